@@ -0,0 +1,347 @@
+/*
+* Opus configuration matrix benchmark, running on the host backend.
+*
+* Does what the CodecOpusEncoder sample does (encode Resources/SampleBgm0-1ch.wav at its own rate,
+* decode at 48 kHz) for every combination of frame duration x bit rate x coding mode x complexity,
+* and prints one CSV row per combination:
+*   encode_cpu_ms_per_sec / decode_cpu_ms_per_sec  thread CPU time per second of audio, timed per call
+*   peak_heap_bytes                                 heap high-water mark: codec work buffers plus one frame of PCM and packet
+*   compressed_bytes / kbps                         Opus payload without the 8-byte SDK packet header
+*   snr_db                                          decoded vs. original, after the encoder delay, as a sanity check
+* SILK only supports frames of 10 ms and up, so shorter SILK rows are skipped.
+*
+* Build from the repository root against a libopus build:
+*   g++ -O2 -std=c++14 -IHost -I. $(pkg-config --cflags opus) Host/Host*.cpp Host/CodecOpusBenchmark.cpp \
+*       $(pkg-config --libs opus) -lpthread
+*
+* Usage: CodecOpusBenchmark [--wav <file>] [--seconds <audio seconds, 0 = whole file>]
+*        [--frame-durations 2500,5000,10000,20000] [--bitrates 12000,24000,32000,60000]
+*        [--modes celt,silk,auto] [--complexities 0,5,10]
+*/
+
+#include <malloc.h>
+#include <time.h>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+#include <nn/codec.h>
+#include "HostAudioIn.h"
+#include "HostCodec.h"
+
+namespace {
+	// Live and peak bytes allocated through operator new; every buffer the benchmark needs per
+	// configuration goes through it, so the peak covers the whole encode/decode run.
+	std::atomic<uint64_t> g_AllocatedBytes(0);
+	std::atomic<uint64_t> g_PeakAllocatedBytes(0);
+
+	// Behind every replaced operator new and delete, so each pair allocates and frees the same way.
+	void* AllocateCounted(size_t size)
+	{
+		void* p = std::malloc(size == 0 ? 1 : size);
+		if (!p) throw std::bad_alloc();
+		size_t usableSize = malloc_usable_size(p);
+		uint64_t allocated = g_AllocatedBytes.fetch_add(usableSize, std::memory_order_relaxed) + usableSize;
+		uint64_t peak = g_PeakAllocatedBytes.load(std::memory_order_relaxed);
+		while (allocated > peak && !g_PeakAllocatedBytes.compare_exchange_weak(peak, allocated, std::memory_order_relaxed))
+		{
+		}
+		return p;
+	}
+
+	void FreeCounted(void* p)
+	{
+		if (!p) return;
+		g_AllocatedBytes.fetch_sub(malloc_usable_size(p), std::memory_order_relaxed);
+		std::free(p);
+	}
+
+	const int DecoderSampleRate = 48000;
+
+	struct MatrixResult
+	{
+		uint64_t packetCount;
+		uint64_t compressedBytes;
+		int64_t encodeCpuNanoSeconds;
+		int64_t decodeCpuNanoSeconds;
+		uint64_t peakHeapBytes;
+		double snrDb;
+	};
+
+	int64_t GetThreadCpuNanoSeconds()
+	{
+		timespec time;
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+		return static_cast<int64_t>(time.tv_sec) * 1000000000 + time.tv_nsec;
+	}
+
+	void ResetPeakAllocatedBytes()
+	{
+		g_PeakAllocatedBytes.store(g_AllocatedBytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	}
+
+	const char* GetCodingModeName(nn::codec::OpusCodingMode codingMode)
+	{
+		switch (codingMode)
+		{
+		case nn::codec::OpusCodingMode_Celt: return "celt";
+		case nn::codec::OpusCodingMode_Silk: return "silk";
+		default: return "auto";
+		}
+	}
+
+	bool ParseCodingMode(const char* name, size_t length, nn::codec::OpusCodingMode* pOut)
+	{
+		if (length == 4 && std::strncmp(name, "celt", 4) == 0) *pOut = nn::codec::OpusCodingMode_Celt;
+		else if (length == 4 && std::strncmp(name, "silk", 4) == 0) *pOut = nn::codec::OpusCodingMode_Silk;
+		else if (length == 4 && std::strncmp(name, "auto", 4) == 0) *pOut = nn::codec::OpusCodingMode_Auto;
+		else return false;
+		return true;
+	}
+
+	// "a,b,c" into values; false on an empty or malformed list.
+	bool ParseIntList(const char* text, std::vector<int>* pOutValues)
+	{
+		pOutValues->clear();
+		while (*text)
+		{
+			char* end = nullptr;
+			long value = std::strtol(text, &end, 10);
+			if (end == text || (*end != ',' && *end != '\0')) return false;
+			pOutValues->push_back(static_cast<int>(value));
+			text = *end == ',' ? end + 1 : end;
+		}
+		return !pOutValues->empty();
+	}
+
+	bool ParseCodingModeList(const char* text, std::vector<nn::codec::OpusCodingMode>* pOutModes)
+	{
+		pOutModes->clear();
+		while (*text)
+		{
+			const char* end = std::strchr(text, ',');
+			size_t length = end ? static_cast<size_t>(end - text) : std::strlen(text);
+			nn::codec::OpusCodingMode codingMode;
+			if (!ParseCodingMode(text, length, &codingMode)) return false;
+			pOutModes->push_back(codingMode);
+			text += end ? length + 1 : length;
+		}
+		return !pOutModes->empty();
+	}
+
+	// Encodes the clip with one configuration and decodes each packet right away, like the
+	// CodecOpusEncoder sample without the audio renderer. Returns false if the codec rejects the
+	// configuration.
+	bool RunConfiguration(MatrixResult* pOutResult, const int16_t* pcm, int64_t sampleCountPerChannel, int sampleRate, int channelCount,
+		int frameDuration, int bitRate, nn::codec::OpusCodingMode codingMode, int complexity)
+	{
+		ResetPeakAllocatedBytes();
+		const uint64_t baseBytes = g_AllocatedBytes.load(std::memory_order_relaxed);
+		bool isSuccess = false;
+
+		nn::codec::OpusEncoder encoder;
+		const size_t encoderWorkBufferSize = encoder.GetWorkBufferSize(sampleRate, channelCount);
+		char* encoderWorkBuffer = new char[encoderWorkBufferSize];
+		nn::codec::OpusDecoder decoder;
+		const size_t decoderWorkBufferSize = decoder.GetWorkBufferSize(DecoderSampleRate, channelCount);
+		char* decoderWorkBuffer = new char[decoderWorkBufferSize];
+
+		int16_t* inputDataBuffer = nullptr;
+		int16_t* decodedDataBuffer = nullptr;
+		uint8_t* encodedDataBuffer = nullptr;
+
+		do
+		{
+			if (encoder.Initialize(sampleRate, channelCount, encoderWorkBuffer, encoderWorkBufferSize) != nn::codec::OpusResult_Success) break;
+			if (decoder.Initialize(DecoderSampleRate, channelCount, decoderWorkBuffer, decoderWorkBufferSize) != nn::codec::OpusResult_Success) break;
+			encoder.SetBitRate(bitRate);
+			encoder.BindCodingMode(codingMode);
+			if (!HostBackend::SetOpusEncoderComplexity(&encoder, complexity)) break;
+
+			const int encodeSampleCount = encoder.CalculateFrameSampleCount(frameDuration);
+			const int decodeSampleCount = static_cast<int>(static_cast<int64_t>(encodeSampleCount) * DecoderSampleRate / sampleRate);
+			if (encodeSampleCount <= 0) break;
+			const int64_t frameCount = (sampleCountPerChannel + encodeSampleCount - 1) / encodeSampleCount;
+
+			inputDataBuffer = new int16_t[encodeSampleCount * channelCount];
+			decodedDataBuffer = new int16_t[decodeSampleCount * channelCount];
+			encodedDataBuffer = new uint8_t[nn::codec::OpusPacketSizeMaximum];
+
+			// Decoded sample i (at the decoder rate) is source sample i / decimation - delay; the
+			// comparison only makes sense when the decoder rate is a multiple of the source rate.
+			const int decimation = DecoderSampleRate % sampleRate == 0 ? DecoderSampleRate / sampleRate : 0;
+			const int64_t delay = encoder.GetPreSkipSampleCount();
+			int64_t decodedSampleCount = 0;
+			double signal = 0.0;
+			double noise = 0.0;
+
+			// Encode and decode one frame at a time, like the sample; the last frame is padded with silence.
+			bool isFrameSuccess = true;
+			const int16_t* p = pcm;
+			for (int64_t frame = 0; frame < frameCount && isFrameSuccess; frame++)
+			{
+				int64_t remaining = sampleCountPerChannel - frame * encodeSampleCount;
+				size_t copySampleCount = remaining < encodeSampleCount ? static_cast<size_t>(remaining) : encodeSampleCount;
+				if (copySampleCount < static_cast<size_t>(encodeSampleCount)) std::memset(inputDataBuffer, 0, sizeof(int16_t) * channelCount * encodeSampleCount);
+				std::memcpy(inputDataBuffer, p, sizeof(int16_t) * channelCount * copySampleCount);
+				p += copySampleCount * channelCount;
+
+				size_t encodedDataSize = 0;
+				int64_t encodeBegin = GetThreadCpuNanoSeconds();
+				isFrameSuccess = encoder.EncodeInterleaved(&encodedDataSize, encodedDataBuffer, nn::codec::OpusPacketSizeMaximum,
+					inputDataBuffer, encodeSampleCount) == nn::codec::OpusResult_Success;
+				int64_t encodeEnd = GetThreadCpuNanoSeconds();
+				if (!isFrameSuccess) break;
+
+				size_t consumed = 0;
+				int sampleCount = 0;
+				isFrameSuccess = decoder.DecodeInterleaved(&consumed, &sampleCount, decodedDataBuffer, decodeSampleCount * channelCount * sizeof(int16_t),
+					encodedDataBuffer, encodedDataSize) == nn::codec::OpusResult_Success && consumed == encodedDataSize;
+				int64_t decodeEnd = GetThreadCpuNanoSeconds();
+				if (!isFrameSuccess) break;
+
+				pOutResult->packetCount++;
+				pOutResult->compressedBytes += encodedDataSize - nn::codec::OpusPacketHeaderSize;
+				pOutResult->encodeCpuNanoSeconds += encodeEnd - encodeBegin;
+				pOutResult->decodeCpuNanoSeconds += decodeEnd - encodeEnd;
+
+				for (int i = 0; decimation > 0 && i < sampleCount; i += decimation)
+				{
+					int64_t source = (decodedSampleCount + i) / decimation - delay;
+					if (source < 0 || source >= sampleCountPerChannel) continue;
+					for (int channel = 0; channel < channelCount; channel++)
+					{
+						double original = pcm[source * channelCount + channel];
+						double error = decodedDataBuffer[i * channelCount + channel] - original;
+						signal += original * original;
+						noise += error * error;
+					}
+				}
+				decodedSampleCount += sampleCount;
+			}
+			if (!isFrameSuccess) break;
+
+			pOutResult->snrDb = signal > 0.0 ? 10.0 * std::log10(signal / (noise > 0.0 ? noise : 1.0)) : 0.0;
+			isSuccess = true;
+		} while (false);
+
+		pOutResult->peakHeapBytes = g_PeakAllocatedBytes.load(std::memory_order_relaxed) - baseBytes;
+
+		encoder.Finalize();
+		decoder.Finalize();
+		delete[] encodedDataBuffer;
+		delete[] decodedDataBuffer;
+		delete[] inputDataBuffer;
+		delete[] decoderWorkBuffer;
+		delete[] encoderWorkBuffer;
+		return isSuccess;
+	}
+}
+
+void* operator new(size_t size)
+{
+	return AllocateCounted(size);
+}
+
+void* operator new[](size_t size)
+{
+	return AllocateCounted(size);
+}
+
+void operator delete(void* p) noexcept
+{
+	FreeCounted(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	FreeCounted(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	FreeCounted(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+	FreeCounted(p);
+}
+
+int main(int argc, char** argv)
+{
+	const char* wavPath = "Resources/SampleBgm0-1ch.wav";
+	int seconds = 0;
+	std::vector<int> frameDurations = { 2500, 5000, 10000, 20000 };
+	std::vector<int> bitRates = { 12000, 24000, 32000, 60000 };
+	std::vector<nn::codec::OpusCodingMode> codingModes = { nn::codec::OpusCodingMode_Celt, nn::codec::OpusCodingMode_Silk, nn::codec::OpusCodingMode_Auto };
+	std::vector<int> complexities = { 0, 5, 10 };
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		bool isValid = true;
+		if (std::strcmp(argv[i], "--wav") == 0) wavPath = argv[i + 1];
+		else if (std::strcmp(argv[i], "--seconds") == 0) seconds = std::atoi(argv[i + 1]);
+		else if (std::strcmp(argv[i], "--frame-durations") == 0) isValid = ParseIntList(argv[i + 1], &frameDurations);
+		else if (std::strcmp(argv[i], "--bitrates") == 0) isValid = ParseIntList(argv[i + 1], &bitRates);
+		else if (std::strcmp(argv[i], "--modes") == 0) isValid = ParseCodingModeList(argv[i + 1], &codingModes);
+		else if (std::strcmp(argv[i], "--complexities") == 0) isValid = ParseIntList(argv[i + 1], &complexities);
+		else isValid = false;
+		if (!isValid)
+		{
+			std::fprintf(stderr, "invalid argument %s %s\n", argv[i], argv[i + 1]);
+			return 1;
+		}
+	}
+
+	std::vector<int16_t> pcm;
+	int sampleRate = 0;
+	int channelCount = 0;
+	if (!HostBackend::LoadWav(wavPath, &pcm, &sampleRate, &channelCount))
+	{
+		std::fprintf(stderr, "cannot load %s\n", wavPath);
+		return 1;
+	}
+	int64_t sampleCountPerChannel = static_cast<int64_t>(pcm.size()) / channelCount;
+	if (seconds > 0 && static_cast<int64_t>(seconds) * sampleRate < sampleCountPerChannel) sampleCountPerChannel = static_cast<int64_t>(seconds) * sampleRate;
+	const double audioSeconds = static_cast<double>(sampleCountPerChannel) / sampleRate;
+
+	std::printf("frame_duration_us,bitrate,coding_mode,complexity,audio_seconds,packets,compressed_bytes,kbps,"
+		"encode_cpu_ms_per_sec,decode_cpu_ms_per_sec,peak_heap_bytes,snr_db\n");
+	int failureCount = 0;
+	for (int frameDuration : frameDurations)
+	{
+		for (int bitRate : bitRates)
+		{
+			for (nn::codec::OpusCodingMode codingMode : codingModes)
+			{
+				if (codingMode == nn::codec::OpusCodingMode_Silk && frameDuration < 10000) continue;
+				for (int complexity : complexities)
+				{
+					MatrixResult result = {};
+					if (!RunConfiguration(&result, pcm.data(), sampleCountPerChannel, sampleRate, channelCount,
+						frameDuration, bitRate, codingMode, complexity))
+					{
+						std::fprintf(stderr, "failed: frame_duration_us=%d bitrate=%d coding_mode=%s complexity=%d\n",
+							frameDuration, bitRate, GetCodingModeName(codingMode), complexity);
+						failureCount++;
+						continue;
+					}
+					std::printf("%d,%d,%s,%d,%.3f,%llu,%llu,%.2f,%.3f,%.3f,%llu,%.2f\n",
+						frameDuration, bitRate, GetCodingModeName(codingMode), complexity, audioSeconds,
+						static_cast<unsigned long long>(result.packetCount),
+						static_cast<unsigned long long>(result.compressedBytes),
+						result.compressedBytes * 8.0 / audioSeconds / 1000.0,
+						result.encodeCpuNanoSeconds / 1e6 / audioSeconds,
+						result.decodeCpuNanoSeconds / 1e6 / audioSeconds,
+						static_cast<unsigned long long>(result.peakHeapBytes),
+						result.snrDb);
+					std::fflush(stdout);
+				}
+			}
+		}
+	}
+	return failureCount == 0 ? 0 : 1;
+}
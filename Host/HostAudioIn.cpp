@@ -0,0 +1,380 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <nn/audio.h>
+#include "HostAudioIn.h"
+
+namespace nn { namespace audio {
+	namespace detail {
+		// Fixed-capacity FIFO, so the fake device never allocates while streaming.
+		class AudioInBufferQueue
+		{
+		public:
+			static const int Capacity = 32;
+			AudioInBufferQueue() : m_Head(0), m_Count(0) {}
+			bool empty() const { return m_Count == 0; }
+			AudioInBuffer* front() const { return m_Buffers[m_Head]; }
+			void pop_front() { m_Head = (m_Head + 1) % Capacity; m_Count--; }
+			bool push_back(AudioInBuffer* pBuffer)
+			{
+				if (m_Count == Capacity) return false;
+				m_Buffers[(m_Head + m_Count) % Capacity] = pBuffer;
+				m_Count++;
+				return true;
+			}
+			bool contains(const AudioInBuffer* pBuffer) const
+			{
+				for (int i = 0; i < m_Count; i++) if (m_Buffers[(m_Head + i) % Capacity] == pBuffer) return true;
+				return false;
+			}
+		private:
+			AudioInBuffer* m_Buffers[Capacity];
+			int m_Head;
+			int m_Count;
+		};
+
+		struct AudioInImpl
+		{
+			std::mutex mutex;
+			std::condition_variable condition;
+			AudioInBufferQueue appended;
+			AudioInBufferQueue released;
+			os::SystemEvent* pEvent;
+			std::thread* pDeviceThread;
+			bool running;
+			bool realTime;
+			int channelCount;
+			int sampleRate;
+			uint64_t captureCursor; // in frames since StartAudioIn
+		};
+	}
+}}
+
+namespace {
+	using namespace nn::audio;
+
+	const char DefaultWavPath[] = "Resources/SampleBgm0-1ch.wav";
+	const char DefaultDeviceName[] = "BuiltInHeadset";
+	const int MaxDeviceCount = 4;
+
+	std::vector<int16_t> g_SourceSamples;
+	int g_SourceSampleRate = 48000;
+	int g_SourceChannelCount = 1;
+	int g_DeviceChannelCount = 2;
+	bool g_SourceLoaded = false;
+	bool g_RealTime = true;
+	int g_DeviceCount = 1;
+
+	uint32_t ReadU32(const uint8_t* p) { return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24); }
+	uint16_t ReadU16(const uint8_t* p) { return static_cast<uint16_t>(p[0] | (p[1] << 8)); }
+
+	void EnsureSourceLoaded()
+	{
+		if (g_SourceLoaded) return;
+		const char* path = std::getenv("WNTGD_HOST_WAV");
+		if (!path) path = DefaultWavPath;
+		if (!HostBackend::LoadWav(path, &g_SourceSamples, &g_SourceSampleRate, &g_SourceChannelCount))
+		{
+			std::fprintf(stderr, "HostAudioIn: cannot load %s, capturing silence\n", path);
+		}
+		g_SourceLoaded = true;
+	}
+
+	void FillBuffer(detail::AudioInImpl* pImpl, AudioInBuffer* pBuffer)
+	{
+		int16_t* out = static_cast<int16_t*>(pBuffer->buffer);
+		size_t frameCount = pBuffer->dataSize / (sizeof(int16_t) * pImpl->channelCount);
+		size_t sourceFrameCount = g_SourceSamples.size() / g_SourceChannelCount;
+		for (size_t i = 0; i < frameCount; i++)
+		{
+			int16_t value = 0;
+			if (sourceFrameCount > 0)
+			{
+				value = g_SourceSamples[((pImpl->captureCursor + i) % sourceFrameCount) * g_SourceChannelCount];
+			}
+			for (int c = 0; c < pImpl->channelCount; c++) out[i * pImpl->channelCount + c] = value;
+		}
+		pBuffer->size = frameCount * sizeof(int16_t) * pImpl->channelCount;
+		pImpl->captureCursor += frameCount;
+	}
+
+	// Emulates the audio driver: a buffer is released once real time has passed its end.
+	void DeviceThread(detail::AudioInImpl* pImpl)
+	{
+		auto start = std::chrono::steady_clock::now();
+		std::unique_lock<std::mutex> lock(pImpl->mutex);
+		while (pImpl->running)
+		{
+			auto elapsed = std::chrono::steady_clock::now() - start;
+			uint64_t nowFrames = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count() * pImpl->sampleRate / 1000000;
+
+			if (pImpl->appended.empty())
+			{
+				// Nothing to record into: this audio is lost.
+				if (pImpl->captureCursor < nowFrames) pImpl->captureCursor = nowFrames;
+				pImpl->condition.wait_for(lock, std::chrono::milliseconds(1));
+				continue;
+			}
+
+			AudioInBuffer* pBuffer = pImpl->appended.front();
+			uint64_t frameCount = pBuffer->dataSize / (sizeof(int16_t) * pImpl->channelCount);
+			uint64_t endFrame = pImpl->captureCursor + frameCount;
+			if (endFrame <= nowFrames)
+			{
+				pImpl->appended.pop_front();
+				FillBuffer(pImpl, pBuffer);
+				pImpl->released.push_back(pBuffer);
+				if (pImpl->pEvent) pImpl->pEvent->Signal();
+				continue;
+			}
+
+			auto deadline = start + std::chrono::microseconds(endFrame * 1000000 / pImpl->sampleRate);
+			pImpl->condition.wait_until(lock, deadline);
+		}
+	}
+
+	nn::Result OpenFakeAudioIn(AudioIn* pOutAudioIn, nn::os::SystemEvent* pOutSystemEvent)
+	{
+		EnsureSourceLoaded();
+		detail::AudioInImpl* pImpl = new detail::AudioInImpl();
+		pImpl->pEvent = pOutSystemEvent;
+		pImpl->pDeviceThread = nullptr;
+		pImpl->running = false;
+		pImpl->realTime = g_RealTime;
+		pImpl->channelCount = g_DeviceChannelCount;
+		pImpl->sampleRate = g_SourceSampleRate;
+		pImpl->captureCursor = 0;
+		pOutAudioIn->pImpl = pImpl;
+		return nn::ResultSuccess();
+	}
+}
+
+namespace HostBackend {
+	bool SetAudioInSource(const char* wavPath, int channelCount)
+	{
+		g_DeviceChannelCount = channelCount;
+		g_SourceLoaded = true;
+		return LoadWav(wavPath, &g_SourceSamples, &g_SourceSampleRate, &g_SourceChannelCount);
+	}
+
+	void SetAudioInRealTime(bool realTime)
+	{
+		g_RealTime = realTime;
+	}
+
+	void SetAudioInDeviceCount(int count)
+	{
+		g_DeviceCount = count < 1 ? 1 : (count > MaxDeviceCount ? MaxDeviceCount : count);
+	}
+
+	bool LoadWav(const char* wavPath, std::vector<int16_t>* pOutSamples, int* pOutSampleRate, int* pOutChannelCount)
+	{
+		FILE* file = std::fopen(wavPath, "rb");
+		if (!file) return false;
+		std::vector<uint8_t> data;
+		uint8_t chunk[4096];
+		size_t read;
+		while ((read = std::fread(chunk, 1, sizeof(chunk), file)) > 0) data.insert(data.end(), chunk, chunk + read);
+		std::fclose(file);
+
+		if (data.size() < 12 || std::memcmp(&data[0], "RIFF", 4) != 0 || std::memcmp(&data[8], "WAVE", 4) != 0) return false;
+
+		bool hasFormat = false;
+		size_t offset = 12;
+		while (offset + 8 <= data.size())
+		{
+			uint32_t chunkSize = ReadU32(&data[offset + 4]);
+			const uint8_t* body = &data[offset + 8];
+			if (offset + 8 + chunkSize > data.size()) chunkSize = static_cast<uint32_t>(data.size() - offset - 8);
+
+			if (std::memcmp(&data[offset], "fmt ", 4) == 0 && chunkSize >= 16)
+			{
+				if (ReadU16(body) != 1 || ReadU16(body + 14) != 16) return false; // 16-bit PCM only
+				*pOutChannelCount = ReadU16(body + 2);
+				*pOutSampleRate = static_cast<int>(ReadU32(body + 4));
+				hasFormat = true;
+			}
+			else if (std::memcmp(&data[offset], "data", 4) == 0 && hasFormat)
+			{
+				pOutSamples->resize(chunkSize / sizeof(int16_t));
+				std::memcpy(pOutSamples->data(), body, pOutSamples->size() * sizeof(int16_t));
+				return true;
+			}
+			offset += 8 + chunkSize + (chunkSize & 1);
+		}
+		return false;
+	}
+}
+
+namespace nn { namespace audio {
+	size_t GetSampleByteSize(SampleFormat sampleFormat)
+	{
+		switch (sampleFormat)
+		{
+		case SampleFormat_PcmInt8: return 1;
+		case SampleFormat_PcmInt16: return 2;
+		case SampleFormat_PcmInt24: return 3;
+		case SampleFormat_PcmInt32: return 4;
+		case SampleFormat_PcmFloat: return 4;
+		default: return 0;
+		}
+	}
+
+	void InitializeAudioInParameter(AudioInParameter* pOutParameter)
+	{
+		pOutParameter->sampleRate = 0;
+	}
+
+	int ListAudioIns(AudioInInfo* pOutInfos, int count)
+	{
+		int listed = count < g_DeviceCount ? count : g_DeviceCount;
+		for (int i = 0; i < listed; i++)
+		{
+			if (i == 0) std::snprintf(pOutInfos[i].name, AudioInNameLength, "%s", DefaultDeviceName);
+			else std::snprintf(pOutInfos[i].name, AudioInNameLength, "UacDevice%d", i);
+		}
+		return listed;
+	}
+
+	Result OpenDefaultAudioIn(AudioIn* pOutAudioIn, const AudioInParameter& parameter)
+	{
+		(void)parameter;
+		return OpenFakeAudioIn(pOutAudioIn, nullptr);
+	}
+
+	Result OpenDefaultAudioIn(AudioIn* pOutAudioIn, os::SystemEvent* pOutSystemEvent, const AudioInParameter& parameter)
+	{
+		(void)parameter;
+		return OpenFakeAudioIn(pOutAudioIn, pOutSystemEvent);
+	}
+
+	Result OpenAudioIn(AudioIn* pOutAudioIn, os::SystemEvent* pOutSystemEvent, const char* name, const AudioInParameter& parameter)
+	{
+		(void)parameter;
+		AudioInInfo infos[MaxDeviceCount];
+		int count = ListAudioIns(infos, MaxDeviceCount);
+		for (int i = 0; i < count; i++)
+		{
+			if (std::strcmp(infos[i].name, name) == 0) return OpenFakeAudioIn(pOutAudioIn, pOutSystemEvent);
+		}
+		return Result(1);
+	}
+
+	void CloseAudioIn(AudioIn* pAudioIn)
+	{
+		StopAudioIn(pAudioIn);
+		delete pAudioIn->pImpl;
+		pAudioIn->pImpl = nullptr;
+	}
+
+	Result StartAudioIn(AudioIn* pAudioIn)
+	{
+		detail::AudioInImpl* pImpl = pAudioIn->pImpl;
+		std::lock_guard<std::mutex> lock(pImpl->mutex);
+		if (pImpl->running) return Result(1);
+		pImpl->running = true;
+		pImpl->captureCursor = 0;
+		if (pImpl->realTime) pImpl->pDeviceThread = new std::thread(DeviceThread, pImpl);
+		return ResultSuccess();
+	}
+
+	void StopAudioIn(AudioIn* pAudioIn)
+	{
+		detail::AudioInImpl* pImpl = pAudioIn->pImpl;
+		if (!pImpl) return;
+		{
+			std::lock_guard<std::mutex> lock(pImpl->mutex);
+			pImpl->running = false;
+		}
+		pImpl->condition.notify_all();
+		if (pImpl->pDeviceThread)
+		{
+			pImpl->pDeviceThread->join();
+			delete pImpl->pDeviceThread;
+			pImpl->pDeviceThread = nullptr;
+		}
+	}
+
+	AudioInState GetAudioInState(const AudioIn* pAudioIn)
+	{
+		return pAudioIn->pImpl->running ? AudioInState_Started : AudioInState_Stopped;
+	}
+
+	int GetAudioInChannelCount(const AudioIn* pAudioIn)
+	{
+		return pAudioIn->pImpl->channelCount;
+	}
+
+	int GetAudioInSampleRate(const AudioIn* pAudioIn)
+	{
+		return pAudioIn->pImpl->sampleRate;
+	}
+
+	SampleFormat GetAudioInSampleFormat(const AudioIn* pAudioIn)
+	{
+		(void)pAudioIn;
+		return SampleFormat_PcmInt16;
+	}
+
+	void SetAudioInBufferInfo(AudioInBuffer* pOutAudioInBuffer, void* buffer, size_t bufferSize, size_t dataSize)
+	{
+		pOutAudioInBuffer->buffer = buffer;
+		pOutAudioInBuffer->bufferSize = bufferSize;
+		pOutAudioInBuffer->dataSize = dataSize;
+		pOutAudioInBuffer->size = 0;
+	}
+
+	void* GetAudioInBufferDataPointer(const AudioInBuffer* pAudioInBuffer)
+	{
+		return pAudioInBuffer->buffer;
+	}
+
+	size_t GetAudioInBufferDataSize(const AudioInBuffer* pAudioInBuffer)
+	{
+		return pAudioInBuffer->size;
+	}
+
+	size_t GetAudioInBufferBufferSize(const AudioInBuffer* pAudioInBuffer)
+	{
+		return pAudioInBuffer->bufferSize;
+	}
+
+	bool AppendAudioInBuffer(AudioIn* pAudioIn, AudioInBuffer* pAudioInBuffer)
+	{
+		detail::AudioInImpl* pImpl = pAudioIn->pImpl;
+		{
+			std::lock_guard<std::mutex> lock(pImpl->mutex);
+			if (!pImpl->appended.push_back(pAudioInBuffer)) return false;
+		}
+		pImpl->condition.notify_all();
+		// A free-running device always has data ready, so wake event waiters right away.
+		if (!pImpl->realTime && pImpl->pEvent) pImpl->pEvent->Signal();
+		return true;
+	}
+
+	AudioInBuffer* GetReleasedAudioInBuffer(AudioIn* pAudioIn)
+	{
+		detail::AudioInImpl* pImpl = pAudioIn->pImpl;
+		std::lock_guard<std::mutex> lock(pImpl->mutex);
+		if (!pImpl->realTime && pImpl->released.empty() && !pImpl->appended.empty())
+		{
+			AudioInBuffer* pBuffer = pImpl->appended.front();
+			pImpl->appended.pop_front();
+			FillBuffer(pImpl, pBuffer);
+			pImpl->released.push_back(pBuffer);
+		}
+		if (pImpl->released.empty()) return nullptr;
+		AudioInBuffer* pBuffer = pImpl->released.front();
+		pImpl->released.pop_front();
+		return pBuffer;
+	}
+
+	bool ContainsAudioInBuffer(const AudioIn* pAudioIn, const AudioInBuffer* pAudioInBuffer)
+	{
+		detail::AudioInImpl* pImpl = pAudioIn->pImpl;
+		std::lock_guard<std::mutex> lock(pImpl->mutex);
+		return pImpl->appended.contains(pAudioInBuffer) || pImpl->released.contains(pAudioInBuffer);
+	}
+}}
@@ -0,0 +1,25 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+
+// Host-only controls for the fake AudioIn device in HostAudioIn.cpp.
+// The fake device replays a WAV file (Resources/SampleBgm0-1ch.wav by default, or $WNTGD_HOST_WAV)
+// as if it were the microphone, looping at the end of the file.
+namespace HostBackend {
+	// Selects the file replayed by the fake microphone and the channel count it reports.
+	// A mono file is duplicated to every channel, like a headset mic exposed as stereo.
+	bool SetAudioInSource(const char* wavPath, int channelCount);
+
+	// Real time (default): buffers are released at the pace of the sample rate by a device thread,
+	// and audio that arrives while no buffer is appended is lost.
+	// Free running: GetReleasedAudioInBuffer fills and releases the oldest appended buffer immediately,
+	// which lets benchmarks drive the capture path as fast as the CPU allows.
+	void SetAudioInRealTime(bool realTime);
+
+	// Number of devices ListAudioIns reports (1 to 4, default 1): "BuiltInHeadset", then "UacDevice1"
+	// and up, e.g. to test several local talkers. They all replay the same source.
+	void SetAudioInDeviceCount(int count);
+
+	// Loads 16-bit PCM from a WAV file. Returns interleaved samples.
+	bool LoadWav(const char* wavPath, std::vector<int16_t>* pOutSamples, int* pOutSampleRate, int* pOutChannelCount);
+}
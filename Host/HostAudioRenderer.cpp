@@ -0,0 +1,376 @@
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <nn/audio.h>
+#include "HostAudioRenderer.h"
+
+namespace nn { namespace audio {
+	namespace detail {
+		// Fixed-capacity FIFO of wave buffers, so the fake renderer never allocates while streaming.
+		class WaveBufferQueue
+		{
+		public:
+			static const int Capacity = 8;
+			WaveBufferQueue() : m_Head(0), m_Count(0) {}
+			bool empty() const { return m_Count == 0; }
+			void clear() { m_Count = 0; }
+			const WaveBuffer* front() const { return m_Buffers[m_Head]; }
+			void pop_front() { m_Head = (m_Head + 1) % Capacity; m_Count--; }
+			bool push_back(const WaveBuffer* pBuffer)
+			{
+				if (m_Count == Capacity) return false;
+				m_Buffers[(m_Head + m_Count) % Capacity] = pBuffer;
+				m_Count++;
+				return true;
+			}
+		private:
+			const WaveBuffer* m_Buffers[Capacity];
+			int m_Head;
+			int m_Count;
+		};
+
+		struct VoiceImpl
+		{
+			AudioRendererConfigImpl* pConfig;
+			bool inUse;
+			VoiceType::PlayState playState;
+			int sampleRate;
+			WaveBufferQueue appended;
+			WaveBufferQueue released;
+			int32_t playOffset; // in samples from startSampleOffset of the front buffer
+			float mixVolume[2]; // source channel 0 to final mix channels 0 and 1
+		};
+
+		struct AudioRendererConfigImpl
+		{
+			std::mutex mutex;
+			int voiceCount;
+			VoiceImpl* pVoices; // voiceCount entries, in the config work buffer
+		};
+
+		struct AudioRendererImpl
+		{
+			std::mutex mutex;
+			std::condition_variable condition;
+			os::SystemEvent* pEvent;
+			std::thread* pDeviceThread;
+			bool running;
+			int sampleRate;
+			int sampleCount;
+			AudioRendererConfigImpl* pConfig; // set by RequestUpdateAudioRenderer
+		};
+	}
+}}
+
+namespace {
+	using namespace nn::audio;
+
+	std::mutex g_StatisticsMutex;
+	HostBackend::AudioRendererStatistics g_Statistics;
+
+	size_t AlignUp(size_t value, size_t alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	// Consumes one quantum from a playing voice, releasing the wave buffers it finishes.
+	void RenderVoice(detail::VoiceImpl* pVoice, int sampleCount, HostBackend::AudioRendererStatistics* pStatistics)
+	{
+		int remaining = sampleCount;
+		while (remaining > 0 && !pVoice->appended.empty())
+		{
+			const WaveBuffer* pBuffer = pVoice->appended.front();
+			const int16_t* samples = static_cast<const int16_t*>(pBuffer->buffer) + pBuffer->startSampleOffset + pVoice->playOffset;
+			int available = pBuffer->endSampleOffset - pBuffer->startSampleOffset - pVoice->playOffset;
+			int count = available < remaining ? available : remaining;
+			for (int i = 0; i < count; i++)
+			{
+				double value = samples[i];
+				pStatistics->outputEnergy[0] += value * value * pVoice->mixVolume[0] * pVoice->mixVolume[0];
+				pStatistics->outputEnergy[1] += value * value * pVoice->mixVolume[1] * pVoice->mixVolume[1];
+			}
+			pVoice->playOffset += count;
+			remaining -= count;
+			if (count == available)
+			{
+				pVoice->appended.pop_front();
+				pVoice->released.push_back(pBuffer);
+				pVoice->playOffset = 0;
+			}
+		}
+		pStatistics->starvedSampleCount += remaining;
+	}
+
+	// Emulates the audio DSP: renders a quantum every sampleCount / sampleRate seconds and signals the
+	// renderer event, which is when the application updates its voices.
+	void DeviceThread(detail::AudioRendererImpl* pImpl)
+	{
+		auto start = std::chrono::steady_clock::now();
+		uint64_t quantum = 0;
+		std::unique_lock<std::mutex> lock(pImpl->mutex);
+		while (pImpl->running)
+		{
+			auto deadline = start + std::chrono::microseconds((quantum + 1) * pImpl->sampleCount * 1000000 / pImpl->sampleRate);
+			if (std::chrono::steady_clock::now() < deadline)
+			{
+				pImpl->condition.wait_until(lock, deadline);
+				continue;
+			}
+
+			if (pImpl->pConfig)
+			{
+				std::lock_guard<std::mutex> configLock(pImpl->pConfig->mutex);
+				std::lock_guard<std::mutex> statisticsLock(g_StatisticsMutex);
+				for (int i = 0; i < pImpl->pConfig->voiceCount; i++)
+				{
+					detail::VoiceImpl* pVoice = &pImpl->pConfig->pVoices[i];
+					if (!pVoice->inUse || pVoice->playState != VoiceType::PlayState_Play) continue;
+					RenderVoice(pVoice, static_cast<int>(static_cast<int64_t>(pImpl->sampleCount) * pVoice->sampleRate / pImpl->sampleRate), &g_Statistics);
+				}
+				g_Statistics.quantumCount++;
+			}
+			quantum++;
+			if (pImpl->pEvent) pImpl->pEvent->Signal();
+		}
+	}
+}
+
+namespace HostBackend {
+	void GetAudioRendererStatistics(AudioRendererStatistics* pOutStatistics)
+	{
+		std::lock_guard<std::mutex> lock(g_StatisticsMutex);
+		*pOutStatistics = g_Statistics;
+	}
+}
+
+namespace nn { namespace audio {
+	void InitializeAudioRendererParameter(AudioRendererParameter* pOutParameter)
+	{
+		pOutParameter->sampleRate = 48000;
+		pOutParameter->sampleCount = 240;
+		pOutParameter->mixBufferCount = 1;
+		pOutParameter->subMixCount = 0;
+		pOutParameter->voiceCount = 1;
+		pOutParameter->sinkCount = 1;
+		pOutParameter->effectCount = 0;
+		pOutParameter->performanceFrameCount = 0;
+		pOutParameter->isVoiceDropEnabled = false;
+	}
+
+	bool IsValidAudioRendererParameter(const AudioRendererParameter& parameter)
+	{
+		return (parameter.sampleRate == 32000 || parameter.sampleRate == 48000) &&
+			(parameter.sampleCount == parameter.sampleRate / 200) &&
+			parameter.mixBufferCount > 0 && parameter.voiceCount > 0 && parameter.sinkCount > 0;
+	}
+
+	size_t GetAudioRendererWorkBufferSize(const AudioRendererParameter& parameter)
+	{
+		(void)parameter;
+		return AlignUp(sizeof(detail::AudioRendererImpl), os::MemoryPageSize);
+	}
+
+	size_t GetAudioRendererConfigWorkBufferSize(const AudioRendererParameter& parameter)
+	{
+		return AlignUp(sizeof(detail::AudioRendererConfigImpl), alignof(detail::VoiceImpl)) + parameter.voiceCount * sizeof(detail::VoiceImpl);
+	}
+
+	Result OpenAudioRenderer(AudioRendererHandle* pOutHandle, os::SystemEvent* pOutSystemEvent, const AudioRendererParameter& parameter, void* workBuffer, size_t workBufferSize)
+	{
+		if (!IsValidAudioRendererParameter(parameter) || workBufferSize < GetAudioRendererWorkBufferSize(parameter)) return Result(1);
+		detail::AudioRendererImpl* pImpl = new (workBuffer) detail::AudioRendererImpl();
+		pImpl->pEvent = pOutSystemEvent;
+		pImpl->pDeviceThread = nullptr;
+		pImpl->running = false;
+		pImpl->sampleRate = parameter.sampleRate;
+		pImpl->sampleCount = parameter.sampleCount;
+		pImpl->pConfig = nullptr;
+		pOutHandle->_handle = pImpl;
+		{
+			std::lock_guard<std::mutex> lock(g_StatisticsMutex);
+			std::memset(&g_Statistics, 0, sizeof(g_Statistics));
+		}
+		return ResultSuccess();
+	}
+
+	void CloseAudioRenderer(AudioRendererHandle handle)
+	{
+		StopAudioRenderer(handle);
+		handle._handle->~AudioRendererImpl();
+	}
+
+	Result StartAudioRenderer(AudioRendererHandle handle)
+	{
+		detail::AudioRendererImpl* pImpl = handle._handle;
+		std::lock_guard<std::mutex> lock(pImpl->mutex);
+		if (pImpl->running) return Result(1);
+		pImpl->running = true;
+		pImpl->pDeviceThread = new std::thread(DeviceThread, pImpl);
+		return ResultSuccess();
+	}
+
+	void StopAudioRenderer(AudioRendererHandle handle)
+	{
+		detail::AudioRendererImpl* pImpl = handle._handle;
+		{
+			std::lock_guard<std::mutex> lock(pImpl->mutex);
+			pImpl->running = false;
+		}
+		pImpl->condition.notify_all();
+		if (pImpl->pDeviceThread)
+		{
+			pImpl->pDeviceThread->join();
+			delete pImpl->pDeviceThread;
+			pImpl->pDeviceThread = nullptr;
+		}
+	}
+
+	// Voice changes already take effect immediately on the host; this only hands the config to the
+	// device thread.
+	Result RequestUpdateAudioRenderer(AudioRendererHandle handle, const AudioRendererConfig* pConfig)
+	{
+		detail::AudioRendererImpl* pImpl = handle._handle;
+		std::lock_guard<std::mutex> lock(pImpl->mutex);
+		pImpl->pConfig = pConfig->_pConfig;
+		return ResultSuccess();
+	}
+
+	void InitializeAudioRendererConfig(AudioRendererConfig* pOutConfig, const AudioRendererParameter& parameter, void* buffer, size_t size)
+	{
+		(void)size;
+		detail::AudioRendererConfigImpl* pConfig = new (buffer) detail::AudioRendererConfigImpl();
+		pConfig->voiceCount = parameter.voiceCount;
+		pConfig->pVoices = reinterpret_cast<detail::VoiceImpl*>(static_cast<char*>(buffer) + AlignUp(sizeof(detail::AudioRendererConfigImpl), alignof(detail::VoiceImpl)));
+		for (int i = 0; i < parameter.voiceCount; i++)
+		{
+			detail::VoiceImpl* pVoice = new (&pConfig->pVoices[i]) detail::VoiceImpl();
+			pVoice->pConfig = pConfig;
+			pVoice->inUse = false;
+		}
+		pOutConfig->_pConfig = pConfig;
+	}
+
+	bool AcquireFinalMix(AudioRendererConfig* pConfig, FinalMixType* pOutFinalMix, int bufferCount)
+	{
+		(void)pConfig;
+		pOutFinalMix->bufferCount = bufferCount;
+		return true;
+	}
+
+	Result AddDeviceSink(AudioRendererConfig* pConfig, DeviceSinkType* pOutDeviceSink, FinalMixType* pFinalMix, const int8_t* input, int inputCount, const char* name)
+	{
+		(void)pConfig;
+		(void)pFinalMix;
+		(void)input;
+		(void)name;
+		pOutDeviceSink->inputCount = inputCount;
+		return ResultSuccess();
+	}
+
+	bool AcquireMemoryPool(AudioRendererConfig* pConfig, MemoryPoolType* pOutPool, void* address, size_t size)
+	{
+		(void)pConfig;
+		if (reinterpret_cast<uintptr_t>(address) % MemoryPoolType::AddressAlignment != 0 || size % MemoryPoolType::SizeGranularity != 0) return false;
+		pOutPool->address = address;
+		pOutPool->size = size;
+		pOutPool->attached = false;
+		return true;
+	}
+
+	void ReleaseMemoryPool(AudioRendererConfig* pConfig, MemoryPoolType* pPool)
+	{
+		(void)pConfig;
+		pPool->address = nullptr;
+		pPool->size = 0;
+	}
+
+	bool RequestAttachMemoryPool(MemoryPoolType* pPool)
+	{
+		pPool->attached = true;
+		return true;
+	}
+
+	bool RequestDetachMemoryPool(MemoryPoolType* pPool)
+	{
+		pPool->attached = false;
+		return true;
+	}
+
+	bool IsMemoryPoolAttached(const MemoryPoolType* pPool)
+	{
+		return pPool->attached;
+	}
+
+	bool AcquireVoiceSlot(AudioRendererConfig* pConfig, VoiceType* pOutVoice, int sampleRate, int channelCount, SampleFormat sampleFormat, int priority, const void* parameter, size_t parameterSize)
+	{
+		(void)priority;
+		(void)parameter;
+		(void)parameterSize;
+		if (channelCount != 1 || sampleFormat != SampleFormat_PcmInt16) return false; // all the fake renderer needs
+		detail::AudioRendererConfigImpl* pImpl = pConfig->_pConfig;
+		std::lock_guard<std::mutex> lock(pImpl->mutex);
+		for (int i = 0; i < pImpl->voiceCount; i++)
+		{
+			detail::VoiceImpl* pVoice = &pImpl->pVoices[i];
+			if (pVoice->inUse) continue;
+			pVoice->inUse = true;
+			pVoice->playState = VoiceType::PlayState_Stop;
+			pVoice->sampleRate = sampleRate;
+			pVoice->appended.clear();
+			pVoice->released.clear();
+			pVoice->playOffset = 0;
+			pVoice->mixVolume[0] = 0.0f;
+			pVoice->mixVolume[1] = 0.0f;
+			pOutVoice->_pVoice = pVoice;
+			return true;
+		}
+		return false;
+	}
+
+	void ReleaseVoiceSlot(AudioRendererConfig* pConfig, VoiceType* pVoice)
+	{
+		std::lock_guard<std::mutex> lock(pConfig->_pConfig->mutex);
+		pVoice->_pVoice->inUse = false;
+		pVoice->_pVoice = nullptr;
+	}
+
+	void SetVoiceDestination(AudioRendererConfig* pConfig, VoiceType* pVoice, FinalMixType* pFinalMix)
+	{
+		(void)pConfig;
+		(void)pVoice;
+		(void)pFinalMix;
+	}
+
+	void SetVoicePlayState(VoiceType* pVoice, VoiceType::PlayState playState)
+	{
+		detail::VoiceImpl* pImpl = pVoice->_pVoice;
+		std::lock_guard<std::mutex> lock(pImpl->pConfig->mutex);
+		pImpl->playState = playState;
+	}
+
+	void SetVoiceMixVolume(VoiceType* pVoice, FinalMixType* pFinalMix, float volume, int sourceIndex, int destinationIndex)
+	{
+		(void)pFinalMix;
+		detail::VoiceImpl* pImpl = pVoice->_pVoice;
+		if (sourceIndex != 0 || destinationIndex < 0 || destinationIndex > 1) return;
+		std::lock_guard<std::mutex> lock(pImpl->pConfig->mutex);
+		pImpl->mixVolume[destinationIndex] = volume;
+	}
+
+	bool AppendWaveBuffer(VoiceType* pVoice, const WaveBuffer* pWaveBuffer)
+	{
+		detail::VoiceImpl* pImpl = pVoice->_pVoice;
+		std::lock_guard<std::mutex> lock(pImpl->pConfig->mutex);
+		return pImpl->appended.push_back(pWaveBuffer);
+	}
+
+	const WaveBuffer* GetReleasedWaveBuffer(VoiceType* pVoice)
+	{
+		detail::VoiceImpl* pImpl = pVoice->_pVoice;
+		std::lock_guard<std::mutex> lock(pImpl->pConfig->mutex);
+		if (pImpl->released.empty()) return nullptr;
+		const WaveBuffer* pBuffer = pImpl->released.front();
+		pImpl->released.pop_front();
+		return pBuffer;
+	}
+}}
@@ -0,0 +1,17 @@
+#pragma once
+#include <stdint.h>
+
+// Host-only view of the fake AudioRenderer in HostAudioRenderer.cpp.
+// The fake renderer consumes the wave buffers of every playing voice at the pace of the sample rate,
+// one quantum (AudioRendererParameter::sampleCount) at a time, and discards the mixed output.
+namespace HostBackend {
+	struct AudioRendererStatistics
+	{
+		uint64_t quantumCount; // rendering quanta since the renderer was started
+		uint64_t starvedSampleCount; // samples a playing voice had no wave buffer for
+		double outputEnergy[2]; // sum of squared samples (int16 scale) mixed into final mix channels 0 and 1
+	};
+
+	// Statistics of the renderer opened last.
+	void GetAudioRendererStatistics(AudioRendererStatistics* pOutStatistics);
+}
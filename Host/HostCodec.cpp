@@ -0,0 +1,199 @@
+#include <cstring>
+#include <opus.h>
+#include <nn/codec.h>
+#include "HostCodec.h"
+
+namespace nn { namespace codec {
+	namespace {
+		// OPUS_SET_FORCE_MODE is only declared in libopus' private header.
+		const int OpusSetForceModeRequest = 11002;
+		const int OpusModeAuto = OPUS_AUTO;
+		const int OpusModeSilkOnly = 1000;
+		const int OpusModeCeltOnly = 1002;
+
+		void WriteU32BigEndian(uint8_t* p, uint32_t value)
+		{
+			p[0] = static_cast<uint8_t>(value >> 24);
+			p[1] = static_cast<uint8_t>(value >> 16);
+			p[2] = static_cast<uint8_t>(value >> 8);
+			p[3] = static_cast<uint8_t>(value);
+		}
+
+		uint32_t ReadU32BigEndian(const uint8_t* p)
+		{
+			return (static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+		}
+
+		bool IsValidSampleRate(int sampleRate)
+		{
+			return sampleRate == 8000 || sampleRate == 12000 || sampleRate == 16000 || sampleRate == 24000 || sampleRate == 48000;
+		}
+
+		::OpusEncoder* EncoderState(void* pState) { return static_cast<::OpusEncoder*>(pState); }
+		::OpusDecoder* DecoderState(void* pState) { return static_cast<::OpusDecoder*>(pState); }
+	}
+
+	OpusEncoder::OpusEncoder() : m_pState(nullptr), m_SampleRate(0), m_ChannelCount(0), m_CodingMode(OpusCodingMode_Auto) {}
+	OpusEncoder::~OpusEncoder() {}
+
+	size_t OpusEncoder::GetWorkBufferSize(int sampleRate, int channelCount) const
+	{
+		(void)sampleRate;
+		return static_cast<size_t>(opus_encoder_get_size(channelCount));
+	}
+
+	OpusResult OpusEncoder::Initialize(int sampleRate, int channelCount, void* buffer, size_t size)
+	{
+		if (!IsValidSampleRate(sampleRate)) return OpusResult_InvalidSampleRate;
+		if (channelCount != 1 && channelCount != 2) return OpusResult_InvalidChannelCount;
+		if (!buffer || size < GetWorkBufferSize(sampleRate, channelCount)) return OpusResult_InvalidWorkBuffer;
+
+		::OpusEncoder* pState = static_cast<::OpusEncoder*>(buffer);
+		if (opus_encoder_init(pState, sampleRate, channelCount, OPUS_APPLICATION_VOIP) != OPUS_OK) return OpusResult_InternalError;
+		m_pState = pState;
+		m_SampleRate = sampleRate;
+		m_ChannelCount = channelCount;
+		BindCodingMode(OpusCodingMode_Auto);
+		return OpusResult_Success;
+	}
+
+	void OpusEncoder::Finalize()
+	{
+		m_pState = nullptr;
+	}
+
+	void OpusEncoder::SetBitRate(int bitRate)
+	{
+		opus_encoder_ctl(EncoderState(m_pState), OPUS_SET_BITRATE(bitRate));
+	}
+
+	int OpusEncoder::GetBitRate() const
+	{
+		opus_int32 bitRate = 0;
+		opus_encoder_ctl(EncoderState(m_pState), OPUS_GET_BITRATE(&bitRate));
+		return bitRate;
+	}
+
+	void OpusEncoder::SetBitRateControl(OpusBitRateControl bitRateControl)
+	{
+		opus_encoder_ctl(EncoderState(m_pState), OPUS_SET_VBR(bitRateControl == OpusBitRateControl_Cbr ? 0 : 1));
+		opus_encoder_ctl(EncoderState(m_pState), OPUS_SET_VBR_CONSTRAINT(bitRateControl == OpusBitRateControl_Cvbr ? 1 : 0));
+	}
+
+	OpusBitRateControl OpusEncoder::GetBitRateControl() const
+	{
+		opus_int32 vbr = 0;
+		opus_int32 constrained = 0;
+		opus_encoder_ctl(EncoderState(m_pState), OPUS_GET_VBR(&vbr));
+		opus_encoder_ctl(EncoderState(m_pState), OPUS_GET_VBR_CONSTRAINT(&constrained));
+		if (!vbr) return OpusBitRateControl_Cbr;
+		return constrained ? OpusBitRateControl_Cvbr : OpusBitRateControl_Vbr;
+	}
+
+	void OpusEncoder::BindCodingMode(OpusCodingMode codingMode)
+	{
+		int mode = OpusModeAuto;
+		if (codingMode == OpusCodingMode_Celt) mode = OpusModeCeltOnly;
+		else if (codingMode == OpusCodingMode_Silk) mode = OpusModeSilkOnly;
+		opus_encoder_ctl(EncoderState(m_pState), OpusSetForceModeRequest, static_cast<opus_int32>(mode));
+		m_CodingMode = codingMode;
+	}
+
+	int OpusEncoder::CalculateFrameSampleCount(int frameDuration) const
+	{
+		return static_cast<int>(static_cast<int64_t>(m_SampleRate) * frameDuration / 1000000);
+	}
+
+	int OpusEncoder::GetPreSkipSampleCount() const
+	{
+		opus_int32 lookahead = 0;
+		opus_encoder_ctl(EncoderState(m_pState), OPUS_GET_LOOKAHEAD(&lookahead));
+		return lookahead;
+	}
+
+	OpusResult OpusEncoder::EncodeInterleaved(size_t* pOutputSize, void* outputBuffer, size_t outputBufferSize,
+		const int16_t* inputBuffer, int inputSampleCountPerChannel)
+	{
+		if (outputBufferSize <= OpusPacketHeaderSize) return OpusResult_InsufficientOpusBuffer;
+		uint8_t* out = static_cast<uint8_t*>(outputBuffer);
+		opus_int32 payloadSize = opus_encode(EncoderState(m_pState), inputBuffer, inputSampleCountPerChannel,
+			out + OpusPacketHeaderSize, static_cast<opus_int32>(outputBufferSize - OpusPacketHeaderSize));
+		if (payloadSize == OPUS_BUFFER_TOO_SMALL) return OpusResult_InsufficientOpusBuffer;
+		if (payloadSize < 0) return OpusResult_InternalError;
+
+		opus_uint32 finalRange = 0;
+		opus_encoder_ctl(EncoderState(m_pState), OPUS_GET_FINAL_RANGE(&finalRange));
+		WriteU32BigEndian(out, static_cast<uint32_t>(payloadSize));
+		WriteU32BigEndian(out + 4, finalRange);
+		*pOutputSize = OpusPacketHeaderSize + payloadSize;
+		return OpusResult_Success;
+	}
+
+	OpusDecoder::OpusDecoder() : m_pState(nullptr), m_SampleRate(0), m_ChannelCount(0) {}
+	OpusDecoder::~OpusDecoder() {}
+
+	size_t OpusDecoder::GetWorkBufferSize(int sampleRate, int channelCount) const
+	{
+		(void)sampleRate;
+		return static_cast<size_t>(opus_decoder_get_size(channelCount));
+	}
+
+	OpusResult OpusDecoder::Initialize(int sampleRate, int channelCount, void* buffer, size_t size)
+	{
+		if (!IsValidSampleRate(sampleRate)) return OpusResult_InvalidSampleRate;
+		if (channelCount != 1 && channelCount != 2) return OpusResult_InvalidChannelCount;
+		if (!buffer || size < GetWorkBufferSize(sampleRate, channelCount)) return OpusResult_InvalidWorkBuffer;
+
+		::OpusDecoder* pState = static_cast<::OpusDecoder*>(buffer);
+		if (opus_decoder_init(pState, sampleRate, channelCount) != OPUS_OK) return OpusResult_InternalError;
+		m_pState = pState;
+		m_SampleRate = sampleRate;
+		m_ChannelCount = channelCount;
+		return OpusResult_Success;
+	}
+
+	void OpusDecoder::Finalize()
+	{
+		m_pState = nullptr;
+	}
+
+	OpusResult OpusDecoder::DecodeInterleaved(size_t* pOutConsumed, int* pOutSampleCount, int16_t* pOutputBuffer, size_t outputSize,
+		const void* pInputBuffer, size_t inputSize)
+	{
+		const uint8_t* in = static_cast<const uint8_t*>(pInputBuffer);
+		if (inputSize < OpusPacketHeaderSize) return OpusResult_InvalidPacket;
+		uint32_t payloadSize = ReadU32BigEndian(in);
+		if (payloadSize > inputSize - OpusPacketHeaderSize) return OpusResult_InvalidPacket;
+
+		int packetSampleCount = opus_decoder_get_nb_samples(DecoderState(m_pState), in + OpusPacketHeaderSize, payloadSize);
+		if (packetSampleCount < 0) return OpusResult_InvalidPacket;
+		if (static_cast<size_t>(packetSampleCount) * m_ChannelCount * sizeof(int16_t) > outputSize) return OpusResult_InsufficientPcmBuffer;
+
+		int sampleCount = opus_decode(DecoderState(m_pState), in + OpusPacketHeaderSize, payloadSize,
+			pOutputBuffer, packetSampleCount, 0);
+		if (sampleCount < 0) return OpusResult_InvalidPacket;
+		// the decoder ends in the encoder's final range only if the packet arrived intact
+		opus_uint32 finalRange = 0;
+		opus_decoder_ctl(DecoderState(m_pState), OPUS_GET_FINAL_RANGE(&finalRange));
+		if (finalRange != ReadU32BigEndian(in + 4)) return OpusResult_InvalidPacket;
+
+		*pOutConsumed = OpusPacketHeaderSize + payloadSize;
+		*pOutSampleCount = sampleCount;
+		return OpusResult_Success;
+	}
+}}
+
+namespace HostBackend {
+	bool SetOpusEncoderComplexity(nn::codec::OpusEncoder* pEncoder, int complexity)
+	{
+		if (!pEncoder->IsInitialized() || complexity < 0 || complexity > 10) return false;
+		return opus_encoder_ctl(static_cast<::OpusEncoder*>(pEncoder->m_pState), OPUS_SET_COMPLEXITY(complexity)) == OPUS_OK;
+	}
+
+	int GetOpusEncoderComplexity(const nn::codec::OpusEncoder* pEncoder)
+	{
+		opus_int32 complexity = 0;
+		if (pEncoder->IsInitialized()) opus_encoder_ctl(static_cast<::OpusEncoder*>(pEncoder->m_pState), OPUS_GET_COMPLEXITY(&complexity));
+		return complexity;
+	}
+}
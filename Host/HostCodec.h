@@ -0,0 +1,12 @@
+#pragma once
+#include <nn/codec.h>
+
+// Host-only controls for the libopus-backed codec in HostCodec.cpp.
+namespace HostBackend {
+	// libopus encoder complexity, 0 (fastest) to 10 (best quality, the libopus default).
+	// The SDK encoder runs at a fixed complexity; benchmarks use this to see what a cheaper
+	// or more expensive setting would cost. Returns false for an uninitialized encoder or an
+	// out-of-range value.
+	bool SetOpusEncoderComplexity(nn::codec::OpusEncoder* pEncoder, int complexity);
+	int GetOpusEncoderComplexity(const nn::codec::OpusEncoder* pEncoder);
+}
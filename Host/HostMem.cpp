@@ -0,0 +1,132 @@
+#include <nn/mem.h>
+
+namespace nn { namespace mem {
+	namespace {
+		const size_t MinimumAlignment = 16;
+
+		// Stored right before every returned address.
+		struct AllocationHeader
+		{
+			char* blockStart;
+			size_t blockSize;
+		};
+	}
+
+	void StandardAllocator::Initialize(void* address, size_t size)
+	{
+		char* start = reinterpret_cast<char*>(util::align_up(reinterpret_cast<uintptr_t>(address), MinimumAlignment));
+		size_t lost = start - static_cast<char*>(address);
+		m_pRegion = start;
+		m_RegionSize = size > lost ? util::align_down(size - lost, MinimumAlignment) : 0;
+		m_pFreeList = nullptr;
+		if (m_RegionSize >= sizeof(FreeChunk))
+		{
+			m_pFreeList = reinterpret_cast<FreeChunk*>(m_pRegion);
+			m_pFreeList->size = m_RegionSize;
+			m_pFreeList->pNext = nullptr;
+		}
+	}
+
+	void StandardAllocator::Finalize()
+	{
+		m_pRegion = nullptr;
+		m_RegionSize = 0;
+		m_pFreeList = nullptr;
+	}
+
+	void* StandardAllocator::Allocate(size_t size)
+	{
+		return Allocate(size, MinimumAlignment);
+	}
+
+	void* StandardAllocator::Allocate(size_t size, size_t alignment)
+	{
+		if (alignment < MinimumAlignment) alignment = MinimumAlignment;
+		size = util::align_up(size == 0 ? 1 : size, MinimumAlignment);
+
+		FreeChunk** ppLink = &m_pFreeList;
+		for (FreeChunk* pChunk = m_pFreeList; pChunk; ppLink = &pChunk->pNext, pChunk = pChunk->pNext)
+		{
+			uintptr_t chunkStart = reinterpret_cast<uintptr_t>(pChunk);
+			uintptr_t chunkEnd = chunkStart + pChunk->size;
+			uintptr_t user = util::align_up(chunkStart + sizeof(AllocationHeader), alignment);
+			uintptr_t end = user + size;
+			if (end > chunkEnd) continue;
+
+			FreeChunk* pNext = pChunk->pNext;
+			if (chunkEnd - end >= sizeof(FreeChunk) + MinimumAlignment)
+			{
+				FreeChunk* pRest = reinterpret_cast<FreeChunk*>(end);
+				pRest->size = chunkEnd - end;
+				pRest->pNext = pNext;
+				*ppLink = pRest;
+			}
+			else
+			{
+				end = chunkEnd;
+				*ppLink = pNext;
+			}
+
+			AllocationHeader* pHeader = reinterpret_cast<AllocationHeader*>(user - sizeof(AllocationHeader));
+			pHeader->blockStart = reinterpret_cast<char*>(chunkStart);
+			pHeader->blockSize = end - chunkStart;
+			return reinterpret_cast<void*>(user);
+		}
+		return nullptr;
+	}
+
+	void StandardAllocator::Free(void* address)
+	{
+		if (!address) return;
+		AllocationHeader* pHeader = reinterpret_cast<AllocationHeader*>(static_cast<char*>(address) - sizeof(AllocationHeader));
+		FreeChunk* pBlock = reinterpret_cast<FreeChunk*>(pHeader->blockStart);
+		pBlock->size = pHeader->blockSize;
+
+		// Keep the free list address-ordered so neighbours can be coalesced.
+		FreeChunk* pPrev = nullptr;
+		FreeChunk* pNext = m_pFreeList;
+		while (pNext && pNext < pBlock)
+		{
+			pPrev = pNext;
+			pNext = pNext->pNext;
+		}
+
+		pBlock->pNext = pNext;
+		if (pNext && reinterpret_cast<char*>(pBlock) + pBlock->size == reinterpret_cast<char*>(pNext))
+		{
+			pBlock->size += pNext->size;
+			pBlock->pNext = pNext->pNext;
+		}
+
+		if (pPrev)
+		{
+			pPrev->pNext = pBlock;
+			if (reinterpret_cast<char*>(pPrev) + pPrev->size == reinterpret_cast<char*>(pBlock))
+			{
+				pPrev->size += pBlock->size;
+				pPrev->pNext = pBlock->pNext;
+			}
+		}
+		else
+		{
+			m_pFreeList = pBlock;
+		}
+	}
+
+	size_t StandardAllocator::GetTotalFreeSize() const
+	{
+		size_t total = 0;
+		for (FreeChunk* pChunk = m_pFreeList; pChunk; pChunk = pChunk->pNext) total += pChunk->size;
+		return total;
+	}
+
+	size_t StandardAllocator::GetAllocatableSize() const
+	{
+		size_t largest = 0;
+		for (FreeChunk* pChunk = m_pFreeList; pChunk; pChunk = pChunk->pNext)
+		{
+			if (pChunk->size > largest) largest = pChunk->size;
+		}
+		return largest > sizeof(AllocationHeader) ? largest - sizeof(AllocationHeader) : 0;
+	}
+}}
@@ -0,0 +1,144 @@
+#include <chrono>
+#include <pthread.h>
+#include <sched.h>
+#include <nn/os.h>
+
+namespace nn { namespace os {
+	namespace {
+		void WaitEvent(SystemEventType* pEvent)
+		{
+			std::unique_lock<std::mutex> lock(pEvent->mutex);
+			pEvent->condition.wait(lock, [pEvent] { return pEvent->signaled; });
+			if (pEvent->clearMode == EventClearMode_AutoClear) pEvent->signaled = false;
+		}
+
+		bool TryWaitEvent(SystemEventType* pEvent)
+		{
+			std::lock_guard<std::mutex> lock(pEvent->mutex);
+			bool signaled = pEvent->signaled;
+			if (signaled && pEvent->clearMode == EventClearMode_AutoClear) pEvent->signaled = false;
+			return signaled;
+		}
+
+		bool TimedWaitEvent(SystemEventType* pEvent, TimeSpan timeout)
+		{
+			std::unique_lock<std::mutex> lock(pEvent->mutex);
+			bool signaled = pEvent->condition.wait_for(lock, std::chrono::nanoseconds(timeout.GetNanoSeconds()),
+				[pEvent] { return pEvent->signaled; });
+			if (signaled && pEvent->clearMode == EventClearMode_AutoClear) pEvent->signaled = false;
+			return signaled;
+		}
+
+		void SignalEvent(SystemEventType* pEvent)
+		{
+			{
+				std::lock_guard<std::mutex> lock(pEvent->mutex);
+				pEvent->signaled = true;
+			}
+			pEvent->condition.notify_all();
+		}
+
+		void ClearEvent(SystemEventType* pEvent)
+		{
+			std::lock_guard<std::mutex> lock(pEvent->mutex);
+			pEvent->signaled = false;
+		}
+
+		void ThreadEntry(ThreadType* pThread)
+		{
+			pThread->function(pThread->argument);
+		}
+	}
+
+	void SystemEvent::Wait() { WaitEvent(&m_Event); }
+	bool SystemEvent::TryWait() { return TryWaitEvent(&m_Event); }
+	bool SystemEvent::TimedWait(TimeSpan timeout) { return TimedWaitEvent(&m_Event, timeout); }
+	void SystemEvent::Signal() { SignalEvent(&m_Event); }
+	void SystemEvent::Clear() { ClearEvent(&m_Event); }
+
+	void DestroySystemEvent(SystemEventType* pEvent)
+	{
+		ClearEvent(pEvent);
+	}
+
+	void Event::Wait() { WaitEvent(&m_Event); }
+	bool Event::TryWait() { return TryWaitEvent(&m_Event); }
+	bool Event::TimedWait(TimeSpan timeout) { return TimedWaitEvent(&m_Event, timeout); }
+	void Event::Signal() { SignalEvent(&m_Event); }
+	void Event::Clear() { ClearEvent(&m_Event); }
+
+	Tick GetSystemTick()
+	{
+		auto now = std::chrono::steady_clock::now().time_since_epoch();
+		return Tick(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count());
+	}
+
+	int64_t GetSystemTickFrequency()
+	{
+		return 1000 * 1000 * 1000;
+	}
+
+	TimeSpan ConvertToTimeSpan(Tick tick)
+	{
+		return TimeSpan::FromNanoSeconds(tick.GetInt64Value());
+	}
+
+	Tick ConvertToTick(TimeSpan timeSpan)
+	{
+		return Tick(timeSpan.GetNanoSeconds());
+	}
+
+	void SleepThread(TimeSpan time)
+	{
+		std::this_thread::sleep_for(std::chrono::nanoseconds(time.GetNanoSeconds()));
+	}
+
+	int GetCurrentCoreNumber()
+	{
+		int core = sched_getcpu();
+		return core < 0 ? 0 : core;
+	}
+
+	Result CreateThread(ThreadType* pThread, ThreadFunction function, void* argument, void* stack, size_t stackSize, int priority)
+	{
+		// The host uses the std::thread stack; stack and priority are accepted for signature compatibility.
+		(void)stack;
+		(void)stackSize;
+		(void)priority;
+		pThread->pThread = nullptr;
+		pThread->function = function;
+		pThread->argument = argument;
+		pThread->name = nullptr;
+		return ResultSuccess();
+	}
+
+	Result CreateThread(ThreadType* pThread, ThreadFunction function, void* argument, void* stack, size_t stackSize, int priority, int idealCore)
+	{
+		(void)idealCore;
+		return CreateThread(pThread, function, argument, stack, stackSize, priority);
+	}
+
+	void StartThread(ThreadType* pThread)
+	{
+		pThread->pThread = new std::thread(ThreadEntry, pThread);
+		if (pThread->name) pthread_setname_np(pThread->pThread->native_handle(), pThread->name);
+	}
+
+	void WaitThread(ThreadType* pThread)
+	{
+		if (pThread->pThread && pThread->pThread->joinable()) pThread->pThread->join();
+	}
+
+	void DestroyThread(ThreadType* pThread)
+	{
+		WaitThread(pThread);
+		delete pThread->pThread;
+		pThread->pThread = nullptr;
+	}
+
+	void SetThreadName(ThreadType* pThread, const char* name)
+	{
+		pThread->name = name;
+		if (pThread->pThread) pthread_setname_np(pThread->pThread->native_handle(), name);
+	}
+}}
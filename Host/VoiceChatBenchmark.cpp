@@ -0,0 +1,276 @@
+/*
+* Encode/decode throughput benchmark for the voice chat native code, running on the host backend.
+*
+* The fake AudioIn replays Resources/SampleBgm0-1ch.wav in free-running mode, so the capture and
+* encode path (wntgd_GetVoiceBuffer) and the decode path (wntgd_DecompressVoiceData) run as fast as
+* the CPU allows. Reports frames/sec, ns per frame and heap allocations per frame for each path.
+* decode_batch replays the packets as a lobby of --speakers speakers, one packet per speaker per tick,
+* through wntgd_DecompressSpeakerVoiceDataBatch with --decode-workers worker threads; compare ns per
+* tick across worker counts to see the scaling. --decode-budget and --decode-speakers turn on the decode
+* schedule (wntgd_SetDecodeSchedule), with priorities falling off with the speaker index like distance.
+*
+* Build from the repository root against a libopus build:
+*   g++ -O2 -std=c++14 -IHost -I. $(pkg-config --cflags opus) Host/Host*.cpp Host/VoiceChatBenchmark.cpp \
+*       SwitchVoiceChatNativeCode.cpp SwitchVoiceChatDecodeNativeCode.cpp SwitchVoiceChatMemory.cpp $(pkg-config --libs opus) -lpthread
+*
+* Usage: VoiceChatBenchmark [--seconds <audio seconds>] [--wav <file>] [--speakers <count>] [--decode-workers <count>]
+*                          [--decode-budget <us per tick>] [--decode-speakers <count>]
+*/
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+#include <nn/codec.h>
+#include <nn/os.h>
+#include "HostAudioIn.h"
+#include "../SwitchVoiceChatNativeCode.h"
+#include "../SwitchVoiceChatDecodeNativeCode.h"
+
+namespace {
+	std::atomic<uint64_t> g_AllocationCount(0);
+
+	const int FrameDurationMicroSeconds = 10000;
+	const int DecodeSampleRate = 48000;
+
+	struct BenchmarkResult
+	{
+		uint64_t frameCount;
+		int64_t elapsedNanoSeconds;
+		uint64_t allocationCount;
+	};
+
+	void PrintResult(const char* name, const BenchmarkResult& result)
+	{
+		double frames = result.frameCount > 0 ? static_cast<double>(result.frameCount) : 1.0;
+		std::printf("%-12s frames=%llu frames_per_sec=%.1f ns_per_frame=%.1f allocs_per_frame=%.3f\n",
+			name,
+			static_cast<unsigned long long>(result.frameCount),
+			result.frameCount * 1e9 / (result.elapsedNanoSeconds > 0 ? result.elapsedNanoSeconds : 1),
+			result.elapsedNanoSeconds / frames,
+			result.allocationCount / frames);
+	}
+
+	// Counts the frames in an encoded blob.
+	uint64_t CountPackets(const char* buffer, int count)
+	{
+		uint64_t packets = 0;
+		SwitchVoiceChatFraming::VoiceFrameReader reader(buffer, count);
+		SwitchVoiceChatFraming::VoiceFrame frame;
+		while (reader.Next(&frame)) packets++;
+		return packets;
+	}
+}
+
+void* operator new(size_t size)
+{
+	g_AllocationCount.fetch_add(1, std::memory_order_relaxed);
+	void* p = std::malloc(size == 0 ? 1 : size);
+	if (!p) throw std::bad_alloc();
+	return p;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+	std::free(p);
+}
+
+int main(int argc, char** argv)
+{
+	int seconds = 60;
+	const char* wavPath = "Resources/SampleBgm0-1ch.wav";
+	int speakerCount = 32;
+	int decodeWorkerCount = 0;
+	int decodeBudgetMicroSeconds = 0;
+	int decodeSpeakerCount = 0;
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		if (std::strcmp(argv[i], "--seconds") == 0) seconds = std::atoi(argv[i + 1]);
+		else if (std::strcmp(argv[i], "--wav") == 0) wavPath = argv[i + 1];
+		else if (std::strcmp(argv[i], "--speakers") == 0) speakerCount = std::atoi(argv[i + 1]);
+		else if (std::strcmp(argv[i], "--decode-workers") == 0) decodeWorkerCount = std::atoi(argv[i + 1]);
+		else if (std::strcmp(argv[i], "--decode-budget") == 0) decodeBudgetMicroSeconds = std::atoi(argv[i + 1]);
+		else if (std::strcmp(argv[i], "--decode-speakers") == 0) decodeSpeakerCount = std::atoi(argv[i + 1]);
+	}
+
+	if (!HostBackend::SetAudioInSource(wavPath, 2))
+	{
+		std::fprintf(stderr, "cannot load %s\n", wavPath);
+		return 1;
+	}
+	HostBackend::SetAudioInRealTime(false);
+	// room for every speaker of the lobby, so the batch pass never evicts
+	SwitchVoiceChatMemory::wntgd_SetMemoryBudget(SwitchVoiceChatMemory::wntgd_GetDefaultMemoryBudget(speakerCount));
+
+	if (!SwitchVoiceChatNativeCode::wntgd_StartRecordVoice())
+	{
+		std::fprintf(stderr, "wntgd_StartRecordVoice failed\n");
+		return 1;
+	}
+	if (!SwitchVoiceChatDecodeNativeCode::wntgd_InitializeDecoder())
+	{
+		std::fprintf(stderr, "wntgd_InitializeDecoder failed\n");
+		return 1;
+	}
+
+	const uint64_t targetFrameCount = static_cast<uint64_t>(seconds) * 1000000 / FrameDurationMicroSeconds;
+	std::vector<std::vector<char>> packets;
+
+	// Encode: capture + encode through the public entry point.
+	BenchmarkResult encodeResult = {};
+	while (encodeResult.frameCount < targetFrameCount)
+	{
+		intptr_t handler = 0;
+		char* buffer = nullptr;
+		int count = 0;
+
+		uint64_t allocationsBefore = g_AllocationCount.load(std::memory_order_relaxed);
+		nn::os::Tick begin = nn::os::GetSystemTick();
+		bool hasData = SwitchVoiceChatNativeCode::wntgd_GetVoiceBuffer(&handler, &buffer, &count);
+		nn::os::Tick end = nn::os::GetSystemTick();
+		uint64_t allocationsAfter = g_AllocationCount.load(std::memory_order_relaxed);
+
+		// Keep a copy for the decode pass; not part of the measurement.
+		if (hasData) packets.emplace_back(buffer, buffer + count);
+
+		uint64_t releaseAllocationsBefore = g_AllocationCount.load(std::memory_order_relaxed);
+		nn::os::Tick releaseBegin = nn::os::GetSystemTick();
+		if (handler) SwitchVoiceChatNativeCode::wntgd_ReleaseVoiceBuffer(reinterpret_cast<intptr_t*>(handler));
+		nn::os::Tick releaseEnd = nn::os::GetSystemTick();
+		uint64_t releaseAllocationsAfter = g_AllocationCount.load(std::memory_order_relaxed);
+
+		encodeResult.elapsedNanoSeconds += nn::os::ConvertToTimeSpan((end - begin) + (releaseEnd - releaseBegin)).GetNanoSeconds();
+		encodeResult.allocationCount += (allocationsAfter - allocationsBefore) + (releaseAllocationsAfter - releaseAllocationsBefore);
+		if (hasData) encodeResult.frameCount += CountPackets(packets.back().data(), count);
+	}
+
+	// Decode: every blob produced above, in order.
+	BenchmarkResult decodeResult = {};
+	const int decodeFrameSampleCount = DecodeSampleRate / (1000000 / FrameDurationMicroSeconds);
+	for (auto& packet : packets)
+	{
+		intptr_t handle = 0;
+		float* audioOut = nullptr;
+		int outSampleCount = 0;
+		unsigned int sampleRateOut = 0;
+
+		uint64_t allocationsBefore = g_AllocationCount.load(std::memory_order_relaxed);
+		nn::os::Tick begin = nn::os::GetSystemTick();
+		SwitchVoiceChatDecodeNativeCode::wntgd_DecompressVoiceData(&handle, packet.data(), static_cast<int>(packet.size()),
+			&audioOut, &outSampleCount, &sampleRateOut);
+		SwitchVoiceChatDecodeNativeCode::wntgd_ReleaseDecompressBuffer(reinterpret_cast<intptr_t*>(handle));
+		nn::os::Tick end = nn::os::GetSystemTick();
+		uint64_t allocationsAfter = g_AllocationCount.load(std::memory_order_relaxed);
+
+		decodeResult.elapsedNanoSeconds += nn::os::ConvertToTimeSpan(end - begin).GetNanoSeconds();
+		decodeResult.allocationCount += allocationsAfter - allocationsBefore;
+		decodeResult.frameCount += outSampleCount / decodeFrameSampleCount;
+	}
+
+	// Decode again into a caller-owned buffer, starting from a fresh decoder state.
+	SwitchVoiceChatDecodeNativeCode::wntgd_FinalizeDecoder();
+	SwitchVoiceChatDecodeNativeCode::wntgd_InitializeDecoder();
+	BenchmarkResult decodeIntoResult = {};
+	std::vector<float> decodeOut(DecodeSampleRate);
+	for (auto& packet : packets)
+	{
+		int outSampleCount = 0;
+		unsigned int sampleRateOut = 0;
+
+		uint64_t allocationsBefore = g_AllocationCount.load(std::memory_order_relaxed);
+		nn::os::Tick begin = nn::os::GetSystemTick();
+		SwitchVoiceChatDecodeNativeCode::wntgd_DecompressVoiceDataInto(packet.data(), static_cast<int>(packet.size()),
+			decodeOut.data(), static_cast<int>(decodeOut.size()), &outSampleCount, &sampleRateOut);
+		nn::os::Tick end = nn::os::GetSystemTick();
+		uint64_t allocationsAfter = g_AllocationCount.load(std::memory_order_relaxed);
+
+		decodeIntoResult.elapsedNanoSeconds += nn::os::ConvertToTimeSpan(end - begin).GetNanoSeconds();
+		decodeIntoResult.allocationCount += allocationsAfter - allocationsBefore;
+		decodeIntoResult.frameCount += outSampleCount / decodeFrameSampleCount;
+	}
+
+	// Batch decode: every tick, one packet for each speaker of the lobby.
+	SwitchVoiceChatDecodeNativeCode::wntgd_StartDecodeWorkers(decodeWorkerCount);
+	SwitchVoiceChatDecodeNativeCode::wntgd_SetDecodeSchedule(decodeBudgetMicroSeconds, decodeSpeakerCount);
+	uint64_t skippedJobCount = 0;
+	BenchmarkResult decodeBatchResult = {};
+	std::vector<SwitchVoiceChatDecodeNativeCode::SpeakerDecodeJob> jobs(speakerCount);
+	std::vector<float> batchOut(static_cast<size_t>(speakerCount) * DecodeSampleRate);
+	const uint64_t tickCount = packets.size() < 500 ? packets.size() : 500;
+	for (uint64_t tick = 0; tick < tickCount; tick++)
+	{
+		for (int speaker = 0; speaker < speakerCount; speaker++)
+		{
+			auto& packet = packets[(tick + speaker) % packets.size()];
+			jobs[speaker].speakerId = static_cast<uint64_t>(speaker) + 1;
+			jobs[speaker].inputBuffer = packet.data();
+			jobs[speaker].count = static_cast<int>(packet.size());
+			jobs[speaker].audioOut = batchOut.data() + static_cast<size_t>(speaker) * DecodeSampleRate;
+			jobs[speaker].capacity = DecodeSampleRate;
+		}
+		unsigned int sampleRateOut = 0;
+
+		uint64_t allocationsBefore = g_AllocationCount.load(std::memory_order_relaxed);
+		nn::os::Tick begin = nn::os::GetSystemTick();
+		SwitchVoiceChatDecodeNativeCode::wntgd_DecompressSpeakerVoiceDataBatch(jobs.data(), speakerCount, &sampleRateOut);
+		nn::os::Tick end = nn::os::GetSystemTick();
+		uint64_t allocationsAfter = g_AllocationCount.load(std::memory_order_relaxed);
+
+		decodeBatchResult.elapsedNanoSeconds += nn::os::ConvertToTimeSpan(end - begin).GetNanoSeconds();
+		decodeBatchResult.allocationCount += allocationsAfter - allocationsBefore;
+		for (auto& job : jobs)
+		{
+			decodeBatchResult.frameCount += job.outSampleCount / decodeFrameSampleCount;
+			if (job.skipped) skippedJobCount++;
+		}
+		// priorities only stick to speakers that have a decoder, i.e. after their first batch
+		if (tick == 0)
+		{
+			for (int speaker = 0; speaker < speakerCount; speaker++)
+			{
+				SwitchVoiceChatDecodeNativeCode::wntgd_SetSpeakerPriority(static_cast<uint64_t>(speaker) + 1, 1.0f / (1 + speaker));
+			}
+		}
+	}
+
+	SwitchVoiceChatMemory::MemoryFootprint footprint;
+	SwitchVoiceChatMemory::wntgd_GetMemoryFootprint(&footprint);
+	SwitchVoiceChatDecodeNativeCode::wntgd_FinalizeDecoder();
+	SwitchVoiceChatNativeCode::wntgd_StopRecordVoice();
+
+	PrintResult("encode", encodeResult);
+	PrintResult("decode", decodeResult);
+	PrintResult("decode_into", decodeIntoResult);
+	PrintResult("decode_batch", decodeBatchResult);
+	std::printf("decode_batch speakers=%d workers=%d ns_per_tick=%.1f decoded_per_tick=%.1f skipped_per_tick=%.1f\n", speakerCount, decodeWorkerCount,
+		tickCount > 0 ? static_cast<double>(decodeBatchResult.elapsedNanoSeconds) / tickCount : 0.0,
+		tickCount > 0 ? static_cast<double>(tickCount * speakerCount - skippedJobCount) / tickCount : 0.0,
+		tickCount > 0 ? static_cast<double>(skippedJobCount) / tickCount : 0.0);
+	std::printf("memory budget=%llu peak_used=%llu encoder=%llu decoder=%llu\n",
+		static_cast<unsigned long long>(footprint.budgetSize), static_cast<unsigned long long>(footprint.peakUsedSize),
+		static_cast<unsigned long long>(footprint.categorySizes[SwitchVoiceChatMemory::MemoryCategory_Encoder]),
+		static_cast<unsigned long long>(footprint.categorySizes[SwitchVoiceChatMemory::MemoryCategory_Decoder]));
+	return 0;
+}
@@ -0,0 +1,531 @@
+/*
+* Self-checks for the header-only parts of the voice chat native code, running on the host.
+*
+* Covers the wire format parsers (SwitchVoiceChatFraming.h): frame and bundle round trips, the one to
+* two byte bundle size boundary, and truncated or invalid input. The jitter buffer
+* (SwitchVoiceChatJitterBuffer.h) is played across the sequence number wraparound, in order, reordered
+* and with a lost frame. The resampler (SwitchVoiceChatResampler.h) converts a second of audio from
+* 44.1 to 48 kHz and back, in one call and in uneven chunks, and must write the expected sample count
+* within the output bound. The preprocessor (SwitchVoiceChatPreprocessor.h) must give the input back
+* one block late when both stages are off, attenuate steady noise without losing a louder tone, and
+* settle the AGC gain on quiet and loud talkers. Prints each failed check and exits with 1 if any failed.
+*
+* Build from the repository root (no codec needed):
+*   g++ -O2 -std=c++14 -I. Host/VoiceChatSelfTest.cpp -o VoiceChatSelfTest
+*
+* Usage: VoiceChatSelfTest
+*/
+
+#include <cmath>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "../SwitchVoiceChatFraming.h"
+#include "../SwitchVoiceChatJitterBuffer.h"
+#include "../SwitchVoiceChatPreprocessor.h"
+#include "../SwitchVoiceChatResampler.h"
+
+namespace {
+	int g_CheckCount = 0;
+	int g_FailureCount = 0;
+
+	void Check(bool condition, const char* what)
+	{
+		g_CheckCount++;
+		if (condition) return;
+		g_FailureCount++;
+		std::printf("FAILED: %s\n", what);
+	}
+
+	void FillPattern(char* dest, size_t size, int seed)
+	{
+		for (size_t i = 0; i < size; i++) dest[i] = static_cast<char>(i * 7 + seed);
+	}
+
+	// Appends one frame (header and payload) to buffer.
+	void AppendFrame(std::vector<char>* buffer, const SwitchVoiceChatFraming::VoiceFrame& frame)
+	{
+		size_t offset = buffer->size();
+		buffer->resize(offset + SwitchVoiceChatFraming::VoiceFrameHeaderSize + frame.payloadSize);
+		SwitchVoiceChatFraming::WriteVoiceFrameHeader(buffer->data() + offset, frame);
+		std::memcpy(buffer->data() + offset + SwitchVoiceChatFraming::VoiceFrameHeaderSize, frame.payload, frame.payloadSize);
+	}
+
+	// Builds a bundle payload the way the encoder does: count, sizes, then the packets back to back.
+	std::vector<char> BuildBundle(const std::vector<std::vector<char>>& packets)
+	{
+		std::vector<char> bundle(1 + 2 * packets.size());
+		bundle[0] = static_cast<char>(packets.size());
+		size_t offset = 1;
+		for (size_t i = 0; i < packets.size(); i++)
+		{
+			offset += SwitchVoiceChatFraming::WriteVoiceBundlePacketSize(bundle.data() + offset, packets[i].size());
+		}
+		bundle.resize(offset);
+		for (size_t i = 0; i < packets.size(); i++) bundle.insert(bundle.end(), packets[i].begin(), packets[i].end());
+		return bundle;
+	}
+
+	void CheckFrameRoundTrip()
+	{
+		using namespace SwitchVoiceChatFraming;
+		const uint16_t payloadSizes[] = { 0, 1, 251, 252, 255, 256, 1275 };
+		std::vector<char> payload(1275);
+		FillPattern(payload.data(), payload.size(), 1);
+
+		std::vector<char> buffer;
+		for (size_t i = 0; i < sizeof(payloadSizes) / sizeof(payloadSizes[0]); i++)
+		{
+			VoiceFrame frame;
+			frame.payloadSize = payloadSizes[i];
+			frame.sequence = static_cast<uint16_t>(65533 + i); // wraps to 0 on the way
+			frame.timestamp = 0xfffffe00u + static_cast<uint32_t>(i) * 480;
+			frame.durationHalfMilis = 20;
+			frame.flags = static_cast<uint8_t>(i == 0 ? VoiceFrameFlag_TalkSpurtStart : VoiceFrameFlag_Redundant);
+			frame.payload = payload.data();
+			AppendFrame(&buffer, frame);
+		}
+
+		VoiceFrameReader reader(buffer.data(), buffer.size());
+		VoiceFrame frame;
+		size_t index = 0;
+		size_t offset = 0;
+		while (reader.Next(&frame))
+		{
+			Check(frame.payloadSize == payloadSizes[index], "frame round trip: payload size");
+			Check(frame.sequence == static_cast<uint16_t>(65533 + index), "frame round trip: sequence");
+			Check(frame.timestamp == 0xfffffe00u + static_cast<uint32_t>(index) * 480, "frame round trip: timestamp");
+			Check(frame.durationHalfMilis == 20 && GetVoiceFrameDurationMicroSeconds(frame) == 10000, "frame round trip: duration");
+			Check(GetVoiceFrameSampleCount(frame, 48000) == 480, "frame round trip: sample count");
+			Check(frame.flags == (index == 0 ? VoiceFrameFlag_TalkSpurtStart : VoiceFrameFlag_Redundant), "frame round trip: flags");
+			Check(frame.payload == buffer.data() + offset + VoiceFrameHeaderSize, "frame round trip: payload points into the buffer");
+			Check(std::memcmp(frame.payload, payload.data(), frame.payloadSize) == 0, "frame round trip: payload bytes");
+			Check(GetVoiceFrameSize(buffer.data() + offset) == VoiceFrameHeaderSize + frame.payloadSize, "frame round trip: size from header");
+			offset += VoiceFrameHeaderSize + frame.payloadSize;
+			index++;
+		}
+		Check(index == sizeof(payloadSizes) / sizeof(payloadSizes[0]), "frame round trip: frame count");
+		Check(reader.IsValid() && reader.GetOffset() == buffer.size(), "frame round trip: reader ends at the buffer end");
+
+		VoiceFrameReader emptyReader(buffer.data(), 0);
+		Check(!emptyReader.Next(&frame) && emptyReader.IsValid(), "frame reader: empty buffer is valid");
+	}
+
+	void CheckFrameTruncation()
+	{
+		using namespace SwitchVoiceChatFraming;
+		char payload[300];
+		FillPattern(payload, sizeof(payload), 2);
+		std::vector<char> buffer;
+		VoiceFrame frame = {};
+		frame.durationHalfMilis = 20;
+		frame.payload = payload;
+		frame.payloadSize = 40;
+		AppendFrame(&buffer, frame);
+		size_t firstSize = buffer.size();
+		frame.sequence = 1;
+		frame.payloadSize = 300;
+		AppendFrame(&buffer, frame);
+
+		// every cut short of a frame end leaves a truncated frame
+		for (size_t size = 0; size < firstSize; size++)
+		{
+			Check(ReadVoiceFrame(&frame, buffer.data(), size) == 0, "frame truncation: partial frame rejected");
+		}
+		Check(ReadVoiceFrame(&frame, buffer.data(), firstSize) == firstSize, "frame truncation: exact frame accepted");
+
+		for (size_t size = firstSize + 1; size < buffer.size(); size++)
+		{
+			VoiceFrameReader reader(buffer.data(), size);
+			int frameCount = 0;
+			while (reader.Next(&frame)) frameCount++;
+			Check(frameCount == 1 && !reader.IsValid() && reader.GetOffset() == firstSize, "frame truncation: reader stops after the last whole frame");
+		}
+	}
+
+	void CheckBundleSizeBoundary()
+	{
+		using namespace SwitchVoiceChatFraming;
+		// 251 is the largest one-byte size, 252-255 are the first two-byte sizes
+		for (size_t size = 1; size <= MaxVoiceBundlePacketSize; size++)
+		{
+			char encoded[2] = {};
+			size_t written = WriteVoiceBundlePacketSize(encoded, size);
+			Check(written == (size < 252 ? 1u : 2u), "bundle size: byte count");
+			const uint8_t* p = reinterpret_cast<const uint8_t*>(encoded);
+			size_t decoded = p[0] < 252 ? p[0] : p[0] + static_cast<size_t>(p[1]) * 4;
+			Check(decoded == size, "bundle size: decodes back");
+		}
+	}
+
+	void CheckBundleRoundTrip()
+	{
+		using namespace SwitchVoiceChatFraming;
+		const size_t sizeSets[][MaxVoiceBundlePacketCount] = {
+			{ 251, 252, 253, 254, 255, 256 },
+			{ 1, 250, 251, 252, 1275, 0 },
+			{ 255, 0 },
+		};
+		for (size_t set = 0; set < sizeof(sizeSets) / sizeof(sizeSets[0]); set++)
+		{
+			std::vector<std::vector<char>> packets;
+			for (int i = 0; i < MaxVoiceBundlePacketCount && sizeSets[set][i] > 0; i++)
+			{
+				packets.push_back(std::vector<char>(sizeSets[set][i]));
+				FillPattern(packets.back().data(), packets.back().size(), static_cast<int>(set * 16 + i));
+			}
+			std::vector<char> bundle = BuildBundle(packets);
+			size_t bundleSize = bundle.size();
+			// the redundant copy follows the bundle in the payload
+			bundle.insert(bundle.end(), 17, 'r');
+
+			VoiceBundleReader reader(bundle.data(), bundle.size());
+			Check(reader.IsValid(), "bundle round trip: valid");
+			Check(reader.GetPacketCount() == static_cast<int>(packets.size()), "bundle round trip: packet count");
+			Check(reader.GetSize() == bundleSize, "bundle round trip: size excludes trailing data");
+			const char* packet;
+			size_t packetSize;
+			size_t index = 0;
+			while (reader.Next(&packet, &packetSize))
+			{
+				Check(index < packets.size(), "bundle round trip: no extra packets");
+				if (index >= packets.size()) break;
+				Check(packetSize == packets[index].size(), "bundle round trip: packet size");
+				Check(std::memcmp(packet, packets[index].data(), packetSize) == 0, "bundle round trip: packet bytes");
+				index++;
+			}
+			Check(index == packets.size(), "bundle round trip: every packet read");
+
+			// any cut inside the bundle is rejected, never read past the end
+			for (size_t size = 0; size < bundleSize; size++)
+			{
+				std::vector<char> truncated(bundle.begin(), bundle.begin() + size);
+				VoiceBundleReader truncatedReader(truncated.data(), truncated.size());
+				Check(!truncatedReader.IsValid() && truncatedReader.GetPacketCount() == 0, "bundle truncation: rejected");
+			}
+		}
+	}
+
+	void CheckBundleInvalid()
+	{
+		using namespace SwitchVoiceChatFraming;
+		char payload[64] = {};
+		payload[0] = 0;
+		Check(!VoiceBundleReader(payload, sizeof(payload)).IsValid(), "bundle invalid: zero packets");
+		payload[0] = MaxVoiceBundlePacketCount + 1;
+		for (int i = 1; i <= MaxVoiceBundlePacketCount + 1; i++) payload[i] = 1;
+		Check(!VoiceBundleReader(payload, sizeof(payload)).IsValid(), "bundle invalid: too many packets");
+		// a two-byte size whose second byte is missing
+		payload[0] = 1;
+		payload[1] = static_cast<char>(252);
+		Check(!VoiceBundleReader(payload, 2).IsValid(), "bundle invalid: cut inside a two-byte size");
+		// sizes adding up to more than the payload
+		payload[0] = 2;
+		payload[1] = 30;
+		payload[2] = 31;
+		Check(!VoiceBundleReader(payload, 3 + 60).IsValid(), "bundle invalid: packets past the payload");
+		Check(VoiceBundleReader(payload, 3 + 61).IsValid(), "bundle invalid: exact fit accepted");
+	}
+
+	void CheckSequenceOrder()
+	{
+		using namespace SwitchVoiceChatFraming;
+		Check(IsSequenceBefore(65535, 0), "sequence order: 65535 before 0");
+		Check(!IsSequenceBefore(0, 65535), "sequence order: 0 after 65535");
+		Check(IsSequenceBefore(65000, 100), "sequence order: across the wrap");
+		Check(!IsSequenceBefore(7, 7), "sequence order: equal");
+	}
+
+	// A 10 ms frame whose payload holds its own sequence number, arriving on a steady clock.
+	struct SequencedFrame
+	{
+		SwitchVoiceChatFraming::VoiceFrame frame;
+		char payload[2];
+		int64_t arrivalTime;
+
+		explicit SequencedFrame(uint16_t sequence, int index)
+		{
+			payload[0] = static_cast<char>(sequence);
+			payload[1] = static_cast<char>(sequence >> 8);
+			frame.payloadSize = sizeof(payload);
+			frame.sequence = sequence;
+			frame.timestamp = static_cast<uint32_t>(index) * 480;
+			frame.durationHalfMilis = 20;
+			frame.flags = 0;
+			frame.payload = payload;
+			arrivalTime = 1000 + static_cast<int64_t>(index) * 480;
+		}
+	};
+
+	bool PopsSequence(SwitchVoiceChatDecodeNativeCode::JitterBuffer* buffer, uint16_t sequence)
+	{
+		SwitchVoiceChatFraming::VoiceFrame frame;
+		if (buffer->Pop(&frame) != SwitchVoiceChatDecodeNativeCode::JitterBuffer::PopResult_Frame) return false;
+		const uint8_t* p = reinterpret_cast<const uint8_t*>(frame.payload);
+		return frame.sequence == sequence && frame.payloadSize == 2 && (p[0] | (p[1] << 8)) == sequence;
+	}
+
+	void CheckJitterBufferWraparound()
+	{
+		using SwitchVoiceChatDecodeNativeCode::JitterBuffer;
+		std::vector<char> storage(JitterBuffer::GetStorageSize());
+		JitterBuffer buffer;
+		buffer.Initialize(storage.data());
+		const uint16_t firstSequence = 65530;
+		const int frameCount = 20;
+
+		// in order: one frame in, one frame out
+		for (int i = 0; i < frameCount; i++)
+		{
+			uint16_t sequence = static_cast<uint16_t>(firstSequence + i);
+			SequencedFrame frame(sequence, i);
+			Check(buffer.Insert(frame.frame, frame.arrivalTime), "jitter wraparound: in-order insert");
+			Check(PopsSequence(&buffer, sequence), "jitter wraparound: in-order pop");
+		}
+		Check(buffer.GetJitter() == 0, "jitter wraparound: steady arrival has no jitter");
+
+		// pairs swapped on the way, so 0 arrives before 65535
+		buffer.Reset();
+		for (int i = 0; i < frameCount; i += 2)
+		{
+			SequencedFrame second(static_cast<uint16_t>(firstSequence + 1 + i), i + 1);
+			SequencedFrame first(static_cast<uint16_t>(firstSequence + i), i);
+			Check(buffer.Insert(second.frame, first.arrivalTime), "jitter wraparound: reordered insert");
+			Check(buffer.Insert(first.frame, first.arrivalTime), "jitter wraparound: reordered insert");
+			Check(PopsSequence(&buffer, first.frame.sequence), "jitter wraparound: reordered pop");
+			Check(PopsSequence(&buffer, second.frame.sequence), "jitter wraparound: reordered pop");
+		}
+		Check(buffer.GetLateCount() == 0 && buffer.GetDroppedCount() == 0, "jitter wraparound: nothing late or dropped");
+
+		// 0 is lost: its slot is skipped, and the copy arriving afterwards is late
+		buffer.Reset();
+		for (int i = 0; i < frameCount; i++)
+		{
+			uint16_t sequence = static_cast<uint16_t>(firstSequence + i);
+			if (sequence == 0) continue;
+			SequencedFrame frame(sequence, i);
+			Check(buffer.Insert(frame.frame, frame.arrivalTime), "jitter wraparound: insert around the loss");
+			if (sequence == 1)
+			{
+				SwitchVoiceChatFraming::VoiceFrame missing;
+				Check(buffer.Pop(&missing) == JitterBuffer::PopResult_Missing, "jitter wraparound: lost frame reported missing");
+			}
+			Check(PopsSequence(&buffer, sequence), "jitter wraparound: pop around the loss");
+		}
+		SequencedFrame late(0, 65536 - firstSequence);
+		Check(!buffer.Insert(late.frame, late.arrivalTime + 10 * 480) && buffer.GetLateCount() == 1, "jitter wraparound: late frame rejected");
+		SwitchVoiceChatFraming::VoiceFrame frame;
+		Check(buffer.Pop(&frame) == JitterBuffer::PopResult_Underrun, "jitter wraparound: empty after the last frame");
+	}
+
+	// Converts one second of a 1 kHz tone from inputRate to outputRate, in one call or in chunks of
+	// varying size, and checks the output length against the rate ratio and the output bound.
+	std::vector<int16_t> CheckResamplerLength(int inputRate, int outputRate, bool isChunked)
+	{
+		using SwitchVoiceChatResampler::PolyphaseResampler;
+		std::vector<int16_t> input(inputRate);
+		for (size_t i = 0; i < input.size(); i++)
+		{
+			input[i] = static_cast<int16_t>(10000.0 * std::sin(2.0 * 3.14159265358979 * 1000.0 * i / inputRate));
+		}
+		std::vector<float> storage(PolyphaseResampler::GetStorageSize(inputRate, outputRate));
+		std::vector<int16_t> output;
+		PolyphaseResampler resampler;
+		bool isInitialized = !storage.empty() && resampler.Initialize(storage.data(), inputRate, outputRate);
+		Check(isInitialized, "resampler length: initialized");
+		if (!isInitialized) return output;
+
+		const size_t chunkSizes[] = { 441, 1, 480, 1000, 255, 256, 257, 2 };
+		size_t chunkIndex = 0;
+		size_t offset = 0;
+		while (offset < input.size())
+		{
+			size_t count = isChunked ? chunkSizes[chunkIndex++ % (sizeof(chunkSizes) / sizeof(chunkSizes[0]))] : input.size();
+			if (count > input.size() - offset) count = input.size() - offset;
+			size_t maxCount = resampler.GetMaxOutputCount(count);
+			Check(maxCount == PolyphaseResampler::GetMaxOutputCount(inputRate, outputRate, count), "resampler length: static bound matches");
+			size_t start = output.size();
+			output.resize(start + maxCount);
+			size_t written = resampler.Process(input.data() + offset, count, 1, output.data() + start);
+			Check(written <= maxCount, "resampler length: within GetMaxOutputCount");
+			output.resize(start + written);
+			offset += count;
+		}
+
+		// the filter history starts out as silence, so the count follows the rate ratio from the first
+		// sample and the filter delay only shows in the content
+		double expected = static_cast<double>(input.size()) * outputRate / inputRate;
+		Check(std::fabs(output.size() - expected) <= 1.0, "resampler length: output count follows the rate ratio");
+
+		// the tone comes through at its level once the filter has filled
+		double energy = 0.0;
+		for (size_t i = output.size() / 2; i < output.size(); i++) energy += static_cast<double>(output[i]) * output[i];
+		double rms = std::sqrt(energy / (output.size() - output.size() / 2));
+		Check(rms > 10000.0 / std::sqrt(2.0) * 0.95 && rms < 10000.0 / std::sqrt(2.0) * 1.05, "resampler length: tone level kept");
+		return output;
+	}
+
+	void CheckResampler()
+	{
+		std::vector<int16_t> whole = CheckResamplerLength(44100, 48000, false);
+		std::vector<int16_t> chunked = CheckResamplerLength(44100, 48000, true);
+		Check(whole == chunked, "resampler: chunked output equals one call");
+		whole = CheckResamplerLength(48000, 44100, false);
+		chunked = CheckResamplerLength(48000, 44100, true);
+		Check(whole == chunked, "resampler: chunked output equals one call");
+	}
+
+	const int PreprocessSampleRate = 48000;
+
+	double GetRmsDb(const int16_t* samples, size_t count)
+	{
+		double energy = 0.0;
+		for (size_t i = 0; i < count; i++) energy += static_cast<double>(samples[i]) * samples[i];
+		return 10.0 * std::log10(energy / count / (32768.0 * 32768.0) + 1e-12);
+	}
+
+	// Deterministic white noise and a 1 kHz tone, both given as rms in dBFS.
+	void AddNoise(int16_t* samples, size_t count, double levelDb, uint32_t* seed)
+	{
+		double amplitude = 32768.0 * std::pow(10.0, levelDb / 20.0) * std::sqrt(3.0);
+		for (size_t i = 0; i < count; i++)
+		{
+			*seed = *seed * 1664525u + 1013904223u;
+			samples[i] = static_cast<int16_t>(samples[i] + amplitude * ((*seed >> 8) / 8388608.0 - 1.0));
+		}
+	}
+
+	void AddTone(int16_t* samples, size_t count, double levelDb, size_t start)
+	{
+		double amplitude = 32768.0 * std::pow(10.0, levelDb / 20.0) * std::sqrt(2.0);
+		for (size_t i = 0; i < count; i++)
+		{
+			samples[i] = static_cast<int16_t>(samples[i] + amplitude * std::sin(2.0 * 3.14159265358979 * 1000.0 * (start + i) / PreprocessSampleRate));
+		}
+	}
+
+	void CheckPreprocessorPassthrough()
+	{
+		using SwitchVoiceChatPreprocessor::VoicePreprocessor;
+		std::vector<char> storage(VoicePreprocessor::GetStorageSize(PreprocessSampleRate));
+		VoicePreprocessor preprocessor;
+		Check(preprocessor.Initialize(storage.data(), PreprocessSampleRate, 20.0f, -20.0f), "preprocessor passthrough: initialized");
+		int blockSize = preprocessor.GetBlockSize();
+		Check(blockSize == PreprocessSampleRate / 100, "preprocessor passthrough: 10 ms blocks");
+
+		std::vector<int16_t> input(50 * blockSize, 0);
+		uint32_t seed = 1;
+		AddNoise(input.data(), input.size(), -20.0, &seed);
+		AddTone(input.data(), input.size(), -12.0, 0);
+		std::vector<int16_t> samples = input;
+		// whole blocks in calls of varying size
+		const int blockCounts[] = { 1, 3, 2, 7, 1, 36 };
+		int offset = 0;
+		for (int blockCount : blockCounts)
+		{
+			preprocessor.Process(samples.data() + static_cast<size_t>(offset) * blockSize, blockCount, false, false);
+			offset += blockCount;
+		}
+
+		bool isFirstBlockSilent = true;
+		for (int i = 0; i < blockSize; i++) isFirstBlockSilent = isFirstBlockSilent && samples[i] == 0;
+		Check(isFirstBlockSilent, "preprocessor passthrough: silence before the first block");
+		int maxError = 0;
+		for (size_t i = blockSize; i < samples.size(); i++)
+		{
+			int error = std::abs(samples[i] - input[i - blockSize]);
+			maxError = error > maxError ? error : maxError;
+		}
+		Check(maxError <= 1, "preprocessor passthrough: input one block late");
+	}
+
+	void CheckPreprocessorSuppression()
+	{
+		using SwitchVoiceChatPreprocessor::VoicePreprocessor;
+		std::vector<char> storage(VoicePreprocessor::GetStorageSize(PreprocessSampleRate));
+		VoicePreprocessor preprocessor;
+		preprocessor.Initialize(storage.data(), PreprocessSampleRate, 20.0f, -20.0f);
+		int blockSize = preprocessor.GetBlockSize();
+
+		// two seconds of noise, then half a second with a tone 20 dB above it
+		const int noiseBlockCount = 200;
+		const int toneBlockCount = 50;
+		std::vector<int16_t> input((noiseBlockCount + toneBlockCount) * blockSize, 0);
+		uint32_t seed = 2;
+		AddNoise(input.data(), input.size(), -40.0, &seed);
+		size_t toneStart = static_cast<size_t>(noiseBlockCount) * blockSize;
+		AddTone(input.data() + toneStart, input.size() - toneStart, -20.0, 0);
+		std::vector<int16_t> samples = input;
+		preprocessor.Process(samples.data(), noiseBlockCount + toneBlockCount, true, false);
+
+		// outputs are one block late
+		size_t settled = static_cast<size_t>(noiseBlockCount / 2) * blockSize;
+		double noiseInDb = GetRmsDb(input.data() + settled, toneStart - settled);
+		double noiseOutDb = GetRmsDb(samples.data() + settled + blockSize, toneStart - settled - blockSize);
+		Check(noiseOutDb < noiseInDb - 10.0, "preprocessor suppression: steady noise attenuated");
+
+		size_t toneSettled = toneStart + 10 * blockSize;
+		double toneInDb = GetRmsDb(input.data() + toneSettled, input.size() - toneSettled - blockSize);
+		double toneOutDb = GetRmsDb(samples.data() + toneSettled + blockSize, input.size() - toneSettled - blockSize);
+		Check(std::fabs(toneOutDb - toneInDb) < 2.0, "preprocessor suppression: tone above the noise kept");
+	}
+
+	// Talk spurts of a tone at levelDb with short pauses, with the AGC on, for seconds; returns the
+	// level of the last spurt.
+	double RunAgc(SwitchVoiceChatPreprocessor::VoicePreprocessor* preprocessor, double levelDb, int seconds)
+	{
+		int blockSize = preprocessor->GetBlockSize();
+		const int spurtBlockCount = 30;
+		const int pauseBlockCount = 10;
+		std::vector<int16_t> samples((spurtBlockCount + pauseBlockCount) * blockSize);
+		double lastLevelDb = 0.0;
+		for (int spurt = 0; spurt < seconds * 100 / (spurtBlockCount + pauseBlockCount); spurt++)
+		{
+			std::fill(samples.begin(), samples.end(), static_cast<int16_t>(0));
+			AddTone(samples.data(), static_cast<size_t>(spurtBlockCount) * blockSize, levelDb, 0);
+			preprocessor->Process(samples.data(), spurtBlockCount + pauseBlockCount, false, true);
+			// skip the ramp and the block of delay
+			lastLevelDb = GetRmsDb(samples.data() + 5 * blockSize, static_cast<size_t>(spurtBlockCount - 5) * blockSize);
+		}
+		return lastLevelDb;
+	}
+
+	void CheckPreprocessorAgc()
+	{
+		using SwitchVoiceChatPreprocessor::VoicePreprocessor;
+		std::vector<char> storage(VoicePreprocessor::GetStorageSize(PreprocessSampleRate));
+		VoicePreprocessor preprocessor;
+
+		// a quiet talker is raised to the target
+		preprocessor.Initialize(storage.data(), PreprocessSampleRate, 20.0f, -20.0f);
+		double levelDb = RunAgc(&preprocessor, -36.0, 6);
+		Check(std::fabs(preprocessor.GetAgcGainDb() - 16.0f) < 1.0f, "preprocessor agc: quiet talker gain");
+		Check(std::fabs(levelDb + 20.0) < 1.0, "preprocessor agc: quiet talker reaches the target");
+
+		// a loud one is cut, at most by the largest cut
+		preprocessor.Initialize(storage.data(), PreprocessSampleRate, 20.0f, -20.0f);
+		levelDb = RunAgc(&preprocessor, -3.0, 2);
+		Check(std::fabs(preprocessor.GetAgcGainDb() + 12.0f) < 0.5f, "preprocessor agc: loud talker cut");
+		Check(std::fabs(levelDb + 15.0) < 1.0, "preprocessor agc: loud talker level");
+	}
+}
+
+int main()
+{
+	CheckFrameRoundTrip();
+	CheckFrameTruncation();
+	CheckBundleSizeBoundary();
+	CheckBundleRoundTrip();
+	CheckBundleInvalid();
+	CheckSequenceOrder();
+	CheckJitterBufferWraparound();
+	CheckResampler();
+	CheckPreprocessorPassthrough();
+	CheckPreprocessorSuppression();
+	CheckPreprocessorAgc();
+
+	std::printf("%d checks, %d failed\n", g_CheckCount, g_FailureCount);
+	return g_FailureCount > 0 ? 1 : 0;
+}
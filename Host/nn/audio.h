@@ -0,0 +1,189 @@
+#pragma once
+#include "nn_Common.h"
+#include "os.h"
+
+namespace nn { namespace audio {
+	const size_t BufferAlignSize = 4096;
+
+	enum SampleFormat
+	{
+		SampleFormat_Invalid,
+		SampleFormat_PcmInt8,
+		SampleFormat_PcmInt16,
+		SampleFormat_PcmInt24,
+		SampleFormat_PcmInt32,
+		SampleFormat_PcmFloat
+	};
+
+	size_t GetSampleByteSize(SampleFormat sampleFormat);
+
+	enum AudioInState
+	{
+		AudioInState_Started,
+		AudioInState_Stopped
+	};
+
+	struct AudioInParameter
+	{
+		int sampleRate;
+	};
+
+	struct AudioInBuffer
+	{
+		static const size_t AddressAlignment = BufferAlignSize;
+		static const size_t SizeGranularity = BufferAlignSize;
+
+		void* buffer;
+		size_t bufferSize;
+		size_t dataSize;
+		size_t size;
+	};
+
+	struct AudioOutBuffer
+	{
+		static const size_t AddressAlignment = BufferAlignSize;
+		static const size_t SizeGranularity = BufferAlignSize;
+	};
+
+	namespace detail {
+		struct AudioInImpl;
+	}
+
+	struct AudioIn
+	{
+		detail::AudioInImpl* pImpl;
+	};
+
+	const int AudioInNameLength = 256;
+
+	struct AudioInInfo
+	{
+		char name[AudioInNameLength];
+	};
+
+	void InitializeAudioInParameter(AudioInParameter* pOutParameter);
+	int ListAudioIns(AudioInInfo* pOutInfos, int count);
+	Result OpenAudioIn(AudioIn* pOutAudioIn, os::SystemEvent* pOutSystemEvent, const char* name, const AudioInParameter& parameter);
+	Result OpenDefaultAudioIn(AudioIn* pOutAudioIn, const AudioInParameter& parameter);
+	Result OpenDefaultAudioIn(AudioIn* pOutAudioIn, os::SystemEvent* pOutSystemEvent, const AudioInParameter& parameter);
+	void CloseAudioIn(AudioIn* pAudioIn);
+	Result StartAudioIn(AudioIn* pAudioIn);
+	void StopAudioIn(AudioIn* pAudioIn);
+	AudioInState GetAudioInState(const AudioIn* pAudioIn);
+	int GetAudioInChannelCount(const AudioIn* pAudioIn);
+	int GetAudioInSampleRate(const AudioIn* pAudioIn);
+	SampleFormat GetAudioInSampleFormat(const AudioIn* pAudioIn);
+
+	void SetAudioInBufferInfo(AudioInBuffer* pOutAudioInBuffer, void* buffer, size_t bufferSize, size_t dataSize);
+	void* GetAudioInBufferDataPointer(const AudioInBuffer* pAudioInBuffer);
+	size_t GetAudioInBufferDataSize(const AudioInBuffer* pAudioInBuffer);
+	size_t GetAudioInBufferBufferSize(const AudioInBuffer* pAudioInBuffer);
+	bool AppendAudioInBuffer(AudioIn* pAudioIn, AudioInBuffer* pAudioInBuffer);
+	AudioInBuffer* GetReleasedAudioInBuffer(AudioIn* pAudioIn);
+	bool ContainsAudioInBuffer(const AudioIn* pAudioIn, const AudioInBuffer* pAudioInBuffer);
+
+	// AudioRenderer: the subset used by the samples and the voice chat playback sink.
+	namespace detail {
+		struct AudioRendererImpl;
+		struct AudioRendererConfigImpl;
+		struct VoiceImpl;
+	}
+
+	struct AudioRendererParameter
+	{
+		int sampleRate;
+		int sampleCount; // samples per rendering quantum
+		int mixBufferCount;
+		int subMixCount;
+		int voiceCount;
+		int sinkCount;
+		int effectCount;
+		int performanceFrameCount;
+		bool isVoiceDropEnabled;
+	};
+
+	struct AudioRendererHandle
+	{
+		detail::AudioRendererImpl* _handle;
+	};
+
+	struct AudioRendererConfig
+	{
+		detail::AudioRendererConfigImpl* _pConfig;
+	};
+
+	struct FinalMixType
+	{
+		int bufferCount;
+	};
+
+	struct DeviceSinkType
+	{
+		int inputCount;
+	};
+
+	struct MemoryPoolType
+	{
+		static const size_t AddressAlignment = BufferAlignSize;
+		static const size_t SizeGranularity = BufferAlignSize;
+
+		void* address;
+		size_t size;
+		bool attached;
+	};
+
+	struct WaveBuffer
+	{
+		const void* buffer;
+		size_t size;
+		int32_t startSampleOffset;
+		int32_t endSampleOffset;
+		bool loop;
+		bool isEndOfStream;
+		const void* pContext;
+		size_t contextSize;
+	};
+
+	struct VoiceType
+	{
+		static const int PriorityHighest = 0;
+		static const int PriorityLowest = 255;
+
+		enum PlayState
+		{
+			PlayState_Play,
+			PlayState_Stop,
+			PlayState_Pause
+		};
+
+		detail::VoiceImpl* _pVoice;
+	};
+
+	void InitializeAudioRendererParameter(AudioRendererParameter* pOutParameter);
+	bool IsValidAudioRendererParameter(const AudioRendererParameter& parameter);
+	size_t GetAudioRendererWorkBufferSize(const AudioRendererParameter& parameter);
+	size_t GetAudioRendererConfigWorkBufferSize(const AudioRendererParameter& parameter);
+	Result OpenAudioRenderer(AudioRendererHandle* pOutHandle, os::SystemEvent* pOutSystemEvent, const AudioRendererParameter& parameter, void* workBuffer, size_t workBufferSize);
+	void CloseAudioRenderer(AudioRendererHandle handle);
+	Result StartAudioRenderer(AudioRendererHandle handle);
+	void StopAudioRenderer(AudioRendererHandle handle);
+	Result RequestUpdateAudioRenderer(AudioRendererHandle handle, const AudioRendererConfig* pConfig);
+	void InitializeAudioRendererConfig(AudioRendererConfig* pOutConfig, const AudioRendererParameter& parameter, void* buffer, size_t size);
+
+	bool AcquireFinalMix(AudioRendererConfig* pConfig, FinalMixType* pOutFinalMix, int bufferCount);
+	Result AddDeviceSink(AudioRendererConfig* pConfig, DeviceSinkType* pOutDeviceSink, FinalMixType* pFinalMix, const int8_t* input, int inputCount, const char* name);
+
+	bool AcquireMemoryPool(AudioRendererConfig* pConfig, MemoryPoolType* pOutPool, void* address, size_t size);
+	void ReleaseMemoryPool(AudioRendererConfig* pConfig, MemoryPoolType* pPool);
+	bool RequestAttachMemoryPool(MemoryPoolType* pPool);
+	bool RequestDetachMemoryPool(MemoryPoolType* pPool);
+	bool IsMemoryPoolAttached(const MemoryPoolType* pPool);
+
+	bool AcquireVoiceSlot(AudioRendererConfig* pConfig, VoiceType* pOutVoice, int sampleRate, int channelCount, SampleFormat sampleFormat, int priority, const void* parameter, size_t parameterSize);
+	void ReleaseVoiceSlot(AudioRendererConfig* pConfig, VoiceType* pVoice);
+	void SetVoiceDestination(AudioRendererConfig* pConfig, VoiceType* pVoice, FinalMixType* pFinalMix);
+	void SetVoicePlayState(VoiceType* pVoice, VoiceType::PlayState playState);
+	void SetVoiceMixVolume(VoiceType* pVoice, FinalMixType* pFinalMix, float volume, int sourceIndex, int destinationIndex);
+	bool AppendWaveBuffer(VoiceType* pVoice, const WaveBuffer* pWaveBuffer);
+	const WaveBuffer* GetReleasedWaveBuffer(VoiceType* pVoice);
+}}
@@ -0,0 +1,93 @@
+#pragma once
+#include "nn_Common.h"
+
+namespace nn { namespace codec { class OpusEncoder; }}
+namespace HostBackend {
+	bool SetOpusEncoderComplexity(nn::codec::OpusEncoder* pEncoder, int complexity);
+	int GetOpusEncoderComplexity(const nn::codec::OpusEncoder* pEncoder);
+}
+
+namespace nn { namespace codec {
+	// Every packet produced by OpusEncoder starts with this header (big-endian payload size and
+	// final range), like the SDK codec, so OpusDecoder can walk a buffer of concatenated packets.
+	const size_t OpusPacketHeaderSize = 8;
+	const size_t OpusPacketSizeMaximum = 1275 + OpusPacketHeaderSize;
+
+	enum OpusResult
+	{
+		OpusResult_Success,
+		OpusResult_InvalidWorkBuffer,
+		OpusResult_InsufficientOpusBuffer,
+		OpusResult_InvalidPacket,
+		OpusResult_InsufficientPcmBuffer,
+		OpusResult_InvalidSampleRate,
+		OpusResult_InvalidChannelCount,
+		OpusResult_UnsupportedFormat,
+		OpusResult_InternalError
+	};
+
+	enum OpusCodingMode
+	{
+		OpusCodingMode_Celt,
+		OpusCodingMode_Silk,
+		OpusCodingMode_Auto
+	};
+
+	enum OpusBitRateControl
+	{
+		OpusBitRateControl_Vbr,
+		OpusBitRateControl_Cvbr,
+		OpusBitRateControl_Cbr
+	};
+
+	class OpusEncoder
+	{
+	public:
+		OpusEncoder();
+		~OpusEncoder();
+		size_t GetWorkBufferSize(int sampleRate, int channelCount) const;
+		OpusResult Initialize(int sampleRate, int channelCount, void* buffer, size_t size);
+		void Finalize();
+		bool IsInitialized() const { return m_pState != nullptr; }
+		int GetSampleRate() const { return m_SampleRate; }
+		int GetChannelCount() const { return m_ChannelCount; }
+		void SetBitRate(int bitRate);
+		int GetBitRate() const;
+		void SetBitRateControl(OpusBitRateControl bitRateControl);
+		OpusBitRateControl GetBitRateControl() const;
+		void BindCodingMode(OpusCodingMode codingMode);
+		OpusCodingMode GetCodingMode() const { return m_CodingMode; }
+		int CalculateFrameSampleCount(int frameDuration) const;
+		int GetPreSkipSampleCount() const;
+		OpusResult EncodeInterleaved(size_t* pOutputSize, void* outputBuffer, size_t outputBufferSize,
+			const int16_t* inputBuffer, int inputSampleCountPerChannel);
+	private:
+		// host extensions, see HostCodec.h
+		friend bool HostBackend::SetOpusEncoderComplexity(OpusEncoder* pEncoder, int complexity);
+		friend int HostBackend::GetOpusEncoderComplexity(const OpusEncoder* pEncoder);
+
+		void* m_pState;
+		int m_SampleRate;
+		int m_ChannelCount;
+		OpusCodingMode m_CodingMode;
+	};
+
+	class OpusDecoder
+	{
+	public:
+		OpusDecoder();
+		~OpusDecoder();
+		size_t GetWorkBufferSize(int sampleRate, int channelCount) const;
+		OpusResult Initialize(int sampleRate, int channelCount, void* buffer, size_t size);
+		void Finalize();
+		bool IsInitialized() const { return m_pState != nullptr; }
+		int GetSampleRate() const { return m_SampleRate; }
+		int GetChannelCount() const { return m_ChannelCount; }
+		OpusResult DecodeInterleaved(size_t* pOutConsumed, int* pOutSampleCount, int16_t* pOutputBuffer, size_t outputSize,
+			const void* pInputBuffer, size_t inputSize);
+	private:
+		void* m_pState;
+		int m_SampleRate;
+		int m_ChannelCount;
+	};
+}}
@@ -0,0 +1,29 @@
+#pragma once
+#include "nn_Common.h"
+
+namespace nn { namespace mem {
+	// First-fit allocator working inside a caller-provided region, like the SDK StandardAllocator.
+	// Not thread-safe; the voice chat code only allocates from one thread at a time.
+	class StandardAllocator
+	{
+	public:
+		StandardAllocator() : m_pRegion(nullptr), m_RegionSize(0), m_pFreeList(nullptr) {}
+		StandardAllocator(void* address, size_t size) : StandardAllocator() { Initialize(address, size); }
+		void Initialize(void* address, size_t size);
+		void Finalize();
+		void* Allocate(size_t size);
+		void* Allocate(size_t size, size_t alignment);
+		void Free(void* address);
+		size_t GetTotalFreeSize() const;
+		size_t GetAllocatableSize() const;
+	private:
+		struct FreeChunk
+		{
+			size_t size;
+			FreeChunk* pNext;
+		};
+		char* m_pRegion;
+		size_t m_RegionSize;
+		FreeChunk* m_pFreeList;
+	};
+}}
@@ -0,0 +1,52 @@
+#pragma once
+#include <stdint.h>
+#include <cstddef>
+
+// Host (Linux) stand-ins for the few NintendoSDK core types the voice chat code uses.
+// Only the subset needed by SwitchVoiceChatNativeCode / SwitchVoiceChatDecodeNativeCode is provided.
+
+#define NN_STATIC_ASSERT(expression) static_assert(expression, #expression)
+
+namespace nn {
+	class Result
+	{
+	public:
+		Result() : m_Value(0) {}
+		explicit Result(int value) : m_Value(value) {}
+		bool IsSuccess() const { return m_Value == 0; }
+		bool IsFailure() const { return m_Value != 0; }
+		int GetInnerValueForDebug() const { return m_Value; }
+	private:
+		int m_Value;
+	};
+
+	inline Result ResultSuccess() { return Result(); }
+
+	class TimeSpan
+	{
+	public:
+		TimeSpan() : m_NanoSeconds(0) {}
+		static TimeSpan FromNanoSeconds(int64_t value) { TimeSpan t; t.m_NanoSeconds = value; return t; }
+		static TimeSpan FromMicroSeconds(int64_t value) { return FromNanoSeconds(value * 1000); }
+		static TimeSpan FromMilliSeconds(int64_t value) { return FromNanoSeconds(value * 1000 * 1000); }
+		int64_t GetNanoSeconds() const { return m_NanoSeconds; }
+		int64_t GetMicroSeconds() const { return m_NanoSeconds / 1000; }
+		int64_t GetMilliSeconds() const { return m_NanoSeconds / (1000 * 1000); }
+	private:
+		int64_t m_NanoSeconds;
+	};
+
+	namespace util {
+		template <typename T>
+		inline T align_up(T value, size_t alignment)
+		{
+			return static_cast<T>((value + alignment - 1) & ~(static_cast<T>(alignment) - 1));
+		}
+
+		template <typename T>
+		inline T align_down(T value, size_t alignment)
+		{
+			return static_cast<T>(value & ~(static_cast<T>(alignment) - 1));
+		}
+	}
+}
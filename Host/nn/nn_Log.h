@@ -0,0 +1,4 @@
+#pragma once
+#include <cstdio>
+
+#define NN_LOG(...) std::printf(__VA_ARGS__)
@@ -0,0 +1,107 @@
+#pragma once
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "nn_Common.h"
+
+namespace nn { namespace os {
+	const size_t MemoryPageSize = 4096;
+	const size_t ThreadStackAlignment = 4096;
+	const int DefaultThreadPriority = 16;
+	const int HighestThreadPriority = 0;
+	const int LowestThreadPriority = 31;
+
+	enum EventClearMode
+	{
+		EventClearMode_ManualClear,
+		EventClearMode_AutoClear
+	};
+
+	struct SystemEventType
+	{
+		std::mutex mutex;
+		std::condition_variable condition;
+		bool signaled;
+		EventClearMode clearMode;
+	};
+
+	class SystemEvent
+	{
+	public:
+		SystemEvent() { m_Event.signaled = false; m_Event.clearMode = EventClearMode_AutoClear; }
+		void Wait();
+		bool TryWait();
+		bool TimedWait(TimeSpan timeout);
+		void Signal();
+		void Clear();
+		SystemEventType* GetBase() { return &m_Event; }
+	private:
+		SystemEventType m_Event;
+	};
+
+	void DestroySystemEvent(SystemEventType* pEvent);
+
+	class Event
+	{
+	public:
+		explicit Event(EventClearMode clearMode) { m_Event.signaled = false; m_Event.clearMode = clearMode; }
+		void Wait();
+		bool TryWait();
+		bool TimedWait(TimeSpan timeout);
+		void Signal();
+		void Clear();
+	private:
+		SystemEventType m_Event;
+	};
+
+	class Mutex
+	{
+	public:
+		explicit Mutex(bool recursive) { (void)recursive; }
+		void Lock() { m_Mutex.lock(); }
+		bool TryLock() { return m_Mutex.try_lock(); }
+		void Unlock() { m_Mutex.unlock(); }
+		void lock() { Lock(); }
+		void unlock() { Unlock(); }
+	private:
+		std::recursive_mutex m_Mutex;
+	};
+
+	class Tick
+	{
+	public:
+		Tick() : m_Value(0) {}
+		explicit Tick(int64_t value) : m_Value(value) {}
+		int64_t GetInt64Value() const { return m_Value; }
+		Tick operator-(const Tick& other) const { return Tick(m_Value - other.m_Value); }
+		Tick operator+(const Tick& other) const { return Tick(m_Value + other.m_Value); }
+	private:
+		int64_t m_Value;
+	};
+
+	// Host ticks are nanoseconds of the monotonic clock.
+	Tick GetSystemTick();
+	int64_t GetSystemTickFrequency();
+	TimeSpan ConvertToTimeSpan(Tick tick);
+	Tick ConvertToTick(TimeSpan timeSpan);
+
+	void SleepThread(TimeSpan time);
+	int GetCurrentCoreNumber();
+
+	typedef void (*ThreadFunction)(void* argument);
+
+	struct ThreadType
+	{
+		std::thread* pThread;
+		ThreadFunction function;
+		void* argument;
+		const char* name;
+	};
+
+	Result CreateThread(ThreadType* pThread, ThreadFunction function, void* argument, void* stack, size_t stackSize, int priority);
+	Result CreateThread(ThreadType* pThread, ThreadFunction function, void* argument, void* stack, size_t stackSize, int priority, int idealCore);
+	void StartThread(ThreadType* pThread);
+	void WaitThread(ThreadType* pThread);
+	void DestroyThread(ThreadType* pThread);
+	void SetThreadName(ThreadType* pThread, const char* name);
+}}
@@ -1,80 +1,456 @@
-#include "SwitchVoiceChatDEcodeNativeCode.h";
+#include "SwitchVoiceChatDecodeNativeCode.h"
 
 namespace SwitchVoiceChatDecodeNativeCode {
 	using namespace nn::audio;
 	using namespace nn::codec;
+	using namespace SwitchVoiceChatFraming;
+	using namespace SwitchVoiceChatMemory;
+	using namespace SwitchVoiceChatStats;
 
-	const int TOTAL_BUFFER_SIZE = 1024 * 1024;
+	const int MAX_FRAME_SAMPLE_COUNT = 5760; // 120 ms at 48 kHz, the longest Opus packet
+	const int MAX_SPEAKER_DECODER_COUNT = 64;
+	const float SAMPLE_SCALE = 1.0f / 32767;
+	const int PLAYOUT_FRAME_SAMPLE_COUNT = 2880; // 60 ms at 48 kHz, the longest frame the jitter buffer plays
+	const int MAX_CONCEALED_FRAME_COUNT = 4; // lost frames in a row faded out before going silent
+	const int MIX_CHUNK_SAMPLE_COUNT = 1024; // wntgd_MixSpeakers pulls each speaker in chunks of this size
+	const float HALF_PI = 1.57079632679f;
+	const int RENDERER_SAMPLE_COUNT = 240; // one renderer quantum, 5 ms at 48 kHz
+	const int PLAYBACK_VOICE_COUNT = 16; // speakers played through the renderer at once
+	const int PLAYBACK_WAVE_BUFFER_COUNT = 2; // one quantum playing, one queued
+	const int PLAYBACK_THREAD_STACK_SIZE = 64 * 1024;
+	const int PLAYBACK_THREAD_PRIORITY = nn::os::DefaultThreadPriority - 2;
+	const int MAX_DECODE_WORKER_COUNT = 3;
+	const int DECODE_WORKER_CORE_COUNT = 3; // application cores; worker i prefers core (i + 1) % 3, the caller usually runs on core 0
+	const int DECODE_WORKER_STACK_SIZE = 64 * 1024;
+	const int DECODE_WORKER_PRIORITY = nn::os::DefaultThreadPriority - 1;
+	const int MAX_BATCH_JOB_COUNT = 256; // larger batches are decoded in consecutive slices of this size
+	const float DEFAULT_DECODE_COST_MICROSECONDS = 200.0f; // per frame, for the schedule until decode times are measured
+	const float DECODE_COST_SMOOTHING = 0.125f; // weight of the newest measurement in a speaker's decode cost
+	const float SCHEDULE_HYSTERESIS = 1.25f; // a speaker decoded in the last batch outranks up to 25% higher priorities
 
-	nn::mem::StandardAllocator decoderAllocator;
-	char* totalBufferDecoder;
 	int16_t* decoderOutBuffer;
 	int decoderOutBufferSize;
 
 	size_t opusDecoderWorkBufferSize;
 	char* opusDecoderWorkBuffer;
 	OpusDecoder* decoder;
+	float* mixScratchBuffer;
 
 	const int SAMPLE_RATE = 48000;
 
-	extern "C" bool wntgd_InitializeDecoder()
+	// pipeline statistics, see wntgd_GetDecodeStats
+	std::atomic<uint32_t> receivedFrameCount(0);
+	std::atomic<uint64_t> receivedByteCount(0);
+	std::atomic<uint32_t> invalidBufferCount(0);
+	std::atomic<uint32_t> rejectedFrameCount(0);
+	std::atomic<uint32_t> decodedFrameCount(0);
+	std::atomic<uint32_t> decodeErrorCount(0);
+	std::atomic<uint32_t> totalLostFrameCount(0);
+	std::atomic<uint32_t> totalRecoveredFrameCount(0);
+	std::atomic<uint32_t> totalConcealedFrameCount(0);
+	std::atomic<uint32_t> skippedFrameCount(0);
+	LatencyHistogram decodeTimeHistogram;
+
+	// One decoder per remote speaker: Opus decoding is stateful, so speakers must not share one.
+	// Work buffers are taken from the arena the first time a slot is used and kept for reuse; when no
+	// slot is free (or the budget is used up), the least recently used speaker is evicted.
+	struct SpeakerDecoder
+	{
+		uint64_t speakerId;
+		uint64_t lastUsed;
+		bool inUse;
+		char* workBuffer;
+		OpusDecoder decoder;
+
+		// playout (wntgd_PushSpeakerVoiceData / wntgd_PullSpeakerVoice), storage allocated on first push
+		char* playoutStorage;
+		JitterBuffer jitterBuffer;
+		int16_t* playoutBuffer; // last frame decoded or concealed
+		int playoutOffset;
+		int playoutCount;
+		float playoutGain;
+		int concealedInRow;
+		uint32_t lostFrameCount;
+		uint32_t recoveredFrameCount;
+		uint32_t concealedFrameCount;
+
+		// wntgd_SetSpeakerMix, as constant-power gains
+		float mixLeftGain;
+		float mixRightGain;
+
+		int playbackVoiceIndex; // renderer voice while wntgd_StartPlayback runs, -1 if none
+
+		// decode schedule (wntgd_SetDecodeSchedule)
+		float schedulePriority;
+		bool resyncPending; // batch jobs were skipped, the decoder must restart before the next one
+		float decodeCostMicroSeconds; // per frame, running average; 0 until measured
+	};
+	SpeakerDecoder speakerDecoders[MAX_SPEAKER_DECODER_COUNT];
+	uint64_t speakerDecoderUseCounter;
+	// Guards the speaker slots against the playback thread. Taken by the entry points that touch a
+	// speaker's playout; uncontended unless playback runs.
+	nn::os::Mutex speakerMutex(false);
+
+	// Playback mode (wntgd_StartPlayback): every speaker with playout gets a renderer voice, fed with
+	// quantum-sized int16 wave buffers straight from its playout frame. The renderer does the mixing and
+	// panning, so the PCM never leaves native memory and is never converted to float.
+	struct PlaybackVoice
+	{
+		SpeakerDecoder* speaker; // nullptr while free
+		uint64_t speakerId; // whom the voice was acquired for; the slot may be evicted and reused since
+		VoiceType voice;
+		WaveBuffer waveBuffers[PLAYBACK_WAVE_BUFFER_COUNT];
+	};
+	PlaybackVoice playbackVoices[PLAYBACK_VOICE_COUNT];
+	std::atomic<bool> playbackRunning(false);
+	void* playbackWorkBuffer;
+	void* playbackConfigBuffer;
+	AudioRendererHandle rendererHandle;
+	AudioRendererConfig rendererConfig;
+	nn::os::SystemEvent rendererEvent;
+	FinalMixType finalMix;
+	DeviceSinkType deviceSink;
+	MemoryPoolType playbackMemoryPool;
+	int16_t* playbackPcmBuffer; // PLAYBACK_VOICE_COUNT * PLAYBACK_WAVE_BUFFER_COUNT quanta, in playbackMemoryPool
+	nn::os::ThreadType playbackThread;
+	void* playbackThreadStack;
+
+	// Batch decode (wntgd_DecompressSpeakerVoiceDataBatch). The jobs of one speaker are linked into a
+	// chain, decoded in order by whoever takes the chain; chains are dealt out to one queue per
+	// participant (the calling thread is participant 0, the workers 1 and up). A participant drains its
+	// own queue, then steals from the others, so a slow speaker does not hold up the rest.
+	struct DecodeQueue
+	{
+		int end;
+		std::atomic<int> next; // next chain to take, by the owner or a thief
+	};
+	struct DecodeWorker
+	{
+		nn::os::ThreadType thread;
+		void* stack;
+		int16_t* pcmBuffer; // decoderOutBufferSize samples, like decoderOutBuffer for the caller
+		nn::os::Event* startEvent;
+	};
+	DecodeWorker decodeWorkers[MAX_DECODE_WORKER_COUNT];
+	int decodeWorkerCount;
+	std::atomic<bool> decodeWorkersRunning(false);
+	nn::os::Event batchDoneEvent(nn::os::EventClearMode_AutoClear);
+	std::atomic<int> batchActiveWorkerCount(0);
+	SpeakerDecodeJob* batchJobs;
+	int batchNextJob[MAX_BATCH_JOB_COUNT]; // next job of the same speaker, -1 at the end of a chain
+	int batchChainHead[MAX_SPEAKER_DECODER_COUNT]; // per speaker slot, -1 if the slot has no chain
+	int batchChainTail[MAX_SPEAKER_DECODER_COUNT];
+	int batchChains[MAX_SPEAKER_DECODER_COUNT]; // speaker slots with a chain, in queue order
+	DecodeQueue batchQueues[MAX_DECODE_WORKER_COUNT + 1];
+	int batchQueueCount;
+	// Decode schedule: 0 lifts a limit, both 0 turns it off. batchChainFrameCount is only counted
+	// while it is on, and the chains then measure their decode cost.
+	int scheduleBudgetMicroSeconds;
+	int scheduleMaxSpeakerCount;
+	bool batchScheduled;
+	int batchChainFrameCount[MAX_SPEAKER_DECODER_COUNT];
+
+	size_t GetSpeakerPlayoutStorageSize()
 	{
-		totalBufferDecoder = new char[TOTAL_BUFFER_SIZE]();
-		decoderAllocator.Initialize(totalBufferDecoder, TOTAL_BUFFER_SIZE);
+		return JitterBuffer::GetStorageSize() + PLAYOUT_FRAME_SAMPLE_COUNT * sizeof(int16_t);
+	}
+
+	// Arena bytes wntgd_InitializeDecoder takes, plus speakerCount speakers with playout.
+	size_t GetDecoderMemorySize(int speakerCount)
+	{
+		OpusDecoder sizingDecoder;
+		size_t workBufferSize = GetAllocationSize(sizingDecoder.GetWorkBufferSize(SAMPLE_RATE, 1));
+		size_t size = GetAllocationSize(MAX_FRAME_SAMPLE_COUNT * sizeof(int16_t), AudioInBuffer::AddressAlignment)
+			+ GetAllocationSize(MIX_CHUNK_SAMPLE_COUNT * sizeof(float), AudioInBuffer::AddressAlignment)
+			+ GetAllocationSize(sizeof(OpusDecoder)) + workBufferSize;
+		return size + speakerCount * (workBufferSize + GetAllocationSize(GetSpeakerPlayoutStorageSize()));
+	}
 
-		decoderOutBufferSize = TOTAL_BUFFER_SIZE * 9 / 10;
-		decoderOutBuffer = reinterpret_cast<int16_t*>(decoderAllocator.Allocate(decoderOutBufferSize, AudioInBuffer::AddressAlignment));
-		decoderOutBufferSize = decoderOutBufferSize / sizeof(int16_t);
-		if (!decoderOutBuffer)
+	extern "C" bool wntgd_InitializeDecoder()
+	{
+		if (!AcquireArena()) return false;
+		decoderOutBufferSize = MAX_FRAME_SAMPLE_COUNT;
+		decoderOutBuffer = reinterpret_cast<int16_t*>(Allocate(MemoryCategory_Decoder, decoderOutBufferSize * sizeof(int16_t), AudioInBuffer::AddressAlignment));
+		mixScratchBuffer = reinterpret_cast<float*>(Allocate(MemoryCategory_Decoder, MIX_CHUNK_SAMPLE_COUNT * sizeof(float), AudioInBuffer::AddressAlignment));
+		void* decoderStorage = Allocate(MemoryCategory_Decoder, sizeof(OpusDecoder));
+		decoder = decoderStorage ? new (decoderStorage) OpusDecoder() : nullptr;
+		opusDecoderWorkBufferSize = decoder ? decoder->GetWorkBufferSize(SAMPLE_RATE, 1) : 0; // channelCount = 1, because we use mono
+		opusDecoderWorkBuffer = decoder ? reinterpret_cast<char*>(Allocate(MemoryCategory_Decoder, opusDecoderWorkBufferSize)) : nullptr;
+		if (!decoderOutBuffer || !mixScratchBuffer || !opusDecoderWorkBuffer
+			|| decoder->Initialize(SAMPLE_RATE, 1, opusDecoderWorkBuffer, opusDecoderWorkBufferSize) != OpusResult_Success)
 		{
-			decoderAllocator.Finalize();
-			delete totalBufferDecoder;
+			if (decoder) decoder->~OpusDecoder();
+			Free(MemoryCategory_Decoder, decoderStorage);
+			Free(MemoryCategory_Decoder, opusDecoderWorkBuffer);
+			Free(MemoryCategory_Decoder, mixScratchBuffer);
+			Free(MemoryCategory_Decoder, decoderOutBuffer);
+			decoder = nullptr;
+			opusDecoderWorkBuffer = nullptr;
+			mixScratchBuffer = nullptr;
+			decoderOutBuffer = nullptr;
+			ReleaseArena();
 			return false;
 		}
 
-		decoder = new OpusDecoder();
-		opusDecoderWorkBufferSize = decoder->GetWorkBufferSize(SAMPLE_RATE, 1); // channelCount = 1, because we use mono
-		opusDecoderWorkBuffer = new char[opusDecoderWorkBufferSize];
-		OpusResult result = decoder->Initialize(SAMPLE_RATE, 1, opusDecoderWorkBuffer, opusDecoderWorkBufferSize);
+		for (int i = 0; i < MAX_SPEAKER_DECODER_COUNT; i++)
+		{
+			speakerDecoders[i].inUse = false;
+			speakerDecoders[i].lastUsed = 0;
+			speakerDecoders[i].workBuffer = nullptr;
+			speakerDecoders[i].playoutStorage = nullptr;
+			speakerDecoders[i].playoutBuffer = nullptr;
+			speakerDecoders[i].playbackVoiceIndex = -1;
+			batchChainHead[i] = -1;
+		}
+		speakerDecoderUseCounter = 0;
+
+		receivedFrameCount.store(0, std::memory_order_relaxed);
+		receivedByteCount.store(0, std::memory_order_relaxed);
+		invalidBufferCount.store(0, std::memory_order_relaxed);
+		rejectedFrameCount.store(0, std::memory_order_relaxed);
+		decodedFrameCount.store(0, std::memory_order_relaxed);
+		decodeErrorCount.store(0, std::memory_order_relaxed);
+		totalLostFrameCount.store(0, std::memory_order_relaxed);
+		totalRecoveredFrameCount.store(0, std::memory_order_relaxed);
+		totalConcealedFrameCount.store(0, std::memory_order_relaxed);
+		skippedFrameCount.store(0, std::memory_order_relaxed);
+		decodeTimeHistogram.Reset();
+		return true;
+	}
+
+	SpeakerDecoder* FindSpeaker(uint64_t speakerId)
+	{
+		for (int i = 0; i < MAX_SPEAKER_DECODER_COUNT; i++)
+		{
+			if (speakerDecoders[i].inUse && speakerDecoders[i].speakerId == speakerId) return &speakerDecoders[i];
+		}
+		return nullptr;
+	}
+
+	void ResetSpeakerPlayout(SpeakerDecoder* speaker)
+	{
+		if (speaker->playoutStorage) speaker->jitterBuffer.Reset();
+		speaker->playoutOffset = 0;
+		speaker->playoutCount = 0;
+		speaker->playoutGain = 1.0f;
+		speaker->concealedInRow = 0;
+		speaker->lostFrameCount = 0;
+		speaker->recoveredFrameCount = 0;
+		speaker->concealedFrameCount = 0;
+		speaker->mixLeftGain = std::cos(HALF_PI / 2);
+		speaker->mixRightGain = std::sin(HALF_PI / 2);
+	}
+
+	bool AllocateSpeakerPlayout(SpeakerDecoder* speaker)
+	{
+		if (speaker->playoutStorage) return true;
+		speaker->playoutStorage = reinterpret_cast<char*>(Allocate(MemoryCategory_Decoder, GetSpeakerPlayoutStorageSize()));
+		if (!speaker->playoutStorage) return false;
+		speaker->jitterBuffer.Initialize(speaker->playoutStorage);
+		speaker->playoutBuffer = reinterpret_cast<int16_t*>(speaker->playoutStorage + JitterBuffer::GetStorageSize());
+		return true;
+	}
+
+	// Returns the slot of speakerId, taking a free slot or evicting the least recently used one
+	// for a new speaker. A reused decoder is reset by re-initializing it on its existing work buffer.
+	// With usePlayout the slot also gets playout storage; when the budget has no room for it, only
+	// speakers that already have some are evicted.
+	SpeakerDecoder* CheckoutSpeaker(uint64_t speakerId, bool usePlayout)
+	{
+		SpeakerDecoder* free = nullptr;
+		SpeakerDecoder* leastRecentlyUsed = nullptr;
+		for (int i = 0; i < MAX_SPEAKER_DECODER_COUNT; i++)
+		{
+			SpeakerDecoder* slot = &speakerDecoders[i];
+			if (slot->inUse && slot->speakerId == speakerId)
+			{
+				if (usePlayout && !AllocateSpeakerPlayout(slot)) return nullptr;
+				slot->lastUsed = ++speakerDecoderUseCounter;
+				return slot;
+			}
+			if (!slot->inUse)
+			{
+				// prefer a slot that already owns a work buffer
+				if (!free || (!free->workBuffer && slot->workBuffer)) free = slot;
+			}
+			else if (batchChainHead[i] < 0 && (!usePlayout || slot->playoutStorage)
+				&& (!leastRecentlyUsed || slot->lastUsed < leastRecentlyUsed->lastUsed))
+			{
+				// a speaker with jobs in the running batch is never evicted
+				leastRecentlyUsed = slot;
+			}
+		}
+
+		SpeakerDecoder* slot = free;
+		if (slot && !slot->workBuffer)
+		{
+			slot->workBuffer = reinterpret_cast<char*>(Allocate(MemoryCategory_Decoder, opusDecoderWorkBufferSize));
+			if (!slot->workBuffer) slot = nullptr;
+		}
+		// a free slot keeps what it got for the next speaker
+		if (slot && usePlayout && !AllocateSpeakerPlayout(slot)) slot = nullptr;
+		if (!slot) slot = leastRecentlyUsed;
+		if (!slot) return nullptr;
+
+		if (slot->inUse) slot->decoder.Finalize();
+		if (slot->decoder.Initialize(SAMPLE_RATE, 1, slot->workBuffer, opusDecoderWorkBufferSize) != OpusResult_Success)
+		{
+			slot->inUse = false;
+			return nullptr;
+		}
+		slot->inUse = true;
+		slot->speakerId = speakerId;
+		slot->lastUsed = ++speakerDecoderUseCounter;
+		ResetSpeakerPlayout(slot);
+		slot->schedulePriority = 1.0f;
+		slot->resyncPending = false;
+		slot->decodeCostMicroSeconds = 0.0f;
+		return slot;
+	}
 
-		if (result != OpusResult_Success) return false;
-		else return true;
+	extern "C" void wntgd_ReleaseSpeakerDecoder(uint64_t speakerId)
+	{
+		std::lock_guard<nn::os::Mutex> lock(speakerMutex);
+		for (int i = 0; i < MAX_SPEAKER_DECODER_COUNT; i++)
+		{
+			SpeakerDecoder* slot = &speakerDecoders[i];
+			if (slot->inUse && slot->speakerId == speakerId)
+			{
+				slot->decoder.Finalize();
+				slot->inUse = false;
+			}
+		}
 	}
 
 	extern "C" void wntgd_FinalizeDecoder()
 	{
+		wntgd_StopPlayback();
+		wntgd_StopDecodeWorkers();
+		for (int i = 0; i < MAX_SPEAKER_DECODER_COUNT; i++)
+		{
+			SpeakerDecoder* slot = &speakerDecoders[i];
+			if (slot->inUse) slot->decoder.Finalize();
+			Free(MemoryCategory_Decoder, slot->workBuffer);
+			Free(MemoryCategory_Decoder, slot->playoutStorage);
+			slot->inUse = false;
+			slot->workBuffer = nullptr;
+			slot->playoutStorage = nullptr;
+			slot->playoutBuffer = nullptr;
+		}
+
 		decoder->Finalize();
-		delete opusDecoderWorkBuffer;
-		decoderAllocator.Free(decoderOutBuffer);
-		decoderAllocator.Finalize();
-		delete totalBufferDecoder;
+		decoder->~OpusDecoder();
+		Free(MemoryCategory_Decoder, decoder);
+		Free(MemoryCategory_Decoder, opusDecoderWorkBuffer);
+		Free(MemoryCategory_Decoder, mixScratchBuffer);
+		Free(MemoryCategory_Decoder, decoderOutBuffer);
+		decoder = nullptr;
+		ReleaseArena();
 	}
 
-	extern "C" bool wntgd_DecompressVoiceData(intptr_t * handle, char* inputBuffer, int count, float** audioOut, int* outSampleCount, unsigned int* sampleRateOut)
+	// Size of the frame's own codec packet (or bundle), without the redundant copy of the previous one.
+	// The codec packet header starts with the big-endian payload size.
+	size_t GetPrimaryPacketSize(const VoiceFrame& frame)
+	{
+		if (!(frame.flags & VoiceFrameFlag_Redundant)) return frame.payloadSize;
+		if (frame.flags & VoiceFrameFlag_Bundle)
+		{
+			VoiceBundleReader bundle(frame.payload, frame.payloadSize);
+			return bundle.IsValid() ? bundle.GetSize() : frame.payloadSize;
+		}
+		if (frame.payloadSize < OpusPacketHeaderSize) return frame.payloadSize;
+		const uint8_t* p = reinterpret_cast<const uint8_t*>(frame.payload);
+		size_t packetSize = OpusPacketHeaderSize + ((static_cast<size_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3]);
+		return packetSize < frame.payloadSize ? packetSize : frame.payloadSize;
+	}
+
+	// Decodes one codec packet, timing it for the statistics.
+	OpusResult DecodePacket(OpusDecoder* decoder, int* outSampleCount, int16_t* dest, size_t destSize, const char* packet, size_t packetSize)
+	{
+		size_t consumed = 0;
+		nn::os::Tick begin = nn::os::GetSystemTick();
+		OpusResult result = decoder->DecodeInterleaved(&consumed, outSampleCount, dest, destSize, packet, packetSize);
+		nn::os::Tick end = nn::os::GetSystemTick();
+		if (result != OpusResult_Success)
+		{
+			decodeErrorCount.fetch_add(1, std::memory_order_relaxed);
+			return result;
+		}
+		decodedFrameCount.fetch_add(1, std::memory_order_relaxed);
+		decodeTimeHistogram.Record(nn::os::ConvertToTimeSpan(end - begin).GetMicroSeconds());
+		return result;
+	}
+
+	// Decodes the codec packet, or every packet of the bundle, at payload into dest (destSize bytes).
+	// Bundled packets travel with only the final range of their codec packet header; the size is
+	// put back in front of it here.
+	OpusResult DecodePayload(OpusDecoder* decoder, int* outSampleCount, int16_t* dest, size_t destSize, const char* payload, size_t payloadSize, bool isBundle)
+	{
+		if (!isBundle) return DecodePacket(decoder, outSampleCount, dest, destSize, payload, payloadSize);
+
+		*outSampleCount = 0;
+		VoiceBundleReader bundle(payload, payloadSize);
+		char packet[OpusPacketSizeMaximum];
+		const char* bundlePacket;
+		size_t bundlePacketSize;
+		if (!bundle.IsValid())
+		{
+			decodeErrorCount.fetch_add(1, std::memory_order_relaxed);
+			return OpusResult_InvalidPacket;
+		}
+		while (bundle.Next(&bundlePacket, &bundlePacketSize))
+		{
+			const size_t sizeFieldSize = OpusPacketHeaderSize - VoiceBundlePacketRangeSize;
+			if (bundlePacketSize < VoiceBundlePacketRangeSize || bundlePacketSize > OpusPacketSizeMaximum - sizeFieldSize)
+			{
+				decodeErrorCount.fetch_add(1, std::memory_order_relaxed);
+				return OpusResult_InvalidPacket;
+			}
+			size_t codecPacketSize = bundlePacketSize - VoiceBundlePacketRangeSize;
+			uint8_t* header = reinterpret_cast<uint8_t*>(packet);
+			header[0] = static_cast<uint8_t>(codecPacketSize >> 24);
+			header[1] = static_cast<uint8_t>(codecPacketSize >> 16);
+			header[2] = static_cast<uint8_t>(codecPacketSize >> 8);
+			header[3] = static_cast<uint8_t>(codecPacketSize);
+			std::memcpy(packet + sizeFieldSize, bundlePacket, bundlePacketSize);
+
+			int sampleCount = 0;
+			OpusResult result = DecodePacket(decoder, &sampleCount, dest + *outSampleCount, destSize - *outSampleCount * sizeof(int16_t),
+				packet, OpusPacketHeaderSize + codecPacketSize);
+			if (result != OpusResult_Success) return result;
+			*outSampleCount += sampleCount;
+		}
+		return OpusResult_Success;
+	}
+
+	// Counts the frames of a received buffer for the statistics.
+	void CountReceivedFrame(const VoiceFrame& frame)
+	{
+		receivedFrameCount.fetch_add(1, std::memory_order_relaxed);
+		receivedByteCount.fetch_add(VoiceFrameHeaderSize + frame.payloadSize, std::memory_order_relaxed);
+	}
+
+	bool DecodePackets(OpusDecoder* decoder, intptr_t* handle, char* inputBuffer, int count, float** audioOut, int* outSampleCount, unsigned int* sampleRateOut)
 	{
-		size_t partialConsumed = 0;
 		int partialOutSampleCount = 0;
-		size_t totalConsumed = 0;
 		size_t totalOutSampleCount = 0;
 		std::vector<float>* outVector = new std::vector<float>(0);
 		bool result = true;
 
-		while (count > 0)
+		VoiceFrameReader reader(inputBuffer, count);
+		VoiceFrame frame;
+		while (reader.Next(&frame))
 		{
-			OpusResult decoderResult = decoder->DecodeInterleaved(&partialConsumed, &partialOutSampleCount,
-				decoderOutBuffer, decoderOutBufferSize, inputBuffer, count);
+			CountReceivedFrame(frame);
+			OpusResult decoderResult = DecodePayload(decoder, &partialOutSampleCount, decoderOutBuffer, decoderOutBufferSize * sizeof(int16_t),
+				frame.payload, GetPrimaryPacketSize(frame), (frame.flags & VoiceFrameFlag_Bundle) != 0);
 
 			if (decoderResult == OpusResult_Success)
 			{
-				inputBuffer += partialConsumed;
-				count -= partialConsumed;
-				totalConsumed += partialConsumed;
 				totalOutSampleCount += partialOutSampleCount;
 				outVector->resize(totalOutSampleCount);
-				for (int i = 0; i < partialOutSampleCount; i++)
-				{
-					outVector->at(totalOutSampleCount - partialOutSampleCount + i) = static_cast<float>(decoderOutBuffer[i]) / 32767;
-				}
+				SwitchVoiceChatSimd::ConvertInt16ToFloat(outVector->data() + totalOutSampleCount - partialOutSampleCount,
+					decoderOutBuffer, partialOutSampleCount, SAMPLE_SCALE);
 			}
 			else
 			{
@@ -82,6 +458,11 @@ namespace SwitchVoiceChatDecodeNativeCode {
 				break;
 			}
 		}
+		if (!reader.IsValid())
+		{
+			invalidBufferCount.fetch_add(1, std::memory_order_relaxed);
+			result = false;
+		}
 
 		*handle = reinterpret_cast<intptr_t>(outVector);
 		*audioOut = outVector->data();
@@ -90,6 +471,860 @@ namespace SwitchVoiceChatDecodeNativeCode {
 		return result;
 	}
 
+	// Decodes every frame of inputBuffer into dest (capacity samples). Each frame goes through the
+	// small pcmBuffer (decoderOutBufferSize samples), which stays in cache, and is converted to float
+	// in one vectorized pass.
+	bool DecodePacketsInto(OpusDecoder* decoder, const char* inputBuffer, int count, float* dest, size_t capacity, size_t* written, int16_t* pcmBuffer)
+	{
+		size_t totalOutSampleCount = 0;
+		bool result = true;
+
+		VoiceFrameReader reader(inputBuffer, count);
+		VoiceFrame frame;
+		while (reader.Next(&frame))
+		{
+			CountReceivedFrame(frame);
+			size_t remaining = capacity - totalOutSampleCount;
+			if (remaining > static_cast<size_t>(decoderOutBufferSize)) remaining = decoderOutBufferSize;
+
+			int partialOutSampleCount = 0;
+			OpusResult decoderResult = DecodePayload(decoder, &partialOutSampleCount, pcmBuffer, remaining * sizeof(int16_t),
+				frame.payload, GetPrimaryPacketSize(frame), (frame.flags & VoiceFrameFlag_Bundle) != 0);
+			if (decoderResult != OpusResult_Success)
+			{
+				result = false;
+				break;
+			}
+
+			SwitchVoiceChatSimd::ConvertInt16ToFloat(dest + totalOutSampleCount, pcmBuffer, partialOutSampleCount, SAMPLE_SCALE);
+			totalOutSampleCount += partialOutSampleCount;
+		}
+		if (!reader.IsValid())
+		{
+			invalidBufferCount.fetch_add(1, std::memory_order_relaxed);
+			result = false;
+		}
+
+		*written = totalOutSampleCount;
+		return result;
+	}
+
+	extern "C" int wntgd_GetVoiceFrameInfo(const char* inputBuffer, int count, VoiceFrameInfo* frames, int maxFrameCount)
+	{
+		int frameCount = 0;
+		VoiceFrameReader reader(inputBuffer, count);
+		VoiceFrame frame;
+		while (frameCount < maxFrameCount)
+		{
+			size_t offset = reader.GetOffset();
+			if (!reader.Next(&frame)) break;
+
+			VoiceFrameInfo* info = &frames[frameCount++];
+			info->offset = static_cast<int>(offset);
+			info->size = static_cast<int>(reader.GetOffset() - offset);
+			info->sequence = frame.sequence;
+			info->timestamp = frame.timestamp;
+			info->durationMicroSeconds = GetVoiceFrameDurationMicroSeconds(frame);
+			info->flags = frame.flags;
+		}
+		return frameCount;
+	}
+
+	extern "C" bool wntgd_DecompressVoiceDataInto(char* inputBuffer, int count, float* audioOut, int capacity, int* outSampleCount, unsigned int* sampleRateOut)
+	{
+		size_t written = 0;
+		bool result = DecodePacketsInto(decoder, inputBuffer, count, audioOut, capacity, &written, decoderOutBuffer);
+		*outSampleCount = static_cast<int>(written);
+		*sampleRateOut = SAMPLE_RATE;
+		return result;
+	}
+
+	extern "C" bool wntgd_DecompressSpeakerVoiceDataInto(uint64_t speakerId, char* inputBuffer, int count, float* audioOut, int capacity, int* outSampleCount, unsigned int* sampleRateOut)
+	{
+		*outSampleCount = 0;
+		*sampleRateOut = SAMPLE_RATE;
+		std::lock_guard<nn::os::Mutex> lock(speakerMutex);
+		SpeakerDecoder* speaker = CheckoutSpeaker(speakerId);
+		if (!speaker) return false;
+
+		size_t written = 0;
+		bool result = DecodePacketsInto(&speaker->decoder, inputBuffer, count, audioOut, capacity, &written, decoderOutBuffer);
+		*outSampleCount = static_cast<int>(written);
+		return result;
+	}
+
+	extern "C" bool wntgd_DecompressVoiceData(intptr_t * handle, char* inputBuffer, int count, float** audioOut, int* outSampleCount, unsigned int* sampleRateOut)
+	{
+		return DecodePackets(decoder, handle, inputBuffer, count, audioOut, outSampleCount, sampleRateOut);
+	}
+
+	extern "C" bool wntgd_DecompressSpeakerVoiceData(uint64_t speakerId, intptr_t * handle, char* inputBuffer, int count, float** audioOut, int* outSampleCount, unsigned int* sampleRateOut)
+	{
+		std::lock_guard<nn::os::Mutex> lock(speakerMutex);
+		SpeakerDecoder* speaker = CheckoutSpeaker(speakerId);
+		if (!speaker)
+		{
+			*handle = 0;
+			*audioOut = nullptr;
+			*outSampleCount = 0;
+			*sampleRateOut = SAMPLE_RATE;
+			return false;
+		}
+		return DecodePackets(&speaker->decoder, handle, inputBuffer, count, audioOut, outSampleCount, sampleRateOut);
+	}
+
+	// After skipped jobs the decoder state no longer follows the stream, so it is restarted. When the
+	// first frame carries a redundant copy of its predecessor, the copy is decoded first and thrown
+	// away, which primes the decoder history so the first audible frame does not start with a click.
+	void ResyncSpeakerDecoder(SpeakerDecoder* speaker, const SpeakerDecodeJob* job, int16_t* pcmBuffer)
+	{
+		speaker->resyncPending = false;
+		speaker->decoder.Finalize();
+		if (speaker->decoder.Initialize(SAMPLE_RATE, 1, speaker->workBuffer, opusDecoderWorkBufferSize) != OpusResult_Success) return;
+
+		VoiceFrameReader reader(job->inputBuffer, job->count);
+		VoiceFrame frame;
+		if (!reader.Next(&frame) || !(frame.flags & VoiceFrameFlag_Redundant)) return;
+		size_t primarySize = GetPrimaryPacketSize(frame);
+		if (primarySize >= frame.payloadSize) return;
+
+		int sampleCount = 0;
+		DecodePayload(&speaker->decoder, &sampleCount, pcmBuffer, decoderOutBufferSize * sizeof(int16_t),
+			frame.payload + primarySize, frame.payloadSize - primarySize, (frame.flags & VoiceFrameFlag_Bundle) != 0);
+	}
+
+	void RunDecodeChain(int slotIndex, int16_t* pcmBuffer)
+	{
+		SpeakerDecoder* speaker = &speakerDecoders[slotIndex];
+		if (speaker->resyncPending) ResyncSpeakerDecoder(speaker, &batchJobs[batchChainHead[slotIndex]], pcmBuffer);
+
+		nn::os::Tick begin = nn::os::GetSystemTick();
+		for (int i = batchChainHead[slotIndex]; i >= 0; i = batchNextJob[i])
+		{
+			SpeakerDecodeJob* job = &batchJobs[i];
+			size_t written = 0;
+			job->result = DecodePacketsInto(&speaker->decoder, job->inputBuffer, job->count, job->audioOut, job->capacity, &written, pcmBuffer);
+			job->outSampleCount = static_cast<int>(written);
+		}
+
+		// only this thread touches the speaker until the batch is done
+		if (batchScheduled && batchChainFrameCount[slotIndex] > 0)
+		{
+			float cost = static_cast<float>(nn::os::ConvertToTimeSpan(nn::os::GetSystemTick() - begin).GetMicroSeconds()) / batchChainFrameCount[slotIndex];
+			speaker->decodeCostMicroSeconds = speaker->decodeCostMicroSeconds > 0.0f
+				? speaker->decodeCostMicroSeconds + (cost - speaker->decodeCostMicroSeconds) * DECODE_COST_SMOOTHING : cost;
+		}
+	}
+
+	// Participant `self` drains its own queue first, then steals from the others in turn.
+	void RunDecodeQueues(int self, int16_t* pcmBuffer)
+	{
+		for (int k = 0; k < batchQueueCount; k++)
+		{
+			DecodeQueue* queue = &batchQueues[(self + k) % batchQueueCount];
+			for (int chain = queue->next.fetch_add(1, std::memory_order_relaxed); chain < queue->end; chain = queue->next.fetch_add(1, std::memory_order_relaxed))
+			{
+				RunDecodeChain(batchChains[chain], pcmBuffer);
+			}
+		}
+	}
+
+	void DecodeWorkerThread(void* argument)
+	{
+		int index = static_cast<int>(reinterpret_cast<intptr_t>(argument));
+		DecodeWorker* worker = &decodeWorkers[index];
+		for (;;)
+		{
+			worker->startEvent->Wait();
+			if (!decodeWorkersRunning.load(std::memory_order_acquire)) break;
+			RunDecodeQueues(index + 1, worker->pcmBuffer);
+			if (batchActiveWorkerCount.fetch_sub(1, std::memory_order_acq_rel) == 1) batchDoneEvent.Signal();
+		}
+	}
+
+	// Sorts batchChains by rank and returns how many of them fit the schedule; those are decoded,
+	// the rest skipped. Costs are estimated from each speaker's measured decode time per frame.
+	int ScheduleDecodeChains(int chainCount)
+	{
+		// the hysteresis keeps a crowd near the budget from swapping speakers, and resetting their
+		// decoders, every tick
+		float ranks[MAX_SPEAKER_DECODER_COUNT];
+		for (int c = 0; c < chainCount; c++)
+		{
+			const SpeakerDecoder* speaker = &speakerDecoders[batchChains[c]];
+			ranks[c] = speaker->schedulePriority * (speaker->resyncPending ? 1.0f : SCHEDULE_HYSTERESIS);
+		}
+		// insertion sort, stable so equal ranks keep the job order
+		for (int c = 1; c < chainCount; c++)
+		{
+			float rank = ranks[c];
+			int slotIndex = batchChains[c];
+			int d = c;
+			for (; d > 0 && ranks[d - 1] < rank; d--)
+			{
+				ranks[d] = ranks[d - 1];
+				batchChains[d] = batchChains[d - 1];
+			}
+			ranks[d] = rank;
+			batchChains[d] = slotIndex;
+		}
+
+		LatencyHistogramData decodeTime;
+		decodeTimeHistogram.Read(&decodeTime);
+		float defaultCost = decodeTime.count > 0 ? static_cast<float>(decodeTime.totalMicroSeconds) / decodeTime.count : DEFAULT_DECODE_COST_MICROSECONDS;
+
+		float totalCost = 0.0f;
+		int decodeCount = 0;
+		for (; decodeCount < chainCount; decodeCount++)
+		{
+			const SpeakerDecoder* speaker = &speakerDecoders[batchChains[decodeCount]];
+			if (speaker->schedulePriority <= 0.0f) break;
+			if (scheduleMaxSpeakerCount > 0 && decodeCount >= scheduleMaxSpeakerCount) break;
+			float cost = batchChainFrameCount[batchChains[decodeCount]] * (speaker->decodeCostMicroSeconds > 0.0f ? speaker->decodeCostMicroSeconds : defaultCost);
+			if (scheduleBudgetMicroSeconds > 0 && decodeCount > 0 && totalCost + cost > scheduleBudgetMicroSeconds) break;
+			totalCost += cost;
+		}
+		return decodeCount;
+	}
+
+	// Completes the jobs of a chain the schedule left out; the frames still count as received.
+	void SkipDecodeChain(int slotIndex)
+	{
+		speakerDecoders[slotIndex].resyncPending = true;
+		for (int i = batchChainHead[slotIndex]; i >= 0; i = batchNextJob[i])
+		{
+			SpeakerDecodeJob* job = &batchJobs[i];
+			VoiceFrameReader reader(job->inputBuffer, job->count);
+			VoiceFrame frame;
+			while (reader.Next(&frame))
+			{
+				CountReceivedFrame(frame);
+				skippedFrameCount.fetch_add(1, std::memory_order_relaxed);
+			}
+			if (!reader.IsValid()) invalidBufferCount.fetch_add(1, std::memory_order_relaxed);
+			job->result = reader.IsValid();
+			job->skipped = true;
+		}
+	}
+
+	// Decodes jobs[0, jobCount) with jobCount <= MAX_BATCH_JOB_COUNT. Called with speakerMutex held,
+	// which keeps the speaker slots still for the workers.
+	bool DecodeBatchSlice(SpeakerDecodeJob* jobs, int jobCount)
+	{
+		bool result = true;
+		int chainCount = 0;
+		batchScheduled = scheduleBudgetMicroSeconds > 0 || scheduleMaxSpeakerCount > 0;
+		for (int i = 0; i < jobCount; i++)
+		{
+			SpeakerDecodeJob* job = &jobs[i];
+			job->outSampleCount = 0;
+			job->result = false;
+			job->skipped = false;
+			batchNextJob[i] = -1;
+
+			int frameCount = 0;
+			if (batchScheduled)
+			{
+				VoiceFrameReader reader(job->inputBuffer, job->count);
+				VoiceFrame frame;
+				while (reader.Next(&frame)) frameCount++;
+			}
+
+			SpeakerDecoder* speaker = FindSpeaker(job->speakerId);
+			int slotIndex = speaker ? static_cast<int>(speaker - speakerDecoders) : -1;
+			if (slotIndex >= 0 && batchChainHead[slotIndex] >= 0)
+			{
+				speaker->lastUsed = ++speakerDecoderUseCounter;
+				batchNextJob[batchChainTail[slotIndex]] = i;
+				batchChainTail[slotIndex] = i;
+				batchChainFrameCount[slotIndex] += frameCount;
+				continue;
+			}
+
+			// A new speaker may evict the least recently used slot, which is never one with a chain
+			// as long as some slot has none.
+			speaker = chainCount < MAX_SPEAKER_DECODER_COUNT ? CheckoutSpeaker(job->speakerId) : nullptr;
+			if (!speaker)
+			{
+				result = false;
+				continue;
+			}
+			slotIndex = static_cast<int>(speaker - speakerDecoders);
+			batchChainHead[slotIndex] = i;
+			batchChainTail[slotIndex] = i;
+			batchChainFrameCount[slotIndex] = frameCount;
+			batchChains[chainCount++] = slotIndex;
+		}
+
+		batchJobs = jobs;
+		int decodeChainCount = batchScheduled ? ScheduleDecodeChains(chainCount) : chainCount;
+		for (int c = decodeChainCount; c < chainCount; c++) SkipDecodeChain(batchChains[c]);
+
+		// deal the chains out in contiguous runs, one queue per participant that has work
+		int workerCount = decodeWorkersRunning.load(std::memory_order_acquire) ? decodeWorkerCount : 0;
+		if (workerCount > decodeChainCount - 1) workerCount = decodeChainCount > 0 ? decodeChainCount - 1 : 0;
+		batchQueueCount = workerCount + 1;
+		for (int q = 0; q < batchQueueCount; q++)
+		{
+			batchQueues[q].next.store(q * decodeChainCount / batchQueueCount, std::memory_order_relaxed);
+			batchQueues[q].end = (q + 1) * decodeChainCount / batchQueueCount;
+		}
+
+		// the events order the setup above before the workers' reads
+		batchActiveWorkerCount.store(workerCount, std::memory_order_relaxed);
+		for (int w = 0; w < workerCount; w++) decodeWorkers[w].startEvent->Signal();
+		RunDecodeQueues(0, decoderOutBuffer);
+		if (workerCount > 0) batchDoneEvent.Wait();
+
+		for (int c = 0; c < chainCount; c++)
+		{
+			int head = batchChainHead[batchChains[c]];
+			batchChainHead[batchChains[c]] = -1;
+			for (int i = head; i >= 0; i = batchNextJob[i]) result = result && jobs[i].result;
+		}
+		return result;
+	}
+
+	extern "C" bool wntgd_DecompressSpeakerVoiceDataBatch(SpeakerDecodeJob* jobs, int jobCount, unsigned int* sampleRateOut)
+	{
+		*sampleRateOut = SAMPLE_RATE;
+		std::lock_guard<nn::os::Mutex> lock(speakerMutex);
+		bool result = true;
+		for (int offset = 0; offset < jobCount; offset += MAX_BATCH_JOB_COUNT)
+		{
+			int sliceCount = jobCount - offset < MAX_BATCH_JOB_COUNT ? jobCount - offset : MAX_BATCH_JOB_COUNT;
+			if (!DecodeBatchSlice(jobs + offset, sliceCount)) result = false;
+		}
+		return result;
+	}
+
+	extern "C" void wntgd_SetDecodeSchedule(int budgetMicroSeconds, int maxSpeakerCount)
+	{
+		std::lock_guard<nn::os::Mutex> lock(speakerMutex);
+		scheduleBudgetMicroSeconds = budgetMicroSeconds > 0 ? budgetMicroSeconds : 0;
+		scheduleMaxSpeakerCount = maxSpeakerCount > 0 ? maxSpeakerCount : 0;
+	}
+
+	extern "C" bool wntgd_SetSpeakerPriority(uint64_t speakerId, float priority)
+	{
+		// a hint never takes a decoder slot, which could evict another speaker
+		std::lock_guard<nn::os::Mutex> lock(speakerMutex);
+		SpeakerDecoder* speaker = FindSpeaker(speakerId);
+		if (!speaker) return false;
+		speaker->schedulePriority = priority;
+		return true;
+	}
+
+	size_t GetDecodeWorkerMemorySize(int workerCount)
+	{
+		return workerCount * (GetAllocationSize(DECODE_WORKER_STACK_SIZE, nn::os::ThreadStackAlignment)
+			+ GetAllocationSize(MAX_FRAME_SAMPLE_COUNT * sizeof(int16_t), AudioInBuffer::AddressAlignment)
+			+ GetAllocationSize(sizeof(nn::os::Event)));
+	}
+
+	void FreeDecodeWorker(DecodeWorker* worker)
+	{
+		if (worker->startEvent)
+		{
+			worker->startEvent->~Event();
+			Free(MemoryCategory_Decoder, worker->startEvent);
+		}
+		Free(MemoryCategory_Decoder, worker->pcmBuffer);
+		Free(MemoryCategory_Decoder, worker->stack);
+	}
+
+	extern "C" bool wntgd_StartDecodeWorkers(int workerCount)
+	{
+		if (decodeWorkersRunning.load(std::memory_order_acquire)) wntgd_StopDecodeWorkers();
+		if (workerCount < 1) return true;
+		if (workerCount > MAX_DECODE_WORKER_COUNT) workerCount = MAX_DECODE_WORKER_COUNT;
+
+		decodeWorkersRunning.store(true, std::memory_order_release);
+		decodeWorkerCount = 0;
+		for (int i = 0; i < workerCount; i++)
+		{
+			DecodeWorker* worker = &decodeWorkers[i];
+			worker->stack = Allocate(MemoryCategory_Decoder, DECODE_WORKER_STACK_SIZE, nn::os::ThreadStackAlignment);
+			worker->pcmBuffer = reinterpret_cast<int16_t*>(Allocate(MemoryCategory_Decoder, decoderOutBufferSize * sizeof(int16_t), AudioInBuffer::AddressAlignment));
+			void* eventStorage = Allocate(MemoryCategory_Decoder, sizeof(nn::os::Event));
+			worker->startEvent = eventStorage ? new (eventStorage) nn::os::Event(nn::os::EventClearMode_AutoClear) : nullptr;
+			if (!worker->stack || !worker->pcmBuffer || !worker->startEvent
+				|| nn::os::CreateThread(&worker->thread, DecodeWorkerThread, reinterpret_cast<void*>(static_cast<intptr_t>(i)),
+					worker->stack, DECODE_WORKER_STACK_SIZE, DECODE_WORKER_PRIORITY, (i + 1) % DECODE_WORKER_CORE_COUNT).IsFailure())
+			{
+				FreeDecodeWorker(worker);
+				break;
+			}
+			nn::os::SetThreadName(&worker->thread, "VoiceChatDecoder");
+			nn::os::StartThread(&worker->thread);
+			decodeWorkerCount++;
+		}
+
+		if (decodeWorkerCount < workerCount)
+		{
+			wntgd_StopDecodeWorkers();
+			return false;
+		}
+		return true;
+	}
+
+	extern "C" void wntgd_StopDecodeWorkers()
+	{
+		if (!decodeWorkersRunning.load(std::memory_order_acquire)) return;
+		// no batch is running: batches hold speakerMutex until every worker is done
+		std::lock_guard<nn::os::Mutex> lock(speakerMutex);
+		decodeWorkersRunning.store(false, std::memory_order_release);
+		for (int i = 0; i < decodeWorkerCount; i++)
+		{
+			decodeWorkers[i].startEvent->Signal();
+			nn::os::WaitThread(&decodeWorkers[i].thread);
+			nn::os::DestroyThread(&decodeWorkers[i].thread);
+			FreeDecodeWorker(&decodeWorkers[i]);
+		}
+		decodeWorkerCount = 0;
+	}
+
+	bool DecodePlayoutFrame(SpeakerDecoder* speaker, const char* packet, size_t packetSize, bool isBundle)
+	{
+		int sampleCount = 0;
+		OpusResult result = DecodePayload(&speaker->decoder, &sampleCount,
+			speaker->playoutBuffer, PLAYOUT_FRAME_SAMPLE_COUNT * sizeof(int16_t), packet, packetSize, isBundle);
+		if (result != OpusResult_Success || sampleCount <= 0) return false;
+
+		speaker->playoutOffset = 0;
+		speaker->playoutCount = sampleCount;
+		speaker->playoutGain = 1.0f;
+		speaker->concealedInRow = 0;
+		return true;
+	}
+
+	// Packet-loss concealment: replays the last frame at half the gain each time, then silence.
+	bool ConcealPlayoutFrame(SpeakerDecoder* speaker)
+	{
+		if (speaker->playoutCount == 0) return false;
+		speaker->playoutOffset = 0;
+		speaker->playoutGain = speaker->concealedInRow < MAX_CONCEALED_FRAME_COUNT ? speaker->playoutGain * 0.5f : 0.0f;
+		speaker->concealedInRow++;
+		speaker->concealedFrameCount++;
+		totalConcealedFrameCount.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	// Fills playoutBuffer with the next frame: the decoded frame, the frame recovered from the
+	// redundant copy carried by its successor, or a concealed one. Returns false while buffering.
+	bool RefillPlayout(SpeakerDecoder* speaker)
+	{
+		VoiceFrame frame;
+		JitterBuffer::PopResult popResult = speaker->jitterBuffer.Pop(&frame);
+		if (popResult == JitterBuffer::PopResult_Buffering) return false;
+
+		if (popResult == JitterBuffer::PopResult_Frame)
+		{
+			if (DecodePlayoutFrame(speaker, frame.payload, GetPrimaryPacketSize(frame), (frame.flags & VoiceFrameFlag_Bundle) != 0)) return true;
+		}
+		else if (popResult == JitterBuffer::PopResult_Missing)
+		{
+			speaker->lostFrameCount++;
+			totalLostFrameCount.fetch_add(1, std::memory_order_relaxed);
+			VoiceFrame next;
+			if (speaker->jitterBuffer.PeekNext(&next) && (next.flags & VoiceFrameFlag_Redundant))
+			{
+				size_t primarySize = GetPrimaryPacketSize(next);
+				if (primarySize < next.payloadSize && DecodePlayoutFrame(speaker, next.payload + primarySize, next.payloadSize - primarySize,
+					(next.flags & VoiceFrameFlag_Bundle) != 0))
+				{
+					speaker->recoveredFrameCount++;
+					totalRecoveredFrameCount.fetch_add(1, std::memory_order_relaxed);
+					return true;
+				}
+			}
+		}
+		else if (speaker->concealedInRow >= MAX_CONCEALED_FRAME_COUNT)
+		{
+			// underrun after the concealment already faded out: the speaker simply stopped talking
+			return false;
+		}
+		return ConcealPlayoutFrame(speaker);
+	}
+
+	extern "C" bool wntgd_PushSpeakerVoiceData(uint64_t speakerId, const char* inputBuffer, int count)
+	{
+		std::lock_guard<nn::os::Mutex> lock(speakerMutex);
+		SpeakerDecoder* speaker = CheckoutSpeaker(speakerId, true);
+		if (!speaker) return false;
+
+		// arrival time in 48 kHz samples, the unit of the frame timestamps
+		int64_t arrivalTime = nn::os::ConvertToTimeSpan(nn::os::GetSystemTick()).GetMicroSeconds() * (VoiceFrameTimestampRate / 1000) / 1000;
+
+		VoiceFrameReader reader(inputBuffer, count);
+		VoiceFrame frame;
+		while (reader.Next(&frame))
+		{
+			CountReceivedFrame(frame);
+			if (!speaker->jitterBuffer.Insert(frame, arrivalTime)) rejectedFrameCount.fetch_add(1, std::memory_order_relaxed);
+		}
+		if (!reader.IsValid()) invalidBufferCount.fetch_add(1, std::memory_order_relaxed);
+		return reader.IsValid();
+	}
+
+	// Writes sampleCount samples of the speaker's playout to audioOut, silence included.
+	bool PullPlayout(SpeakerDecoder* speaker, float* audioOut, int sampleCount)
+	{
+		int written = 0;
+		bool audible = false;
+
+		while (speaker && speaker->playoutStorage && written < sampleCount)
+		{
+			if (speaker->playoutOffset == speaker->playoutCount && !RefillPlayout(speaker)) break;
+
+			int partialCount = speaker->playoutCount - speaker->playoutOffset;
+			if (partialCount > sampleCount - written) partialCount = sampleCount - written;
+			SwitchVoiceChatSimd::ConvertInt16ToFloat(audioOut + written, speaker->playoutBuffer + speaker->playoutOffset,
+				partialCount, SAMPLE_SCALE * speaker->playoutGain);
+			if (speaker->playoutGain > 0.0f) audible = true;
+			speaker->playoutOffset += partialCount;
+			written += partialCount;
+		}
+
+		if (written < sampleCount) std::memset(audioOut + written, 0, (sampleCount - written) * sizeof(float));
+		return audible;
+	}
+
+	// int16 version of PullPlayout for the renderer: a plain copy, scaled only while concealing.
+	bool PullPlayoutPcm(SpeakerDecoder* speaker, int16_t* pcmOut, int sampleCount)
+	{
+		int written = 0;
+		bool audible = false;
+
+		while (speaker->playoutStorage && written < sampleCount)
+		{
+			if (speaker->playoutOffset == speaker->playoutCount && !RefillPlayout(speaker)) break;
+
+			int partialCount = speaker->playoutCount - speaker->playoutOffset;
+			if (partialCount > sampleCount - written) partialCount = sampleCount - written;
+			const int16_t* source = speaker->playoutBuffer + speaker->playoutOffset;
+			if (speaker->playoutGain == 1.0f)
+			{
+				std::memcpy(pcmOut + written, source, partialCount * sizeof(int16_t));
+			}
+			else
+			{
+				int32_t gain = static_cast<int32_t>(speaker->playoutGain * 32768.0f);
+				for (int i = 0; i < partialCount; i++) pcmOut[written + i] = static_cast<int16_t>((source[i] * gain) >> 15);
+			}
+			if (speaker->playoutGain > 0.0f) audible = true;
+			speaker->playoutOffset += partialCount;
+			written += partialCount;
+		}
+
+		if (written < sampleCount) std::memset(pcmOut + written, 0, (sampleCount - written) * sizeof(int16_t));
+		return audible;
+	}
+
+	extern "C" bool wntgd_PullSpeakerVoice(uint64_t speakerId, float* audioOut, int sampleCount, unsigned int* sampleRateOut)
+	{
+		*sampleRateOut = SAMPLE_RATE;
+		// the playback thread owns every playout while it runs
+		if (playbackRunning.load(std::memory_order_acquire))
+		{
+			std::memset(audioOut, 0, sampleCount * sizeof(float));
+			return false;
+		}
+		std::lock_guard<nn::os::Mutex> lock(speakerMutex);
+		return PullPlayout(FindSpeaker(speakerId), audioOut, sampleCount);
+	}
+
+	extern "C" bool wntgd_GetSpeakerPlayoutStatus(uint64_t speakerId, SpeakerPlayoutStatus* status)
+	{
+		std::memset(status, 0, sizeof(*status));
+		std::lock_guard<nn::os::Mutex> lock(speakerMutex);
+		SpeakerDecoder* speaker = FindSpeaker(speakerId);
+		if (!speaker || !speaker->playoutStorage) return false;
+
+		const JitterBuffer& jitterBuffer = speaker->jitterBuffer;
+		int samplesPerMilli = VoiceFrameTimestampRate / 1000;
+		status->jitterMicroSeconds = static_cast<int>(jitterBuffer.GetJitter() * 1000 / samplesPerMilli);
+		status->targetDelayMicroSeconds = jitterBuffer.GetTargetDepth() * jitterBuffer.GetFrameSampleCount() * 1000 / samplesPerMilli;
+		status->bufferedFrameCount = jitterBuffer.GetDepth();
+		status->lostFrameCount = speaker->lostFrameCount;
+		status->recoveredFrameCount = speaker->recoveredFrameCount;
+		status->concealedFrameCount = speaker->concealedFrameCount;
+		status->lateFrameCount = jitterBuffer.GetLateCount();
+		status->droppedFrameCount = jitterBuffer.GetDroppedCount();
+		return true;
+	}
+
+	extern "C" void wntgd_GetDecodeStats(DecodeStats* stats)
+	{
+		stats->receivedFrameCount = receivedFrameCount.load(std::memory_order_relaxed);
+		stats->receivedByteCount = receivedByteCount.load(std::memory_order_relaxed);
+		stats->invalidBufferCount = invalidBufferCount.load(std::memory_order_relaxed);
+		stats->rejectedFrameCount = rejectedFrameCount.load(std::memory_order_relaxed);
+		stats->decodedFrameCount = decodedFrameCount.load(std::memory_order_relaxed);
+		stats->decodeErrorCount = decodeErrorCount.load(std::memory_order_relaxed);
+		stats->lostFrameCount = totalLostFrameCount.load(std::memory_order_relaxed);
+		stats->recoveredFrameCount = totalRecoveredFrameCount.load(std::memory_order_relaxed);
+		stats->concealedFrameCount = totalConcealedFrameCount.load(std::memory_order_relaxed);
+		stats->skippedFrameCount = skippedFrameCount.load(std::memory_order_relaxed);
+		decodeTimeHistogram.Read(&stats->decodeTime);
+	}
+
+	extern "C" bool wntgd_SetSpeakerMix(uint64_t speakerId, float gain, float pan)
+	{
+		// like the priority hint, never takes a decoder slot
+		std::lock_guard<nn::os::Mutex> lock(speakerMutex);
+		SpeakerDecoder* speaker = FindSpeaker(speakerId);
+		if (!speaker) return false;
+
+		if (pan < -1.0f) pan = -1.0f;
+		if (pan > 1.0f) pan = 1.0f;
+		// constant power: left^2 + right^2 == gain^2 for every pan position
+		float angle = (pan + 1.0f) * 0.5f * HALF_PI;
+		speaker->mixLeftGain = gain * std::cos(angle);
+		speaker->mixRightGain = gain * std::sin(angle);
+		return true;
+	}
+
+	extern "C" int wntgd_MixSpeakers(float* stereoOut, int frameCount, unsigned int* sampleRateOut)
+	{
+		*sampleRateOut = SAMPLE_RATE;
+		std::memset(stereoOut, 0, frameCount * 2 * sizeof(float));
+		if (playbackRunning.load(std::memory_order_acquire)) return 0;
+
+		std::lock_guard<nn::os::Mutex> lock(speakerMutex);
+		int audibleSpeakerCount = 0;
+		for (int i = 0; i < MAX_SPEAKER_DECODER_COUNT; i++)
+		{
+			SpeakerDecoder* speaker = &speakerDecoders[i];
+			if (!speaker->inUse || !speaker->playoutStorage) continue;
+
+			bool audible = false;
+			for (int offset = 0; offset < frameCount; offset += MIX_CHUNK_SAMPLE_COUNT)
+			{
+				int chunkCount = frameCount - offset < MIX_CHUNK_SAMPLE_COUNT ? frameCount - offset : MIX_CHUNK_SAMPLE_COUNT;
+				if (!PullPlayout(speaker, mixScratchBuffer, chunkCount)) continue;
+
+				SwitchVoiceChatSimd::MixMonoToStereo(stereoOut + offset * 2, mixScratchBuffer, chunkCount, speaker->mixLeftGain, speaker->mixRightGain);
+				audible = true;
+			}
+			if (audible) audibleSpeakerCount++;
+		}
+
+		SwitchVoiceChatSimd::ClampSamples(stereoOut, frameCount * 2, 1.0f);
+		return audibleSpeakerCount;
+	}
+
+	// Refills a wave buffer the renderer is done with and queues it again.
+	void FeedWaveBuffer(PlaybackVoice* playbackVoice, WaveBuffer* waveBuffer)
+	{
+		PullPlayoutPcm(playbackVoice->speaker, static_cast<int16_t*>(const_cast<void*>(waveBuffer->buffer)), RENDERER_SAMPLE_COUNT);
+		AppendWaveBuffer(&playbackVoice->voice, waveBuffer);
+	}
+
+	bool AcquirePlaybackVoice(SpeakerDecoder* speaker)
+	{
+		for (int i = 0; i < PLAYBACK_VOICE_COUNT; i++)
+		{
+			PlaybackVoice* playbackVoice = &playbackVoices[i];
+			if (playbackVoice->speaker) continue;
+			if (!AcquireVoiceSlot(&rendererConfig, &playbackVoice->voice, SAMPLE_RATE, 1, SampleFormat_PcmInt16, VoiceType::PriorityHighest, nullptr, 0)) return false;
+			SetVoiceDestination(&rendererConfig, &playbackVoice->voice, &finalMix);
+
+			playbackVoice->speaker = speaker;
+			playbackVoice->speakerId = speaker->speakerId;
+			speaker->playbackVoiceIndex = i;
+			for (int j = 0; j < PLAYBACK_WAVE_BUFFER_COUNT; j++)
+			{
+				WaveBuffer* waveBuffer = &playbackVoice->waveBuffers[j];
+				waveBuffer->buffer = playbackPcmBuffer + (i * PLAYBACK_WAVE_BUFFER_COUNT + j) * RENDERER_SAMPLE_COUNT;
+				waveBuffer->size = RENDERER_SAMPLE_COUNT * sizeof(int16_t);
+				waveBuffer->startSampleOffset = 0;
+				waveBuffer->endSampleOffset = RENDERER_SAMPLE_COUNT;
+				waveBuffer->loop = false;
+				waveBuffer->isEndOfStream = false;
+				waveBuffer->pContext = nullptr;
+				waveBuffer->contextSize = 0;
+				FeedWaveBuffer(playbackVoice, waveBuffer);
+			}
+			SetVoicePlayState(&playbackVoice->voice, VoiceType::PlayState_Play);
+			return true;
+		}
+		return false;
+	}
+
+	void ReleasePlaybackVoice(PlaybackVoice* playbackVoice)
+	{
+		SetVoicePlayState(&playbackVoice->voice, VoiceType::PlayState_Stop);
+		ReleaseVoiceSlot(&rendererConfig, &playbackVoice->voice);
+		playbackVoice->speaker->playbackVoiceIndex = -1;
+		playbackVoice->speaker = nullptr;
+	}
+
+	// Once per renderer quantum: follows speakers joining and leaving, applies the mix gains and
+	// refills the released wave buffers. Called with speakerMutex held.
+	void UpdatePlayback()
+	{
+		for (int i = 0; i < PLAYBACK_VOICE_COUNT; i++)
+		{
+			// released, or evicted by CheckoutSpeaker and taken by another speaker
+			const SpeakerDecoder* speaker = playbackVoices[i].speaker;
+			if (speaker && (!speaker->inUse || speaker->speakerId != playbackVoices[i].speakerId)) ReleasePlaybackVoice(&playbackVoices[i]);
+		}
+		for (int i = 0; i < MAX_SPEAKER_DECODER_COUNT; i++)
+		{
+			SpeakerDecoder* speaker = &speakerDecoders[i];
+			// speakers beyond PLAYBACK_VOICE_COUNT are not played until a voice frees up
+			if (speaker->inUse && speaker->playoutStorage && speaker->playbackVoiceIndex < 0 && !AcquirePlaybackVoice(speaker)) break;
+		}
+
+		for (int i = 0; i < PLAYBACK_VOICE_COUNT; i++)
+		{
+			PlaybackVoice* playbackVoice = &playbackVoices[i];
+			if (!playbackVoice->speaker) continue;
+
+			SetVoiceMixVolume(&playbackVoice->voice, &finalMix, playbackVoice->speaker->mixLeftGain, 0, 0);
+			SetVoiceMixVolume(&playbackVoice->voice, &finalMix, playbackVoice->speaker->mixRightGain, 0, 1);
+			while (const WaveBuffer* released = GetReleasedWaveBuffer(&playbackVoice->voice))
+			{
+				FeedWaveBuffer(playbackVoice, &playbackVoice->waveBuffers[released - playbackVoice->waveBuffers]);
+			}
+		}
+	}
+
+	void PlaybackThread(void* argument)
+	{
+		(void)argument;
+		while (playbackRunning.load(std::memory_order_acquire))
+		{
+			rendererEvent.Wait();
+			speakerMutex.Lock();
+			UpdatePlayback();
+			speakerMutex.Unlock();
+			RequestUpdateAudioRenderer(rendererHandle, &rendererConfig);
+		}
+	}
+
+	void InitializePlaybackParameter(AudioRendererParameter* parameter)
+	{
+		InitializeAudioRendererParameter(parameter);
+		parameter->sampleRate = SAMPLE_RATE;
+		parameter->sampleCount = RENDERER_SAMPLE_COUNT;
+		parameter->mixBufferCount = 2;
+		parameter->voiceCount = PLAYBACK_VOICE_COUNT;
+		parameter->sinkCount = 1;
+	}
+
+	size_t GetPlaybackPcmBufferSize()
+	{
+		size_t size = PLAYBACK_VOICE_COUNT * PLAYBACK_WAVE_BUFFER_COUNT * RENDERER_SAMPLE_COUNT * sizeof(int16_t);
+		return (size + MemoryPoolType::SizeGranularity - 1) / MemoryPoolType::SizeGranularity * MemoryPoolType::SizeGranularity;
+	}
+
+	// Arena bytes wntgd_StartPlayback takes.
+	size_t GetPlaybackMemorySize()
+	{
+		AudioRendererParameter parameter;
+		InitializePlaybackParameter(&parameter);
+		return GetAllocationSize(GetAudioRendererWorkBufferSize(parameter), nn::os::MemoryPageSize)
+			+ GetAllocationSize(GetAudioRendererConfigWorkBufferSize(parameter))
+			+ GetAllocationSize(GetPlaybackPcmBufferSize(), MemoryPoolType::AddressAlignment)
+			+ GetAllocationSize(PLAYBACK_THREAD_STACK_SIZE, nn::os::ThreadStackAlignment);
+	}
+
+	void FreePlaybackBuffers()
+	{
+		Free(MemoryCategory_Playback, playbackThreadStack);
+		Free(MemoryCategory_Playback, playbackPcmBuffer);
+		Free(MemoryCategory_Playback, playbackConfigBuffer);
+		Free(MemoryCategory_Playback, playbackWorkBuffer);
+		ReleaseArena();
+	}
+
+	extern "C" bool wntgd_StartPlayback()
+	{
+		if (playbackRunning.load(std::memory_order_acquire)) return false;
+
+		AudioRendererParameter parameter;
+		InitializePlaybackParameter(&parameter);
+		if (!IsValidAudioRendererParameter(parameter)) return false;
+
+		size_t workBufferSize = GetAudioRendererWorkBufferSize(parameter);
+		size_t configBufferSize = GetAudioRendererConfigWorkBufferSize(parameter);
+		size_t pcmBufferSize = GetPlaybackPcmBufferSize();
+
+		if (!AcquireArena()) return false;
+		playbackWorkBuffer = Allocate(MemoryCategory_Playback, workBufferSize, nn::os::MemoryPageSize);
+		playbackConfigBuffer = Allocate(MemoryCategory_Playback, configBufferSize);
+		playbackPcmBuffer = reinterpret_cast<int16_t*>(Allocate(MemoryCategory_Playback, pcmBufferSize, MemoryPoolType::AddressAlignment));
+		playbackThreadStack = Allocate(MemoryCategory_Playback, PLAYBACK_THREAD_STACK_SIZE, nn::os::ThreadStackAlignment);
+		if (!playbackWorkBuffer || !playbackConfigBuffer || !playbackPcmBuffer || !playbackThreadStack
+			|| OpenAudioRenderer(&rendererHandle, &rendererEvent, parameter, playbackWorkBuffer, workBufferSize).IsFailure())
+		{
+			FreePlaybackBuffers();
+			return false;
+		}
+
+		InitializeAudioRendererConfig(&rendererConfig, parameter, playbackConfigBuffer, configBufferSize);
+		AcquireFinalMix(&rendererConfig, &finalMix, 2);
+		int8_t bus[2] = { 0, 1 };
+		bool result = AddDeviceSink(&rendererConfig, &deviceSink, &finalMix, bus, sizeof(bus) / sizeof(bus[0]), "MainAudioOut").IsSuccess()
+			&& AcquireMemoryPool(&rendererConfig, &playbackMemoryPool, playbackPcmBuffer, pcmBufferSize)
+			&& RequestAttachMemoryPool(&playbackMemoryPool)
+			&& RequestUpdateAudioRenderer(rendererHandle, &rendererConfig).IsSuccess()
+			&& StartAudioRenderer(rendererHandle).IsSuccess();
+		if (!result)
+		{
+			CloseAudioRenderer(rendererHandle);
+			nn::os::DestroySystemEvent(rendererEvent.GetBase());
+			FreePlaybackBuffers();
+			return false;
+		}
+
+		for (int i = 0; i < PLAYBACK_VOICE_COUNT; i++) playbackVoices[i].speaker = nullptr;
+		playbackRunning.store(true, std::memory_order_release);
+		if (nn::os::CreateThread(&playbackThread, PlaybackThread, nullptr, playbackThreadStack, PLAYBACK_THREAD_STACK_SIZE, PLAYBACK_THREAD_PRIORITY).IsFailure())
+		{
+			playbackRunning.store(false, std::memory_order_release);
+			StopAudioRenderer(rendererHandle);
+			CloseAudioRenderer(rendererHandle);
+			nn::os::DestroySystemEvent(rendererEvent.GetBase());
+			FreePlaybackBuffers();
+			return false;
+		}
+		nn::os::SetThreadName(&playbackThread, "VoiceChatPlayback");
+		nn::os::StartThread(&playbackThread);
+		return true;
+	}
+
+	extern "C" void wntgd_StopPlayback()
+	{
+		if (!playbackRunning.load(std::memory_order_acquire)) return;
+		// the renderer keeps signaling, so the thread wakes up and sees the flag within a quantum
+		playbackRunning.store(false, std::memory_order_release);
+		nn::os::WaitThread(&playbackThread);
+		nn::os::DestroyThread(&playbackThread);
+
+		speakerMutex.Lock();
+		for (int i = 0; i < PLAYBACK_VOICE_COUNT; i++)
+		{
+			if (playbackVoices[i].speaker) ReleasePlaybackVoice(&playbackVoices[i]);
+		}
+		speakerMutex.Unlock();
+
+		RequestDetachMemoryPool(&playbackMemoryPool);
+		while (IsMemoryPoolAttached(&playbackMemoryPool))
+		{
+			RequestUpdateAudioRenderer(rendererHandle, &rendererConfig);
+			rendererEvent.Wait();
+		}
+		ReleaseMemoryPool(&rendererConfig, &playbackMemoryPool);
+
+		StopAudioRenderer(rendererHandle);
+		CloseAudioRenderer(rendererHandle);
+		nn::os::DestroySystemEvent(rendererEvent.GetBase());
+		FreePlaybackBuffers();
+	}
+
 	extern "C" bool wntgd_ReleaseDecompressBuffer(intptr_t * handler)
 	{
 		auto outVector = reinterpret_cast<std::vector<float>*>(handler);
@@ -1,18 +1,171 @@
 #pragma once
 #include <stdint.h>
+#include <atomic>
 #include <vector>
 #include <cstdlib>
+#include <cstring>
+#include <cmath>
 #include <nn/audio.h>
 #include <nn/codec.h>
 #include <nn/mem.h>
 #include <nn/os.h>
 #include <nn/nn_Log.h>
+#include "SwitchVoiceChatFraming.h"
+#include "SwitchVoiceChatJitterBuffer.h"
+#include "SwitchVoiceChatMemory.h"
+#include "SwitchVoiceChatSimd.h"
+#include "SwitchVoiceChatStats.h"
 
 
 
 namespace SwitchVoiceChatDecodeNativeCode {
+	// One frame of a received buffer, as reported by wntgd_GetVoiceFrameInfo.
+	// offset/size locate the whole frame (header included) inside the buffer.
+	struct VoiceFrameInfo
+	{
+		int offset;
+		int size;
+		uint16_t sequence;
+		uint32_t timestamp; // 48 kHz samples
+		int durationMicroSeconds;
+		int flags;
+	};
+
+	struct SpeakerPlayoutStatus
+	{
+		int jitterMicroSeconds; // interarrival jitter estimate
+		int targetDelayMicroSeconds; // playout delay the jitter buffer aims for
+		int bufferedFrameCount;
+		uint32_t lostFrameCount; // frames that never arrived in time
+		uint32_t recoveredFrameCount; // lost frames rebuilt from the redundant copy in the next frame
+		uint32_t concealedFrameCount;
+		uint32_t lateFrameCount; // arrived after their playout time
+		uint32_t droppedFrameCount; // discarded to bring the delay back down, or too big
+	};
+
+	// Cumulative since wntgd_InitializeDecoder, over every speaker, see wntgd_GetDecodeStats.
+	struct DecodeStats
+	{
+		uint32_t receivedFrameCount; // frames pushed or decoded
+		uint64_t receivedByteCount; // framed bytes, headers included
+		uint32_t invalidBufferCount; // received buffers ending in a truncated frame
+		uint32_t rejectedFrameCount; // pushed frames the jitter buffer refused: late, duplicate or too big
+		uint32_t decodedFrameCount;
+		uint32_t decodeErrorCount;
+		uint32_t lostFrameCount;
+		uint32_t recoveredFrameCount;
+		uint32_t concealedFrameCount;
+		uint32_t skippedFrameCount; // batch frames the decode schedule left undecoded
+		SwitchVoiceChatStats::LatencyHistogramData decodeTime; // decoder time per packet
+	};
+
+	// One packet buffer for wntgd_DecompressSpeakerVoiceDataBatch. The caller fills the first five
+	// fields; outSampleCount and result are written like the outputs of wntgd_DecompressSpeakerVoiceDataInto.
+	// skipped is set when the decode schedule left the job undecoded (outSampleCount 0, result true).
+	struct SpeakerDecodeJob
+	{
+		uint64_t speakerId;
+		const char* inputBuffer;
+		int count;
+		float* audioOut;
+		int capacity;
+		int outSampleCount;
+		bool result;
+		bool skipped;
+	};
+
+	struct SpeakerDecoder;
+	SpeakerDecoder* FindSpeaker(uint64_t speakerId);
+	bool AllocateSpeakerPlayout(SpeakerDecoder* speaker);
+	SpeakerDecoder* CheckoutSpeaker(uint64_t speakerId, bool usePlayout = false);
+	void ResetSpeakerPlayout(SpeakerDecoder* speaker);
+	size_t GetPrimaryPacketSize(const SwitchVoiceChatFraming::VoiceFrame& frame);
+	nn::codec::OpusResult DecodePacket(nn::codec::OpusDecoder* decoder, int* outSampleCount, int16_t* dest, size_t destSize, const char* packet, size_t packetSize);
+	nn::codec::OpusResult DecodePayload(nn::codec::OpusDecoder* decoder, int* outSampleCount, int16_t* dest, size_t destSize, const char* payload, size_t payloadSize, bool isBundle);
+	void CountReceivedFrame(const SwitchVoiceChatFraming::VoiceFrame& frame);
+	bool DecodePackets(nn::codec::OpusDecoder* decoder, intptr_t* handle, char* inputBuffer, int count, float** audioOut, int* outSampleCount, unsigned int* sampleRateOut);
+	bool DecodePacketsInto(nn::codec::OpusDecoder* decoder, const char* inputBuffer, int count, float* dest, size_t capacity, size_t* written, int16_t* pcmBuffer);
+	// Memory the decoder takes from the arena (SwitchVoiceChatMemory.h) with speakerCount cached
+	// speakers, and the playback and decode worker counterparts, for the budget.
+	size_t GetDecoderMemorySize(int speakerCount);
+	size_t GetPlaybackMemorySize();
+	size_t GetDecodeWorkerMemorySize(int workerCount);
 	extern "C" bool wntgd_InitializeDecoder();
 	extern "C" void wntgd_FinalizeDecoder();
 	extern "C" bool wntgd_DecompressVoiceData(intptr_t * handle, char* inputBuffer, int count, float** audioOut, int* outSampleCount, unsigned int* sampleRateOut);
 	extern "C" bool wntgd_ReleaseDecompressBuffer(intptr_t * handler);
+	// Like wntgd_DecompressVoiceData, but keeps a separate decoder state per remote speaker.
+	extern "C" bool wntgd_DecompressSpeakerVoiceData(uint64_t speakerId, intptr_t * handle, char* inputBuffer, int count, float** audioOut, int* outSampleCount, unsigned int* sampleRateOut);
+	// Frees the decoder slot of a speaker who left; idle speakers are otherwise evicted least recently used first.
+	extern "C" void wntgd_ReleaseSpeakerDecoder(uint64_t speakerId);
+	// Lists up to maxFrameCount frames of an encoded buffer without decoding them, so the game can
+	// detect loss, reorder, or drop whole frames. Returns the number of frames written to frames.
+	extern "C" int wntgd_GetVoiceFrameInfo(const char* inputBuffer, int count, VoiceFrameInfo* frames, int maxFrameCount);
+	// Decode straight into a caller-owned float buffer of capacity samples (48 per millisecond of
+	// frame duration, see wntgd_GetVoiceFrameInfo); nothing to release. Returns false on a decode error,
+	// a truncated frame, or when capacity runs out before the last frame.
+	extern "C" bool wntgd_DecompressVoiceDataInto(char* inputBuffer, int count, float* audioOut, int capacity, int* outSampleCount, unsigned int* sampleRateOut);
+	extern "C" bool wntgd_DecompressSpeakerVoiceDataInto(uint64_t speakerId, char* inputBuffer, int count, float* audioOut, int capacity, int* outSampleCount, unsigned int* sampleRateOut);
+	void ResyncSpeakerDecoder(SpeakerDecoder* speaker, const SpeakerDecodeJob* job, int16_t* pcmBuffer);
+	void RunDecodeChain(int slotIndex, int16_t* pcmBuffer);
+	void RunDecodeQueues(int self, int16_t* pcmBuffer);
+	int ScheduleDecodeChains(int chainCount);
+	void SkipDecodeChain(int slotIndex);
+	bool DecodeBatchSlice(SpeakerDecodeJob* jobs, int jobCount);
+	// Batch decode for many speakers per tick: decodes every job like wntgd_DecompressSpeakerVoiceDataInto,
+	// spread over the calling thread and the decode workers, and returns once all outputs are written.
+	// The jobs of one speaker are decoded in array order on one thread; different speakers run in
+	// parallel. Returns false if any job failed, including jobs beyond the 64 speakers that fit in the
+	// decoder slots at once. Without workers the batch runs on the calling thread.
+	// With a decode schedule (wntgd_SetDecodeSchedule) only the speakers it picks are decoded.
+	extern "C" bool wntgd_DecompressSpeakerVoiceDataBatch(SpeakerDecodeJob* jobs, int jobCount, unsigned int* sampleRateOut);
+	// Decode schedule for wntgd_DecompressSpeakerVoiceDataBatch, so a crowd costs a bounded amount of
+	// CPU per tick. Speakers are ranked by their wntgd_SetSpeakerPriority hint and decoded in that
+	// order while the estimated decode time (CPU time summed over the calling thread and the workers)
+	// stays within budgetMicroSeconds and at most maxSpeakerCount speakers are decoded; 0 lifts
+	// either limit. The top audible speaker is always decoded. The jobs of the other speakers are
+	// skipped, and a skipped speaker's decoder is reset and warmed up from the redundant copy of its
+	// previous frame (VoiceRecordParameter::useRedundancy) when it is decoded again. Both 0 (the
+	// default) turns the schedule off: every job is decoded and priorities are ignored.
+	extern "C" void wntgd_SetDecodeSchedule(int budgetMicroSeconds, int maxSpeakerCount);
+	// Priority and audibility hint for the decode schedule, e.g. from distance, volume or a voice
+	// that is talking to the player; higher is decoded first. 0 or less means inaudible (muted, out
+	// of range): never decoded while the schedule is on. New speakers start at 1. Returns false for a
+	// speaker without a decoder yet (nothing received, or released or evicted since), so set it once
+	// the speaker's first voice data has been decoded or pushed.
+	extern "C" bool wntgd_SetSpeakerPriority(uint64_t speakerId, float priority);
+	// Starts workerCount (at most 3) decode worker threads, one per application core, replacing any
+	// running ones. Call after wntgd_InitializeDecoder; wntgd_FinalizeDecoder stops them.
+	extern "C" bool wntgd_StartDecodeWorkers(int workerCount);
+	extern "C" void wntgd_StopDecodeWorkers();
+	bool DecodePlayoutFrame(SpeakerDecoder* speaker, const char* packet, size_t packetSize, bool isBundle);
+	bool ConcealPlayoutFrame(SpeakerDecoder* speaker);
+	bool RefillPlayout(SpeakerDecoder* speaker);
+	bool PullPlayout(SpeakerDecoder* speaker, float* audioOut, int sampleCount);
+	// Jitter-buffered playout. Push every buffer received from a speaker as it arrives; frames are
+	// reordered by sequence number and played after an adaptive delay. Pull sampleCount samples at the
+	// playback pace: lost frames are recovered from redundancy (VoiceRecordParameter::useRedundancy)
+	// or concealed, and silence is written while buffering. Pull returns false if nothing audible was written.
+	// Shares the speaker's decoder with wntgd_DecompressSpeakerVoiceData, so use one or the other per speaker.
+	extern "C" bool wntgd_PushSpeakerVoiceData(uint64_t speakerId, const char* inputBuffer, int count);
+	extern "C" bool wntgd_PullSpeakerVoice(uint64_t speakerId, float* audioOut, int sampleCount, unsigned int* sampleRateOut);
+	extern "C" bool wntgd_GetSpeakerPlayoutStatus(uint64_t speakerId, SpeakerPlayoutStatus* status);
+	// Decode-side counterpart of wntgd_GetVoiceStats (SwitchVoiceChatNativeCode.h).
+	extern "C" void wntgd_GetDecodeStats(DecodeStats* stats);
+	// Mixer over the jitter-buffered speakers. gain is linear, pan goes from -1 (left) to 1 (right)
+	// with constant power. wntgd_MixSpeakers pulls frameCount samples from every pushed speaker
+	// (replacing wntgd_PullSpeakerVoice), sums them into interleaved stereo stereoOut
+	// (frameCount * 2 floats) and clips to [-1, 1]. Returns the number of audible speakers.
+	// New speakers start centered at unity gain; wntgd_SetSpeakerMix returns false for a speaker
+	// without a decoder yet, so set the mix once its first voice data has been pushed.
+	extern "C" bool wntgd_SetSpeakerMix(uint64_t speakerId, float gain, float pan);
+	extern "C" int wntgd_MixSpeakers(float* stereoOut, int frameCount, unsigned int* sampleRateOut);
+	bool PullPlayoutPcm(SpeakerDecoder* speaker, int16_t* pcmOut, int sampleCount);
+	// Playback mode: plays every pushed speaker through the audio renderer instead of returning PCM.
+	// Each speaker gets its own renderer voice (up to 16), panned with its wntgd_SetSpeakerMix gains,
+	// and is fed one renderer quantum (5 ms) at a time from a native thread, so the output latency on
+	// top of the jitter buffer delay is one to two quanta. While it runs, wntgd_PullSpeakerVoice and
+	// wntgd_MixSpeakers only write silence (returning false and 0), so they take no frames from it.
+	extern "C" bool wntgd_StartPlayback();
+	extern "C" void wntgd_StopPlayback();
 }
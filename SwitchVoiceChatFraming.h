@@ -0,0 +1,206 @@
+#pragma once
+#include <stdint.h>
+#include <cstddef>
+
+// Wire format of encoded voice: a sequence of frames, each a fixed header followed by one codec packet.
+//
+//   offset size
+//   0      2    payload size in bytes (little-endian)
+//   2      2    sequence number, +1 per frame, wraps
+//   4      4    timestamp of the first sample, in 48 kHz samples, wraps
+//   8      1    frame duration in 0.5 ms units (10 ms = 20)
+//   9      1    flags (VoiceFrameFlag_*)
+//   10     n    codec packet
+//
+// Frames are self-delimiting, so a receiver can drop, reorder or decode each one independently.
+//
+// A bundle frame (VoiceFrameFlag_Bundle) carries the packets of several consecutive codec frames
+// to save the per-frame overhead. Each codec packet header is cut down to its final range, the
+// size being in the bundle header:
+//
+//   1      packet count (1 to MaxVoiceBundlePacketCount)
+//   1-2    size of each packet: 1 byte below 252, else 2 bytes as in RFC 6716 section 3.2.1
+//   n      the packets, back to back, each the 4-byte final range of its codec packet header
+//          (VoiceBundlePacketRangeSize) followed by the codec data
+//
+// The frame duration is the sum of the packets' durations.
+namespace SwitchVoiceChatFraming {
+	const size_t VoiceFrameHeaderSize = 10;
+	const int VoiceFrameTimestampRate = 48000;
+	const int MaxVoiceBundlePacketCount = 6;
+	const size_t MaxVoiceBundlePacketSize = 1275; // what two size bytes can express
+	const size_t VoiceBundlePacketRangeSize = 4; // final range kept at the start of each bundled packet
+
+	enum VoiceFrameFlag
+	{
+		// The payload is the frame's codec packet followed by a copy of the previous frame's packet,
+		// so a receiver can recover a single lost frame from the next one.
+		VoiceFrameFlag_Redundant = 1 << 0,
+		// First frame after a pause (start of the stream, or DTX skipped silent frames before it).
+		// Sequence numbers continue across the pause while the timestamp jumps ahead.
+		VoiceFrameFlag_TalkSpurtStart = 1 << 1,
+		// The payload is a bundle of codec packets instead of a single one. With VoiceFrameFlag_Redundant
+		// the redundant copy is the previous frame's bundle.
+		VoiceFrameFlag_Bundle = 1 << 2
+	};
+
+	struct VoiceFrame
+	{
+		uint16_t payloadSize;
+		uint16_t sequence;
+		uint32_t timestamp;
+		uint8_t durationHalfMilis;
+		uint8_t flags;
+		const char* payload; // points into the parsed buffer, nothing is copied
+	};
+
+	inline int GetVoiceFrameDurationMicroSeconds(const VoiceFrame& frame)
+	{
+		return frame.durationHalfMilis * 500;
+	}
+
+	// Number of samples the frame decodes to at sampleRate.
+	inline int GetVoiceFrameSampleCount(const VoiceFrame& frame, int sampleRate)
+	{
+		return sampleRate / 2000 * frame.durationHalfMilis;
+	}
+
+	inline void WriteVoiceFrameHeader(char* dest, const VoiceFrame& frame)
+	{
+		uint8_t* p = reinterpret_cast<uint8_t*>(dest);
+		p[0] = static_cast<uint8_t>(frame.payloadSize);
+		p[1] = static_cast<uint8_t>(frame.payloadSize >> 8);
+		p[2] = static_cast<uint8_t>(frame.sequence);
+		p[3] = static_cast<uint8_t>(frame.sequence >> 8);
+		p[4] = static_cast<uint8_t>(frame.timestamp);
+		p[5] = static_cast<uint8_t>(frame.timestamp >> 8);
+		p[6] = static_cast<uint8_t>(frame.timestamp >> 16);
+		p[7] = static_cast<uint8_t>(frame.timestamp >> 24);
+		p[8] = frame.durationHalfMilis;
+		p[9] = frame.flags;
+	}
+
+	// Parses the frame at the start of buffer. Returns the total frame size (header + payload),
+	// or 0 if the buffer does not hold a complete frame.
+	inline size_t ReadVoiceFrame(VoiceFrame* frame, const char* buffer, size_t size)
+	{
+		if (size < VoiceFrameHeaderSize) return 0;
+		const uint8_t* p = reinterpret_cast<const uint8_t*>(buffer);
+		frame->payloadSize = static_cast<uint16_t>(p[0] | (p[1] << 8));
+		frame->sequence = static_cast<uint16_t>(p[2] | (p[3] << 8));
+		frame->timestamp = static_cast<uint32_t>(p[4]) | (static_cast<uint32_t>(p[5]) << 8) |
+			(static_cast<uint32_t>(p[6]) << 16) | (static_cast<uint32_t>(p[7]) << 24);
+		frame->durationHalfMilis = p[8];
+		frame->flags = p[9];
+		frame->payload = buffer + VoiceFrameHeaderSize;
+		if (size - VoiceFrameHeaderSize < frame->payloadSize) return 0;
+		return VoiceFrameHeaderSize + frame->payloadSize;
+	}
+
+	// Total frame size (header + payload) from just the header bytes.
+	inline size_t GetVoiceFrameSize(const char* header)
+	{
+		const uint8_t* p = reinterpret_cast<const uint8_t*>(header);
+		return VoiceFrameHeaderSize + static_cast<uint16_t>(p[0] | (p[1] << 8));
+	}
+
+	// Writes the size of a bundled packet (at most MaxVoiceBundlePacketSize), returns the bytes written.
+	inline size_t WriteVoiceBundlePacketSize(char* dest, size_t size)
+	{
+		uint8_t* p = reinterpret_cast<uint8_t*>(dest);
+		if (size < 252)
+		{
+			p[0] = static_cast<uint8_t>(size);
+			return 1;
+		}
+		p[0] = static_cast<uint8_t>(252 + (size & 3));
+		p[1] = static_cast<uint8_t>((size - p[0]) >> 2);
+		return 2;
+	}
+
+	// Iterates over the packets of a bundle payload. The payload may go on past the bundle (the
+	// redundant copy), GetSize tells where the bundle ends.
+	class VoiceBundleReader
+	{
+	public:
+		VoiceBundleReader(const char* payload, size_t size) : m_PacketCount(0), m_Index(0), m_Size(0)
+		{
+			const uint8_t* p = reinterpret_cast<const uint8_t*>(payload);
+			if (size < 1 || p[0] < 1 || p[0] > MaxVoiceBundlePacketCount) return;
+			size_t offset = 1;
+			size_t total = 0;
+			for (int i = 0; i < p[0]; i++)
+			{
+				if (offset >= size) return;
+				size_t packetSize = p[offset++];
+				if (packetSize >= 252)
+				{
+					if (offset >= size) return;
+					packetSize += static_cast<size_t>(p[offset++]) * 4;
+				}
+				m_PacketSizes[i] = packetSize;
+				total += packetSize;
+			}
+			if (total > size - offset) return;
+			m_pPacket = payload + offset;
+			m_PacketCount = p[0];
+			m_Size = offset + total;
+		}
+
+		bool IsValid() const { return m_PacketCount > 0; }
+		int GetPacketCount() const { return m_PacketCount; }
+		size_t GetSize() const { return m_Size; }
+
+		bool Next(const char** packet, size_t* size)
+		{
+			if (m_Index == m_PacketCount) return false;
+			*packet = m_pPacket;
+			*size = m_PacketSizes[m_Index];
+			m_pPacket += m_PacketSizes[m_Index++];
+			return true;
+		}
+
+	private:
+		size_t m_PacketSizes[MaxVoiceBundlePacketCount];
+		const char* m_pPacket;
+		int m_PacketCount;
+		int m_Index;
+		size_t m_Size;
+	};
+
+	// Sequence numbers compared modulo 2^16: true if a comes before b.
+	inline bool IsSequenceBefore(uint16_t a, uint16_t b)
+	{
+		return static_cast<int16_t>(a - b) < 0;
+	}
+
+	// Iterates over the frames of a received buffer without copying.
+	class VoiceFrameReader
+	{
+	public:
+		VoiceFrameReader(const char* buffer, size_t size) : m_pBuffer(buffer), m_Size(size), m_Offset(0), m_IsValid(true) {}
+
+		// Returns false at the end of the buffer or on a truncated frame (see IsValid).
+		bool Next(VoiceFrame* frame)
+		{
+			if (m_Offset == m_Size) return false;
+			size_t frameSize = ReadVoiceFrame(frame, m_pBuffer + m_Offset, m_Size - m_Offset);
+			if (frameSize == 0)
+			{
+				m_IsValid = false;
+				return false;
+			}
+			m_Offset += frameSize;
+			return true;
+		}
+
+		bool IsValid() const { return m_IsValid; }
+		size_t GetOffset() const { return m_Offset; }
+
+	private:
+		const char* m_pBuffer;
+		size_t m_Size;
+		size_t m_Offset;
+		bool m_IsValid;
+	};
+}
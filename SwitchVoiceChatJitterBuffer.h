@@ -0,0 +1,241 @@
+#pragma once
+#include <stdint.h>
+#include <cstring>
+#include "SwitchVoiceChatFraming.h"
+
+namespace SwitchVoiceChatDecodeNativeCode {
+	// Per-speaker reorder and playout buffer for framed voice (see SwitchVoiceChatFraming.h).
+	// Frames are stored by sequence number in a fixed array of slots, so late or reordered frames
+	// fall back into place. The playout delay follows the RFC 3550 interarrival jitter estimate:
+	// playback starts once targetDepth frames are queued, an underrun in the middle of a talk spurt
+	// raises the target for a while,
+	// and a frame is dropped whenever more than needed is queued. Storage is provided by the caller.
+	// Not thread-safe: push and pull for one speaker from the same thread.
+	class JitterBuffer
+	{
+	public:
+		static const int SlotCount = 16; // power of two
+		static const size_t SlotSize = 512; // largest frame payload kept, bigger frames are dropped
+
+		enum PopResult
+		{
+			PopResult_Frame, // next frame in playout order
+			PopResult_Missing, // next frame was lost or is too late, its sequence number is skipped
+			PopResult_Underrun, // nothing queued while playing, playback pauses to rebuffer
+			PopResult_Buffering // waiting for targetDepth frames before playing
+		};
+
+		static size_t GetStorageSize() { return SlotCount * SlotSize; }
+
+		void Initialize(char* storage)
+		{
+			m_pStorage = storage;
+			Reset();
+		}
+
+		void Reset()
+		{
+			for (int i = 0; i < SlotCount; i++) m_Slots[i].filled = false;
+			m_IsPlaying = false;
+			m_HasFrame = false;
+			m_NextSequence = 0;
+			m_NewestSequence = 0;
+			m_FrameSampleCount = SwitchVoiceChatFraming::VoiceFrameTimestampRate / 100;
+			m_HasTransit = false;
+			m_LastTransit = 0;
+			m_ScaledJitter = 0;
+			m_TargetBoost = 0;
+			m_IsBoostPending = false;
+			m_PoppedSinceUnderrun = 0;
+			m_LateCount = 0;
+			m_DroppedCount = 0;
+		}
+
+		// Queues a copy of frame. arrivalTime is in 48 kHz samples on any monotonic clock.
+		// Returns false if the frame was dropped (late, duplicate or too big).
+		bool Insert(const SwitchVoiceChatFraming::VoiceFrame& frame, int64_t arrivalTime)
+		{
+			// first frame after the speaker went quiet: start a new talk spurt at this frame, and do not
+			// count the silence as jitter
+			if (m_HasFrame && !m_IsPlaying && GetDepth() == 0 && SwitchVoiceChatFraming::IsSequenceBefore(m_NewestSequence, frame.sequence))
+			{
+				m_HasFrame = false;
+				m_HasTransit = false;
+			}
+			// an underrun only means the delay is too short if the stream was still going on
+			if (frame.flags & SwitchVoiceChatFraming::VoiceFrameFlag_TalkSpurtStart)
+			{
+				m_HasTransit = false;
+			}
+			else if (m_IsBoostPending && m_TargetBoost < SlotCount / 2)
+			{
+				m_TargetBoost++;
+			}
+			m_IsBoostPending = false;
+
+			UpdateJitter(frame.timestamp, arrivalTime);
+			if (frame.durationHalfMilis > 0) m_FrameSampleCount = frame.durationHalfMilis * (SwitchVoiceChatFraming::VoiceFrameTimestampRate / 2000);
+
+			if (frame.payloadSize > SlotSize)
+			{
+				m_DroppedCount++;
+				return false;
+			}
+
+			if (!m_HasFrame)
+			{
+				m_NextSequence = frame.sequence;
+				m_NewestSequence = frame.sequence;
+				m_HasFrame = true;
+			}
+			else if (SwitchVoiceChatFraming::IsSequenceBefore(frame.sequence, m_NextSequence))
+			{
+				// already played or skipped; while still buffering, an earlier frame moves the start back
+				if (m_IsPlaying || static_cast<uint16_t>(m_NewestSequence - frame.sequence) >= SlotCount)
+				{
+					m_LateCount++;
+					return false;
+				}
+				m_NextSequence = frame.sequence;
+			}
+
+			// far ahead of playout: drop the oldest frames to make room
+			if (static_cast<uint16_t>(frame.sequence - m_NextSequence) >= SlotCount)
+			{
+				uint16_t newNext = static_cast<uint16_t>(frame.sequence - SlotCount + 1);
+				while (m_NextSequence != newNext)
+				{
+					Slot& skipped = m_Slots[m_NextSequence & (SlotCount - 1)];
+					if (skipped.filled)
+					{
+						skipped.filled = false;
+						m_DroppedCount++;
+					}
+					m_NextSequence++;
+				}
+			}
+
+			Slot& slot = m_Slots[frame.sequence & (SlotCount - 1)];
+			if (slot.filled && slot.frame.sequence == frame.sequence) return false;
+
+			char* data = m_pStorage + (frame.sequence & (SlotCount - 1)) * SlotSize;
+			std::memcpy(data, frame.payload, frame.payloadSize);
+			slot.frame = frame;
+			slot.frame.payload = data;
+			slot.filled = true;
+			if (SwitchVoiceChatFraming::IsSequenceBefore(m_NewestSequence, frame.sequence)) m_NewestSequence = frame.sequence;
+			return true;
+		}
+
+		// Takes the next frame in playout order. The returned payload stays valid until the next Insert.
+		PopResult Pop(SwitchVoiceChatFraming::VoiceFrame* frame)
+		{
+			int depth = GetDepth();
+			if (!m_IsPlaying)
+			{
+				if (depth == 0 || depth < GetTargetDepth()) return PopResult_Buffering;
+				m_IsPlaying = true;
+			}
+
+			if (depth == 0)
+			{
+				m_IsPlaying = false;
+				m_IsBoostPending = true;
+				m_PoppedSinceUnderrun = 0;
+				return PopResult_Underrun;
+			}
+
+			// more queued than needed: skip a frame to bring the delay back down
+			if (depth > GetTargetDepth() + 2)
+			{
+				Slot& skipped = m_Slots[m_NextSequence & (SlotCount - 1)];
+				if (skipped.filled) m_DroppedCount++;
+				skipped.filled = false;
+				m_NextSequence++;
+			}
+
+			// the target boost from the last underrun wears off after a while of smooth playback
+			if (m_TargetBoost > 0 && ++m_PoppedSinceUnderrun >= 256)
+			{
+				m_TargetBoost--;
+				m_PoppedSinceUnderrun = 0;
+			}
+
+			Slot& slot = m_Slots[m_NextSequence & (SlotCount - 1)];
+			m_NextSequence++;
+			if (!slot.filled) return PopResult_Missing;
+
+			slot.filled = false;
+			*frame = slot.frame;
+			return PopResult_Frame;
+		}
+
+		// The frame that the next Pop would return, if it already arrived (e.g. to recover a missing
+		// frame from its redundant copy).
+		bool PeekNext(SwitchVoiceChatFraming::VoiceFrame* frame) const
+		{
+			const Slot& slot = m_Slots[m_NextSequence & (SlotCount - 1)];
+			if (!slot.filled) return false;
+			*frame = slot.frame;
+			return true;
+		}
+
+		// Frames from the playout position up to the newest frame received, lost ones included.
+		int GetDepth() const
+		{
+			if (!m_HasFrame || SwitchVoiceChatFraming::IsSequenceBefore(m_NewestSequence, m_NextSequence)) return 0;
+			return static_cast<uint16_t>(m_NewestSequence - m_NextSequence) + 1;
+		}
+
+		// Playout delay in frames: one frame plus three times the jitter, plus the underrun boost.
+		int GetTargetDepth() const
+		{
+			int jitterFrameCount = static_cast<int>((3 * GetJitter() + m_FrameSampleCount - 1) / m_FrameSampleCount);
+			int target = 1 + jitterFrameCount + m_TargetBoost;
+			return target < SlotCount - 2 ? target : SlotCount - 2;
+		}
+
+		// Interarrival jitter in 48 kHz samples.
+		uint32_t GetJitter() const { return m_ScaledJitter >> 4; }
+		int GetFrameSampleCount() const { return m_FrameSampleCount; }
+		uint32_t GetLateCount() const { return m_LateCount; }
+		uint32_t GetDroppedCount() const { return m_DroppedCount; }
+
+	private:
+		struct Slot
+		{
+			bool filled;
+			SwitchVoiceChatFraming::VoiceFrame frame;
+		};
+
+		// RFC 3550 section 6.4.1: J += (|D| - J) / 16, kept scaled by 16.
+		void UpdateJitter(uint32_t timestamp, int64_t arrivalTime)
+		{
+			int32_t transit = static_cast<int32_t>(static_cast<uint32_t>(arrivalTime) - timestamp);
+			if (m_HasTransit)
+			{
+				int32_t d = transit - m_LastTransit;
+				if (d < 0) d = -d;
+				m_ScaledJitter += d - ((m_ScaledJitter + 8) >> 4);
+			}
+			m_LastTransit = transit;
+			m_HasTransit = true;
+		}
+
+		char* m_pStorage;
+		Slot m_Slots[SlotCount];
+		bool m_IsPlaying;
+		bool m_HasFrame;
+		uint16_t m_NextSequence;
+		uint16_t m_NewestSequence;
+		int m_FrameSampleCount;
+		bool m_HasTransit;
+		int32_t m_LastTransit;
+		uint32_t m_ScaledJitter;
+		int m_TargetBoost;
+		bool m_IsBoostPending;
+		int m_PoppedSinceUnderrun;
+		uint32_t m_LateCount;
+		uint32_t m_DroppedCount;
+	};
+}
@@ -0,0 +1,112 @@
+#include "SwitchVoiceChatMemory.h"
+#include "SwitchVoiceChatNativeCode.h"
+#include "SwitchVoiceChatDecodeNativeCode.h"
+
+namespace SwitchVoiceChatMemory {
+	const size_t ALLOCATION_OVERHEAD = 32; // allocator header, plus a remainder too small to split off
+	const int DEFAULT_BUDGET_SPEAKER_COUNT = 16;
+	const int DEFAULT_BUDGET_DECODE_WORKER_COUNT = 3; // every worker wntgd_StartDecodeWorkers starts
+
+	nn::os::Mutex arenaMutex(false);
+	nn::mem::StandardAllocator arenaAllocator;
+	char* arenaBuffer;
+	size_t arenaSize;
+	int arenaUserCount = 0;
+	uint64_t requestedBudgetSize = 0;
+	size_t usedSize;
+	size_t peakUsedSize;
+	size_t categorySizes[MemoryCategory_Count];
+
+	size_t GetAllocationSize(size_t size, size_t alignment)
+	{
+		return nn::util::align_up(size, DefaultAlignment) + (alignment > DefaultAlignment ? alignment : 0) + ALLOCATION_OVERHEAD;
+	}
+
+	bool AcquireArena()
+	{
+		std::lock_guard<nn::os::Mutex> lock(arenaMutex);
+		if (arenaUserCount > 0)
+		{
+			arenaUserCount++;
+			return true;
+		}
+
+		arenaSize = static_cast<size_t>(requestedBudgetSize != 0 ? requestedBudgetSize : wntgd_GetDefaultMemoryBudget(DEFAULT_BUDGET_SPEAKER_COUNT));
+		arenaBuffer = new char[arenaSize]();
+		arenaAllocator.Initialize(arenaBuffer, arenaSize);
+		usedSize = 0;
+		peakUsedSize = 0;
+		for (int i = 0; i < MemoryCategory_Count; i++) categorySizes[i] = 0;
+		arenaUserCount = 1;
+		return true;
+	}
+
+	void ReleaseArena()
+	{
+		std::lock_guard<nn::os::Mutex> lock(arenaMutex);
+		if (arenaUserCount == 0 || --arenaUserCount > 0) return;
+		arenaAllocator.Finalize();
+		delete[] arenaBuffer;
+		arenaBuffer = nullptr;
+	}
+
+	// The free size before and after gives the exact bytes a block takes, padding included.
+	void* Allocate(MemoryCategory category, size_t size, size_t alignment)
+	{
+		std::lock_guard<nn::os::Mutex> lock(arenaMutex);
+		if (arenaUserCount == 0) return nullptr;
+		size_t freeSize = arenaAllocator.GetTotalFreeSize();
+		void* address = arenaAllocator.Allocate(size, alignment);
+		if (!address) return nullptr;
+
+		size_t blockSize = freeSize - arenaAllocator.GetTotalFreeSize();
+		usedSize += blockSize;
+		categorySizes[category] += blockSize;
+		if (usedSize > peakUsedSize) peakUsedSize = usedSize;
+		return address;
+	}
+
+	void Free(MemoryCategory category, void* address)
+	{
+		if (!address) return;
+		std::lock_guard<nn::os::Mutex> lock(arenaMutex);
+		if (arenaUserCount == 0) return;
+		size_t freeSize = arenaAllocator.GetTotalFreeSize();
+		arenaAllocator.Free(address);
+
+		size_t blockSize = arenaAllocator.GetTotalFreeSize() - freeSize;
+		usedSize -= blockSize;
+		categorySizes[category] -= blockSize;
+	}
+
+	extern "C" bool wntgd_SetMemoryBudget(uint64_t budgetSize)
+	{
+		std::lock_guard<nn::os::Mutex> lock(arenaMutex);
+		if (arenaUserCount > 0) return false;
+		requestedBudgetSize = budgetSize;
+		return true;
+	}
+
+	extern "C" uint64_t wntgd_GetDefaultMemoryBudget(int speakerCount)
+	{
+		SwitchVoiceChatNativeCode::VoiceRecordParameter parameter;
+		SwitchVoiceChatNativeCode::wntgd_InitializeVoiceRecordParameter(&parameter);
+		parameter.useWorkerThread = true;
+		parameter.useRedundancy = true;
+
+		size_t size = SwitchVoiceChatNativeCode::wntgd_GetVoiceRecorderMemorySize(&parameter)
+			+ SwitchVoiceChatDecodeNativeCode::GetDecoderMemorySize(speakerCount)
+			+ SwitchVoiceChatDecodeNativeCode::GetPlaybackMemorySize()
+			+ SwitchVoiceChatDecodeNativeCode::GetDecodeWorkerMemorySize(DEFAULT_BUDGET_DECODE_WORKER_COUNT);
+		return size;
+	}
+
+	extern "C" void wntgd_GetMemoryFootprint(MemoryFootprint* footprint)
+	{
+		std::lock_guard<nn::os::Mutex> lock(arenaMutex);
+		footprint->budgetSize = arenaUserCount > 0 ? arenaSize : 0;
+		footprint->usedSize = usedSize;
+		footprint->peakUsedSize = peakUsedSize;
+		for (int i = 0; i < MemoryCategory_Count; i++) footprint->categorySizes[i] = categorySizes[i];
+	}
+}
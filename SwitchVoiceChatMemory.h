@@ -0,0 +1,49 @@
+#pragma once
+#include <stdint.h>
+#include <cstddef>
+#include <new>
+#include <nn/mem.h>
+#include <nn/os.h>
+
+// One arena for all native voice chat memory. The encoder, the speaker decoders, the rings, the
+// packet buffers, playback and the worker stacks are carved from a single block the size of the
+// memory budget, allocated when the encoder or the decoder starts and freed once both have stopped.
+// The default budget is added up from the actual frame, ring and codec state sizes.
+namespace SwitchVoiceChatMemory {
+	enum MemoryCategory
+	{
+		MemoryCategory_Encoder, // capture buffers, ring, encoder state, packet buffers, encode worker
+		MemoryCategory_Decoder, // speaker decoders and playout, decode scratch, decode workers
+		MemoryCategory_Playback, // audio renderer and playback thread, see wntgd_StartPlayback
+		MemoryCategory_Count
+	};
+
+	struct MemoryFootprint
+	{
+		uint64_t budgetSize; // size of the arena, 0 while neither the encoder nor the decoder runs
+		uint64_t usedSize; // taken from the arena, allocator headers and alignment padding included
+		uint64_t peakUsedSize; // since the arena was allocated
+		uint64_t categorySizes[MemoryCategory_Count]; // usedSize by MemoryCategory
+	};
+
+	const size_t DefaultAlignment = 16;
+
+	// Upper bound of the arena bytes one Allocate of size bytes takes, for the budget.
+	size_t GetAllocationSize(size_t size, size_t alignment = DefaultAlignment);
+	// The encoder and the decoder each hold the arena while they run.
+	bool AcquireArena();
+	void ReleaseArena();
+	// Thread-safe. Returns nullptr when the budget is exhausted.
+	void* Allocate(MemoryCategory category, size_t size, size_t alignment = DefaultAlignment);
+	void Free(MemoryCategory category, void* address);
+
+	// Arena size for the next time it is allocated; 0 (default) uses wntgd_GetDefaultMemoryBudget(16).
+	// Fails while the encoder or the decoder runs. With a smaller budget fewer speaker decoders stay
+	// cached (the least recently used one is reset for a new speaker), and features started last
+	// (playback, decode workers, the encode worker) fail to start when nothing is left.
+	extern "C" bool wntgd_SetMemoryBudget(uint64_t budgetSize);
+	// Budget that fits the encoder with default parameters (48 kHz stereo capture, worker thread and
+	// redundancy included), playback, every decode worker, and speakerCount cached speakers with playout.
+	extern "C" uint64_t wntgd_GetDefaultMemoryBudget(int speakerCount);
+	extern "C" void wntgd_GetMemoryFootprint(MemoryFootprint* footprint);
+}
@@ -3,263 +3,1587 @@
 namespace SwitchVoiceChatNativeCode {
 	using namespace nn::audio;
 	using namespace nn::codec;
-	const int BUFFER_LENGTH_MILIS = 50;
+	using namespace SwitchVoiceChatFraming;
+	using namespace SwitchVoiceChatMemory;
+	using namespace SwitchVoiceChatPreprocessor;
+	using namespace SwitchVoiceChatResampler;
+	using namespace SwitchVoiceChatRingBuffer;
+	using namespace SwitchVoiceChatStats;
+	const int BUFFER_LENGTH_MILIS = 20; // default AudioInBuffer duration
+	const int BUFFER_COUNT = 4; // default number of AudioInBuffers rotating through the driver
+	const int MAX_BUFFER_COUNT = 16;
 	const int ENCODER_BIT_RATE = 24000;
-	const int MIN_TOTAL_BUFFER_SIZE = 32 * 16384;
-	const int ENCODER_FRAME_DURATION = 10000; // only 5000, 10000, and 20000 are valids values
+	const int MIN_ENCODER_BIT_RATE = 6000; // lowest VoiceRecordParameter::minBitRate
+	const int MAX_ENCODER_BIT_RATE = 64000; // highest maxBitRate, so a redundant 20 ms frame fits a jitter buffer slot
+	const int ENCODER_FRAME_DURATION = 10000; // default; only 5000, 10000, and 20000 are valids values
+	const int MAX_ENCODER_FRAME_DURATION = 20000;
 	const int MAX_OPUS_ENCODER_OUTPUT_SIZE = OpusPacketSizeMaximum;
+	const int MAX_FRAME_SIZE = VoiceFrameHeaderSize + 2 * MAX_OPUS_ENCODER_OUTPUT_SIZE; // with a redundant packet
+	const int WORKER_THREAD_STACK_SIZE = 128 * 1024;
+	const int WORKER_THREAD_PRIORITY = nn::os::DefaultThreadPriority - 1;
+	const int WORKER_WAIT_TIMEOUT_MILIS = 10;
+	const int ENCODED_PACKET_QUEUE_SIZE = 32 * 1024;
+	const int PACKET_BUFFER_COUNT = 8; // outstanding wntgd_GetVoiceBuffer handles
+	const int PACKET_BUFFER_SIZE = 8 * 1024;
+	const float VOICE_ACTIVITY_THRESHOLD_DB = 9.0f;
+	const float VOICE_ACTIVITY_MINIMUM_LEVEL_DB = -55.0f;
+	const int VOICE_ACTIVITY_HANGOVER_MILIS = 300;
+	const float VOICED_ZERO_CROSSING_RATE = 0.25f; // voiced speech crosses zero less often than hiss
+	const float NOISE_FLOOR_RISE = 0.005f; // per frame, so the floor follows a louder background within seconds
+	const int ENCODER_SAMPLE_RATE = 48000; // when the capture rate is not one the encoder accepts
+	const int MAX_AUDIO_IN_COUNT = 8; // devices listed by wntgd_GetAudioInName
+	const int MAX_SHARED_WORKER_RECORDER_COUNT = 8;
+	const int SHARED_WORKER_POLL_MILIS = 2; // added capture latency, at most
+	const int DEFAULT_CAPTURE_SAMPLE_RATE = 48000; // for wntgd_GetVoiceRecorderMemorySize
+	const int MAX_PRE_ROLL_MILIS = 500;
+	const size_t MAX_BUNDLE_SIZE = 256; // a bundle and its redundant copy fit a receiver's jitter buffer slot
+	const int MAX_BUNDLE_DURATION = 60000; // the longest frame the receiver's playout takes
+	const int DEFAULT_CAPTURE_CHANNEL_COUNT = 2;
+	const float MAX_INPUT_GAIN_DB = 30.0f;
+	const int DC_TIME_CONSTANT_MICROSECONDS = 1000000; // the DC estimate follows the block means this slowly
+	const float PEAK_FALL_DB_PER_SECOND = 20.0f; // input level meter ballistics
+	const float NOISE_SUPPRESSION_DB = 15.0f;
+	const float MAX_NOISE_SUPPRESSION_DB = 40.0f;
+	const float AGC_TARGET_LEVEL_DB = -20.0f;
+	const float MIN_AGC_TARGET_LEVEL_DB = -40.0f;
+	const int PREPROCESS_BUDGET_MICROSECONDS = 1000; // per 10 ms block, a tenth of a core
+	const int PREPROCESS_BYPASS_BLOCK_COUNT = 50; // half a second without suppression once over the budget
+	const float PREPROCESS_COST_SMOOTHING = 0.125f; // weight of the newest block in the cost estimate
 
-	AudioIn audioIn;
-	AudioInBuffer audioInBuffer;
-	nn::mem::StandardAllocator allocator;
-	char* totalBuffer;
-	void* audioBuffer;
+	// fixed-size output buffers handed out by wntgd_GetRecorderVoiceBuffer; the handle is the PacketBuffer address
+	struct PacketBuffer
+	{
+		std::atomic<bool> inUse;
+		char* data;
+	};
+
+	// One capture and encode stream: its own AudioIn device, capture ring and encoder. Recorders share
+	// nothing but the arena and, with useSharedWorker, the shared worker thread, so several capture
+	// at once without contending.
+	struct VoiceRecorder
+	{
+		AudioIn audioIn;
+		nn::os::SystemEvent audioInEvent;
+		AudioInBuffer audioInBuffers[MAX_BUFFER_COUNT];
+		void* audioBuffers[MAX_BUFFER_COUNT];
+		int audioInBufferCount = BUFFER_COUNT;
+		int audioInBufferLengthMilis = BUFFER_LENGTH_MILIS;
+
+		// capture status, see wntgd_GetRecorderCaptureStatus
+		std::atomic<uint32_t> audioInStarvedCount{0};
+		std::atomic<uint64_t> capturedSampleCount{0};
+
+		// pipeline statistics, see wntgd_GetRecorderStats
+		std::atomic<uint64_t> captureOverrunSampleCount{0};
+		std::atomic<uint32_t> encodedFrameCount{0};
+		std::atomic<uint32_t> encodeErrorCount{0};
+		std::atomic<uint32_t> droppedFrameCount{0};
+		std::atomic<uint64_t> sentByteCount{0};
+		LatencyHistogram captureToEncodeHistogram;
+		LatencyHistogram encodeTimeHistogram;
+		nn::os::Tick lastCaptureTick; // when the newest sample of remainToEncodeRing was handed over by the driver
+
+		// captured mono samples at encodeSampleRate waiting to be encoded (capture side produces, Encode consumes)
+		int16_t* remainToEncodeBuffer;
+		SpscRingBuffer<int16_t> remainToEncodeRing;
+		int16_t* tempInputEncoderBuffer;
+
+		size_t opusWorkBufferSize;
+		char* opusWorkBuffer;
+		OpusEncoder* encoder;
+		bool isEncoderInitialized; // encoder->Initialize succeeded, so it needs a Finalize
+		int encodeFrameDuration;
+		int encodeSampleCount; // samples per frame at encodeFrameDuration
+		OpusCodingMode codingMode;
+
+		// framing state of the outgoing stream, see SwitchVoiceChatFraming.h
+		uint16_t frameSequence;
+		uint32_t frameTimestamp;
+
+		// voice activity detection and DTX
+		bool useVoiceActivityDetection = false;
+		bool useDtx = false;
+		float voiceActivityThresholdDb = VOICE_ACTIVITY_THRESHOLD_DB;
+		float voiceActivityMinimumLevelDb = VOICE_ACTIVITY_MINIMUM_LEVEL_DB;
+		int voiceActivityHangoverMilis = VOICE_ACTIVITY_HANGOVER_MILIS;
+		float noiseFloorDb;
+		int hangoverRemainingMicroSeconds;
+		bool talkSpurtStart;
+		std::atomic<bool> isSpeaking{true};
+		std::atomic<uint32_t> dtxSkippedFrameCount{0};
+
+		// bitrate: chosen by bitRateController on the feedback caller's thread, applied by the encoding thread
+		int initialBitRate = ENCODER_BIT_RATE;
+		bool useAdaptiveBitRate = false;
+		BitRateController bitRateController;
+		nn::os::Mutex bitRateControllerMutex{false};
+		std::atomic<int> targetBitRate{ENCODER_BIT_RATE};
+		std::atomic<int> currentBitRate{ENCODER_BIT_RATE};
+
+		// frame duration and coding mode: set from any thread, applied by the encoding thread between frames.
+		// Packed in one atomic (PackEncoderSetting), so the pair is checked and changed as a whole.
+		int initialFrameDuration = ENCODER_FRAME_DURATION;
+		OpusCodingMode initialCodingMode = OpusCodingMode_Auto;
+		std::atomic<uint64_t> targetEncoderSetting{PackEncoderSetting(ENCODER_FRAME_DURATION, OpusCodingMode_Auto)};
+
+		// immediate flush: the worker hands each frame to frameCallback instead of queueing it
+		bool useImmediateFlush = false;
+		VoiceFrameCallback frameCallback;
+		void* frameCallbackUserData;
+
+		// redundancy: the last packet (or bundle) is kept and appended to the next frame
+		bool useRedundancy = false;
+		char* previousPacket;
+		size_t previousPacketSize;
+		bool previousPacketIsBundle;
+
+		// packet bundling (VoiceRecordParameter::framesPerPacket): the packets of the frame being put
+		// together wait in bundleBuffer, their OpusPacketHeader cut down to the final range
+		int framesPerPacket = 1;
+		std::atomic<int> targetFramesPerPacket{1};
+		char* bundleBuffer; // MAX_BUNDLE_SIZE, then MAX_OPUS_ENCODER_OUTPUT_SIZE to encode the next packet into
+		int bundleCount;
+		size_t bundlePacketSizes[MaxVoiceBundlePacketCount];
+		size_t bundleSize; // packet bytes
+		size_t bundleSizeFieldSize; // bytes the packet sizes take in the bundle header
+		uint32_t bundleTimestamp;
+		int bundleDuration;
+		uint8_t bundleFlags;
+
+		int channelCount = 0;
+		int sampleRate = 48000; // capture rate, whatever the AudioIn device reports
+		int requestedEncodeSampleRate = 0; // VoiceRecordParameter::encodeSampleRate
+		int encodeSampleRate = ENCODER_SAMPLE_RATE;
+
+		// capture rate to encodeSampleRate, only used when they differ; the filter state carries over
+		// from one AudioIn buffer to the next
+		bool useCaptureResampler = false;
+		PolyphaseResampler captureResampler;
+		float* captureResamplerStorage;
+		int16_t* resampledInputBuffer; // one AudioIn buffer worth of resampled mono samples
+
+		// capture front-end (SwitchVoiceChatSimd::ProcessCapture), run on every released AudioIn buffer
+		bool useDownmix = false;
+		bool useDcRemoval = true;
+		float dcOffset;
+		std::atomic<float> inputGain{1.0f}; // linear, set from any thread
+		std::atomic<uint64_t> inputLevels{0}; // VoiceInputLevels, stored whole so readers never see half an update
+		float inputPeak;
+
+		// preprocessing (wntgd_SetRecorderPreprocessing): switched from any thread, run by the encoding
+		// thread on each frame before the VAD and the encoder
+		std::atomic<bool> useNoiseSuppression{false};
+		std::atomic<bool> useAutomaticGainControl{false};
+		float noiseSuppressionDb = NOISE_SUPPRESSION_DB;
+		float automaticGainControlTargetDb = AGC_TARGET_LEVEL_DB;
+		VoicePreprocessor preprocessor;
+		void* preprocessorStorage;
+		bool preprocessing; // the last frame went through the preprocessor, which holds its last block
+		int preprocessBudgetMicroSeconds = PREPROCESS_BUDGET_MICROSECONDS;
+		float preprocessCostMicroSeconds; // per block, smoothed; 0 until measured
+		int preprocessBypassRemaining; // blocks left to send without suppression
+		std::atomic<uint32_t> preprocessBypassedBlockCount{0};
+		LatencyHistogram preprocessTimeHistogram;
+
+		// worker mode: capture and encode run on workerThread, and the encoded packets wait in
+		// encodedPacketQueue until wntgd_GetVoiceBuffer takes them
+		bool useWorkerThread = false;
+		bool useSharedWorker = false; // the shared worker runs it instead of workerThread
+		std::atomic<bool> workerRunning{false};
+		nn::os::ThreadType workerThread;
+		void* workerThreadStack;
+		char* workerPacketBuffer;
+		char* encodedPacketQueueBuffer;
+		SpscRingBuffer<char> encodedPacketQueue; // whole frames, header included
+
+		PacketBuffer packetBuffers[PACKET_BUFFER_COUNT];
+		char* packetBufferStorage;
+
+		// push-to-talk (wntgd_PauseRecorder): requested from any thread, applied by the encoding thread
+		int preRollMilis = 0;
+		size_t preRollSampleCount; // at encodeSampleRate, kept in remainToEncodeRing while paused
+		std::atomic<bool> targetPaused{false};
+		bool paused = false;
+		uint64_t pausedSampleCount; // captured and dropped while paused, for the timestamps
+	};
+	// behind the wntgd_*RecordVoice / wntgd_GetVoice* entry points
+	VoiceRecorder defaultRecorder;
+
+	// Shared worker (VoiceRecordParameter::useSharedWorker): one thread polls the AudioIn event of
+	// every registered recorder and captures and encodes for the ones with buffers released.
+	nn::os::Mutex sharedWorkerControlMutex(false); // adding and removing recorders, thread start and stop included
+	nn::os::Mutex sharedWorkerMutex(false); // the list, against the thread
+	VoiceRecorder* sharedWorkerRecorders[MAX_SHARED_WORKER_RECORDER_COUNT];
+	int sharedWorkerRecorderCount;
+	std::atomic<bool> sharedWorkerRunning(false);
+	nn::os::ThreadType sharedWorkerThread;
+	void* sharedWorkerThreadStack;
+
+	bool AllocatePacketBuffers(VoiceRecorder* recorder)
+	{
+		recorder->packetBufferStorage = reinterpret_cast<char*>(Allocate(MemoryCategory_Encoder, PACKET_BUFFER_COUNT * PACKET_BUFFER_SIZE));
+		if (!recorder->packetBufferStorage) return false;
+		for (int i = 0; i < PACKET_BUFFER_COUNT; i++)
+		{
+			recorder->packetBuffers[i].data = recorder->packetBufferStorage + i * PACKET_BUFFER_SIZE;
+			recorder->packetBuffers[i].inUse.store(false, std::memory_order_relaxed);
+		}
+		return true;
+	}
 
-	// remainToEncodeBuffer is a circular array
-	int16_t* remainToEncodeBuffer;
-	size_t remainToEncodeBufferSize;
-	size_t remainToEncodeBufferStart;
-	size_t remainToEncodeBufferEnd;
-	int16_t* tempInputEncoderBuffer;
+	void FreePacketBuffers(VoiceRecorder* recorder)
+	{
+		Free(MemoryCategory_Encoder, recorder->packetBufferStorage);
+		recorder->packetBufferStorage = nullptr;
+	}
+
+	PacketBuffer* AcquirePacketBuffer(VoiceRecorder* recorder)
+	{
+		for (int i = 0; i < PACKET_BUFFER_COUNT; i++)
+		{
+			bool expected = false;
+			if (recorder->packetBuffers[i].inUse.compare_exchange_strong(expected, true, std::memory_order_acquire)) return &recorder->packetBuffers[i];
+		}
+		return nullptr;
+	}
+
+	void ReleasePacketBuffer(PacketBuffer* packetBuffer)
+	{
+		packetBuffer->inUse.store(false, std::memory_order_release);
+	}
 
-	size_t opusWorkBufferSize;
-	char* opusWorkBuffer;
-	OpusEncoder* encoder;
-	int encodeSampleCountMaximum;
+	// The encoder rate for a capture rate, see VoiceRecordParameter::encodeSampleRate.
+	int SelectEncodeSampleRate(int requestedRate, int captureRate)
+	{
+		if (requestedRate != 0) return requestedRate;
+		return IsValidEncodeSampleRate(captureRate) ? captureRate : ENCODER_SAMPLE_RATE;
+	}
+
+	// Room for every AudioIn buffer released at once (bufferSampleCount mono samples each, at the
+	// encoder rate) on top of a partial frame left from the last call, or the pre-roll while paused.
+	size_t GetRemainToEncodeCapacity(size_t bufferSampleCount, int bufferCount, int rate, int preRollMilis)
+	{
+		int heldMicroSeconds = preRollMilis * 1000 > MAX_ENCODER_FRAME_DURATION ? preRollMilis * 1000 : MAX_ENCODER_FRAME_DURATION;
+		return SpscRingBuffer<int16_t>::RoundUpCapacity(bufferSampleCount * bufferCount + static_cast<size_t>(rate) * heldMicroSeconds / 1000000);
+	}
+
+	size_t GetAudioInBufferSize(size_t dataSize)
+	{
+		return nn::util::align_up(dataSize, AudioOutBuffer::SizeGranularity);
+	}
+
+	// Arena bytes AllocateBuffers, InitializeEncoder, AllocatePacketBuffers and StartEncodeWorker take
+	// for parameter and a 16-bit capture device of the given format.
+	size_t GetEncoderMemorySize(const VoiceRecordParameter* parameter, int captureSampleRate, int captureChannelCount)
+	{
+		int rate = SelectEncodeSampleRate(parameter->encodeSampleRate, captureSampleRate);
+		int frameSampleCount = captureSampleRate * parameter->audioInBufferLengthMilis / 1000;
+		size_t dataSize = frameSampleCount * captureChannelCount * sizeof(int16_t);
+		size_t size = parameter->audioInBufferCount * GetAllocationSize(GetAudioInBufferSize(dataSize), AudioInBuffer::AddressAlignment);
+
+		size_t bufferSampleCount = frameSampleCount;
+		if (rate != captureSampleRate)
+		{
+			bufferSampleCount = PolyphaseResampler::GetMaxOutputCount(captureSampleRate, rate, frameSampleCount);
+			size += GetAllocationSize(PolyphaseResampler::GetStorageSize(captureSampleRate, rate) * sizeof(float));
+			size += GetAllocationSize(bufferSampleCount * sizeof(int16_t));
+		}
+		size += GetAllocationSize(GetRemainToEncodeCapacity(bufferSampleCount, parameter->audioInBufferCount, rate, parameter->preRollMilis) * sizeof(int16_t));
 
-	int channelCount = 0;
-	int sampleRate = 48000;
+		OpusEncoder sizingEncoder;
+		size += GetAllocationSize(sizeof(OpusEncoder)) + GetAllocationSize(sizingEncoder.GetWorkBufferSize(rate, 1));
+		size += GetAllocationSize(static_cast<size_t>(rate) * MAX_ENCODER_FRAME_DURATION / 1000000 * sizeof(int16_t));
+		if (parameter->useRedundancy) size += GetAllocationSize(MAX_OPUS_ENCODER_OUTPUT_SIZE);
+		size += GetAllocationSize(MAX_BUNDLE_SIZE + MAX_OPUS_ENCODER_OUTPUT_SIZE);
+		size += GetAllocationSize(VoicePreprocessor::GetStorageSize(rate));
+		size += GetAllocationSize(PACKET_BUFFER_COUNT * PACKET_BUFFER_SIZE);
+		if (parameter->useWorkerThread)
+		{
+			size += GetAllocationSize(WORKER_THREAD_STACK_SIZE, nn::os::ThreadStackAlignment)
+				+ GetAllocationSize(MAX_FRAME_SIZE) + GetAllocationSize(ENCODED_PACKET_QUEUE_SIZE);
+		}
+		return size;
+	}
 
-	bool AllocateBuffers()
+	bool AllocateBuffers(VoiceRecorder* recorder)
 	{
-		channelCount = GetAudioInChannelCount(&audioIn);
-		sampleRate = GetAudioInSampleRate(&audioIn);
-		SampleFormat sampleFormat = GetAudioInSampleFormat(&audioIn);
+		recorder->channelCount = GetAudioInChannelCount(&recorder->audioIn);
+		recorder->sampleRate = GetAudioInSampleRate(&recorder->audioIn);
+		SampleFormat sampleFormat = GetAudioInSampleFormat(&recorder->audioIn);
 		size_t sampleByteSize = GetSampleByteSize(sampleFormat);
 
-		int frameRate = 1000 / BUFFER_LENGTH_MILIS;
-		int frameSampleCount = sampleRate / frameRate;
-		size_t dataSize = frameSampleCount * channelCount * sampleByteSize;
-		size_t audioBufferSize = nn::util::align_up(dataSize, AudioOutBuffer::SizeGranularity);
+		int frameSampleCount = recorder->sampleRate * recorder->audioInBufferLengthMilis / 1000;
+		size_t dataSize = frameSampleCount * recorder->channelCount * sampleByteSize;
+		size_t audioBufferSize = GetAudioInBufferSize(dataSize);
 
-		size_t totalBufferSize = audioBufferSize;
-		if (totalBufferSize < MIN_TOTAL_BUFFER_SIZE) totalBufferSize = MIN_TOTAL_BUFFER_SIZE;
-		totalBuffer = new char[totalBufferSize]();
-		allocator.Initialize(totalBuffer, totalBufferSize);
+		bool allocated = true;
+		recorder->encodeSampleRate = SelectEncodeSampleRate(recorder->requestedEncodeSampleRate, recorder->sampleRate);
+		recorder->useCaptureResampler = recorder->sampleRate != recorder->encodeSampleRate;
+		recorder->captureResamplerStorage = nullptr;
+		recorder->resampledInputBuffer = nullptr;
+		size_t bufferSampleCount = frameSampleCount; // mono samples per AudioIn buffer at encodeSampleRate
+		if (recorder->useCaptureResampler)
+		{
+			size_t storageSize = PolyphaseResampler::GetStorageSize(recorder->sampleRate, recorder->encodeSampleRate);
+			if (storageSize > 0) recorder->captureResamplerStorage = reinterpret_cast<float*>(Allocate(MemoryCategory_Encoder, storageSize * sizeof(float)));
+			if (recorder->captureResamplerStorage && recorder->captureResampler.Initialize(recorder->captureResamplerStorage, recorder->sampleRate, recorder->encodeSampleRate))
+			{
+				bufferSampleCount = recorder->captureResampler.GetMaxOutputCount(frameSampleCount);
+				recorder->resampledInputBuffer = reinterpret_cast<int16_t*>(Allocate(MemoryCategory_Encoder, bufferSampleCount * sizeof(int16_t)));
+			}
+			if (!recorder->resampledInputBuffer) allocated = false;
+		}
+
+		size_t remainToEncodeBufferSize = GetRemainToEncodeCapacity(bufferSampleCount, recorder->audioInBufferCount, recorder->encodeSampleRate, recorder->preRollMilis);
+		recorder->preRollSampleCount = static_cast<size_t>(recorder->encodeSampleRate) * recorder->preRollMilis / 1000;
+		recorder->remainToEncodeBuffer = reinterpret_cast<int16_t*>(Allocate(MemoryCategory_Encoder, remainToEncodeBufferSize * sizeof(int16_t)));
+		if (recorder->remainToEncodeBuffer) recorder->remainToEncodeRing.Initialize(recorder->remainToEncodeBuffer, remainToEncodeBufferSize);
+		else allocated = false;
 
-		remainToEncodeBufferSize = totalBufferSize;
-		remainToEncodeBuffer = new int16_t[remainToEncodeBufferSize];
-		remainToEncodeBufferStart = 0;
-		remainToEncodeBufferEnd = 0;
+		for (int i = 0; i < recorder->audioInBufferCount; i++)
+		{
+			recorder->audioBuffers[i] = Allocate(MemoryCategory_Encoder, audioBufferSize, AudioInBuffer::AddressAlignment);
+			if (recorder->audioBuffers[i]) SetAudioInBufferInfo(&recorder->audioInBuffers[i], recorder->audioBuffers[i], audioBufferSize, dataSize);
+			else allocated = false;
+		}
 
-		audioBuffer = allocator.Allocate(audioBufferSize, AudioInBuffer::AddressAlignment);
-		if (audioBuffer)
+		if (allocated)
 		{
-			SetAudioInBufferInfo(&audioInBuffer, audioBuffer, audioBufferSize, dataSize);
 			return true;
 		}
 		else
 		{
-			allocator.Finalize();
-			delete totalBuffer;
+			for (int i = 0; i < recorder->audioInBufferCount; i++) Free(MemoryCategory_Encoder, recorder->audioBuffers[i]);
+			FreeCaptureResampler(recorder);
+			if (recorder->remainToEncodeBuffer) recorder->remainToEncodeRing.Finalize();
+			Free(MemoryCategory_Encoder, recorder->remainToEncodeBuffer);
 			return false;
 		}
 	}
 
-	bool InitializeEncoder()
+	void FreeCaptureResampler(VoiceRecorder* recorder)
 	{
-		encoder = new OpusEncoder();
-		opusWorkBufferSize = encoder->GetWorkBufferSize(sampleRate, 1); // channelCount = 1, because we use mono
-		opusWorkBuffer = new char[opusWorkBufferSize];
-		OpusResult result = encoder->Initialize(sampleRate, 1, opusWorkBuffer, opusWorkBufferSize);
+		Free(MemoryCategory_Encoder, recorder->resampledInputBuffer);
+		Free(MemoryCategory_Encoder, recorder->captureResamplerStorage);
+		recorder->resampledInputBuffer = nullptr;
+		recorder->captureResamplerStorage = nullptr;
+		recorder->useCaptureResampler = false;
+	}
+
+	bool InitializeEncoder(VoiceRecorder* recorder)
+	{
+		recorder->previousPacket = nullptr;
+		recorder->previousPacketSize = 0;
+		recorder->tempInputEncoderBuffer = nullptr;
+		recorder->opusWorkBuffer = nullptr;
+		recorder->bundleBuffer = nullptr;
+		recorder->preprocessorStorage = nullptr;
+		recorder->encoder = nullptr;
+		recorder->isEncoderInitialized = false;
+		void* encoderStorage = Allocate(MemoryCategory_Encoder, sizeof(OpusEncoder));
+		if (!encoderStorage) return false;
+		recorder->encoder = new (encoderStorage) OpusEncoder();
+		recorder->opusWorkBufferSize = recorder->encoder->GetWorkBufferSize(recorder->encodeSampleRate, 1); // channelCount = 1, because we use mono
+		recorder->opusWorkBuffer = reinterpret_cast<char*>(Allocate(MemoryCategory_Encoder, recorder->opusWorkBufferSize));
+		if (!recorder->opusWorkBuffer) return false;
+		OpusResult result = recorder->encoder->Initialize(recorder->encodeSampleRate, 1, recorder->opusWorkBuffer, recorder->opusWorkBufferSize);
 		if (result != OpusResult_Success) return false;
+		recorder->isEncoderInitialized = true;
+
+		recorder->encoder->SetBitRate(recorder->initialBitRate);
+		recorder->targetBitRate.store(recorder->initialBitRate, std::memory_order_relaxed);
+		recorder->currentBitRate.store(recorder->initialBitRate, std::memory_order_relaxed);
+		recorder->codingMode = recorder->initialCodingMode;
+		recorder->encoder->BindCodingMode(recorder->codingMode);
+
+		recorder->encodeFrameDuration = recorder->initialFrameDuration;
+		recorder->encodeSampleCount = recorder->encoder->CalculateFrameSampleCount(recorder->encodeFrameDuration);
+		recorder->targetEncoderSetting.store(PackEncoderSetting(recorder->encodeFrameDuration, recorder->codingMode), std::memory_order_relaxed);
+		recorder->tempInputEncoderBuffer = reinterpret_cast<int16_t*>(Allocate(MemoryCategory_Encoder, recorder->encoder->CalculateFrameSampleCount(MAX_ENCODER_FRAME_DURATION) * sizeof(int16_t)));
+		if (!recorder->tempInputEncoderBuffer) return false;
+		recorder->frameSequence = 0;
+		recorder->frameTimestamp = 0;
+		recorder->noiseFloorDb = recorder->voiceActivityMinimumLevelDb;
+		recorder->hangoverRemainingMicroSeconds = 0;
+		recorder->talkSpurtStart = true;
+		recorder->isSpeaking.store(!recorder->useVoiceActivityDetection, std::memory_order_relaxed);
+		recorder->dtxSkippedFrameCount.store(0, std::memory_order_relaxed);
 
-		encoder->SetBitRate(ENCODER_BIT_RATE);
-		encoder->BindCodingMode(OpusCodingMode_Auto);
+		// allocated either way, the bundle size can be changed while recording
+		recorder->bundleBuffer = reinterpret_cast<char*>(Allocate(MemoryCategory_Encoder, MAX_BUNDLE_SIZE + MAX_OPUS_ENCODER_OUTPUT_SIZE));
+		if (!recorder->bundleBuffer) return false;
+		recorder->framesPerPacket = recorder->targetFramesPerPacket.load(std::memory_order_relaxed);
+		recorder->bundleCount = 0;
+		recorder->bundleSize = 0;
+		recorder->bundleSizeFieldSize = 0;
 
-		encodeSampleCountMaximum = encoder->CalculateFrameSampleCount(ENCODER_FRAME_DURATION);
-		tempInputEncoderBuffer = new int16_t[encodeSampleCountMaximum];
+		// allocated either way too, preprocessing can be switched on while recording
+		recorder->preprocessorStorage = Allocate(MemoryCategory_Encoder, VoicePreprocessor::GetStorageSize(recorder->encodeSampleRate));
+		if (!recorder->preprocessorStorage) return false;
+		recorder->preprocessor.Initialize(recorder->preprocessorStorage, recorder->encodeSampleRate, recorder->noiseSuppressionDb, recorder->automaticGainControlTargetDb);
+		recorder->preprocessing = false;
+		recorder->preprocessCostMicroSeconds = 0.0f;
+		recorder->preprocessBypassRemaining = 0;
+
+		if (recorder->useRedundancy)
+		{
+			recorder->previousPacket = reinterpret_cast<char*>(Allocate(MemoryCategory_Encoder, MAX_OPUS_ENCODER_OUTPUT_SIZE));
+			if (!recorder->previousPacket) return false;
+		}
 		return true;
 	}
 
-	void FinalizeEncoder()
+	void FinalizeEncoder(VoiceRecorder* recorder)
 	{
-		encoder->Finalize();
-		delete tempInputEncoderBuffer;
-		delete opusWorkBuffer;
+		Free(MemoryCategory_Encoder, recorder->previousPacket);
+		recorder->previousPacket = nullptr;
+		if (recorder->encoder)
+		{
+			if (recorder->isEncoderInitialized) recorder->encoder->Finalize();
+			recorder->isEncoderInitialized = false;
+			recorder->encoder->~OpusEncoder();
+			Free(MemoryCategory_Encoder, recorder->encoder);
+			recorder->encoder = nullptr;
+		}
+		Free(MemoryCategory_Encoder, recorder->bundleBuffer);
+		Free(MemoryCategory_Encoder, recorder->preprocessorStorage);
+		Free(MemoryCategory_Encoder, recorder->tempInputEncoderBuffer);
+		Free(MemoryCategory_Encoder, recorder->opusWorkBuffer);
+		recorder->bundleBuffer = nullptr;
+		recorder->preprocessorStorage = nullptr;
+		recorder->tempInputEncoderBuffer = nullptr;
+		recorder->opusWorkBuffer = nullptr;
 	}
 
-	inline bool IsEmptyRemainToEncodeBuffer()
+	// Updates the DC estimate and the input level meter after sampleCount captured samples.
+	void UpdateInputLevels(VoiceRecorder* recorder, const SwitchVoiceChatSimd::CaptureLevels& levels, size_t sampleCount)
 	{
-		return remainToEncodeBufferStart == remainToEncodeBufferEnd;
+		if (sampleCount == 0) return;
+		int durationMicroSeconds = static_cast<int>(static_cast<int64_t>(sampleCount) * 1000000 / recorder->sampleRate);
+		if (recorder->useDcRemoval)
+		{
+			float rate = durationMicroSeconds < DC_TIME_CONSTANT_MICROSECONDS ? static_cast<float>(durationMicroSeconds) / DC_TIME_CONSTANT_MICROSECONDS : 1.0f;
+			recorder->dcOffset += (levels.inputSum / sampleCount - recorder->dcOffset) * rate;
+		}
+
+		float peak = levels.peak / 32768.0f;
+		float fallenPeak = recorder->inputPeak * std::pow(10.0f, -PEAK_FALL_DB_PER_SECOND * durationMicroSeconds / 20000000.0f);
+		recorder->inputPeak = peak > fallenPeak ? peak : fallenPeak;
+		VoiceInputLevels published;
+		published.peak = recorder->inputPeak;
+		published.rms = std::sqrt(levels.sumOfSquares / sampleCount) / 32768.0f;
+		uint64_t packed;
+		std::memcpy(&packed, &published, sizeof(packed));
+		recorder->inputLevels.store(packed, std::memory_order_relaxed);
 	}
 
-	inline size_t SizeRemainToEncodeBuffer()
+	// Drains every released AudioInBuffer into remainToEncodeRing, then hands them all back to the driver.
+	// Each buffer goes through the capture front-end on the way: straight into the ring, or in place
+	// before the resampler.
+	bool GetMicrophoneInput(VoiceRecorder* recorder)
 	{
-		if (remainToEncodeBufferStart <= remainToEncodeBufferEnd)
+		AudioInBuffer* releasedBuffers[MAX_BUFFER_COUNT];
+		int releasedCount = 0;
+		float gain = recorder->inputGain.load(std::memory_order_relaxed);
+		SwitchVoiceChatSimd::CaptureLevels levels = {};
+		size_t processedSampleCount = 0;
+
+		while (releasedCount < recorder->audioInBufferCount)
 		{
-			return remainToEncodeBufferEnd - remainToEncodeBufferStart;
+			AudioInBuffer* releasedBuffer = GetReleasedAudioInBuffer(&recorder->audioIn);
+			if (!releasedBuffer) break;
+			releasedBuffers[releasedCount++] = releasedBuffer;
+
+			size_t releasedBufferSize = GetAudioInBufferDataSize(releasedBuffer) / 2;
+			int16_t* releasedBufferPointer = reinterpret_cast<int16_t*>(GetAudioInBufferDataPointer(releasedBuffer));
+
+			// one channel, or all of them downmixed
+			size_t audioBufferMonoSize = releasedBufferSize / recorder->channelCount;
+			// a full ring means the encoder fell behind: the newest audio is dropped
+			size_t pushSize, pushedSize;
+			if (recorder->useCaptureResampler)
+			{
+				SwitchVoiceChatSimd::ProcessCapture(releasedBufferPointer, releasedBufferPointer, audioBufferMonoSize, recorder->channelCount,
+					recorder->useDownmix, recorder->dcOffset, gain, &levels);
+				processedSampleCount += audioBufferMonoSize;
+				pushSize = recorder->captureResampler.Process(releasedBufferPointer, audioBufferMonoSize, 1, recorder->resampledInputBuffer);
+				pushedSize = recorder->remainToEncodeRing.Push(recorder->resampledInputBuffer, pushSize);
+			}
+			else
+			{
+				int16_t* first;
+				int16_t* second;
+				size_t firstCount, secondCount;
+				pushSize = audioBufferMonoSize;
+				pushedSize = recorder->remainToEncodeRing.Reserve(&first, &firstCount, &second, &secondCount, pushSize);
+				SwitchVoiceChatSimd::ProcessCapture(first, releasedBufferPointer, firstCount, recorder->channelCount,
+					recorder->useDownmix, recorder->dcOffset, gain, &levels);
+				SwitchVoiceChatSimd::ProcessCapture(second, releasedBufferPointer + firstCount * recorder->channelCount, secondCount, recorder->channelCount,
+					recorder->useDownmix, recorder->dcOffset, gain, &levels);
+				recorder->remainToEncodeRing.Commit(pushedSize);
+				processedSampleCount += pushedSize;
+			}
+			if (pushedSize < pushSize) recorder->captureOverrunSampleCount.fetch_add(pushSize - pushedSize, std::memory_order_relaxed);
+			recorder->capturedSampleCount.fetch_add(audioBufferMonoSize, std::memory_order_relaxed);
 		}
-		else
+		if (releasedCount == 0) return false;
+		recorder->lastCaptureTick = nn::os::GetSystemTick();
+		UpdateInputLevels(recorder, levels, processedSampleCount);
+
+		// the driver had nothing left to record into: audio was lost until now
+		if (releasedCount == recorder->audioInBufferCount) recorder->audioInStarvedCount.fetch_add(1, std::memory_order_relaxed);
+
+		for (int i = 0; i < releasedCount; i++) AppendAudioInBuffer(&recorder->audioIn, releasedBuffers[i]);
+		return true;
+	}
+
+	// Energy VAD with an adaptive noise floor. A frame is speech when it is voiceActivityThresholdDb
+	// above the floor, or half that and voiced (few zero crossings). Speech is held for the hangover.
+	bool DetectVoiceActivity(VoiceRecorder* recorder, const int16_t* samples, int sampleCount)
+	{
+		uint64_t sumOfSquares = SwitchVoiceChatSimd::SumOfSquares(samples, sampleCount);
+		float meanSquare = static_cast<float>(sumOfSquares) / (static_cast<float>(sampleCount) * 32768.0f * 32768.0f);
+		float levelDb = 10.0f * std::log10(meanSquare + 1e-10f);
+
+		int zeroCrossingCount = 0;
+		for (int i = 1; i < sampleCount; i++) zeroCrossingCount += (samples[i - 1] < 0) != (samples[i] < 0);
+		float zeroCrossingRate = static_cast<float>(zeroCrossingCount) / sampleCount;
+
+		// the floor drops at once to a quieter frame and rises slowly
+		if (levelDb < recorder->noiseFloorDb) recorder->noiseFloorDb = levelDb;
+		else recorder->noiseFloorDb += (levelDb - recorder->noiseFloorDb) * NOISE_FLOOR_RISE;
+		if (recorder->noiseFloorDb < recorder->voiceActivityMinimumLevelDb - recorder->voiceActivityThresholdDb) recorder->noiseFloorDb = recorder->voiceActivityMinimumLevelDb - recorder->voiceActivityThresholdDb;
+
+		float aboveFloorDb = levelDb - recorder->noiseFloorDb;
+		bool voiced = levelDb > recorder->voiceActivityMinimumLevelDb &&
+			(aboveFloorDb > recorder->voiceActivityThresholdDb || (aboveFloorDb > recorder->voiceActivityThresholdDb * 0.5f && zeroCrossingRate < VOICED_ZERO_CROSSING_RATE));
+
+		if (voiced) recorder->hangoverRemainingMicroSeconds = recorder->voiceActivityHangoverMilis * 1000;
+		else if (recorder->hangoverRemainingMicroSeconds > 0) recorder->hangoverRemainingMicroSeconds -= recorder->encodeFrameDuration;
+		return voiced || recorder->hangoverRemainingMicroSeconds > 0;
+	}
+
+	// SILK has no 5 ms frames; Auto falls back to CELT for them.
+	bool IsValidEncoderSetting(int frameDuration, int mode)
+	{
+		if (frameDuration != 5000 && frameDuration != 10000 && frameDuration != 20000) return false;
+		if (mode != OpusCodingMode_Celt && mode != OpusCodingMode_Silk && mode != OpusCodingMode_Auto) return false;
+		return !(mode == OpusCodingMode_Silk && frameDuration < 10000);
+	}
+
+	// Frame duration in the high half, coding mode in the low half.
+	uint64_t PackEncoderSetting(int frameDuration, int mode)
+	{
+		return (static_cast<uint64_t>(static_cast<uint32_t>(frameDuration)) << 32) | static_cast<uint32_t>(mode);
+	}
+
+	// Sets the frame duration and coding mode to apply next, either one negative to keep the current
+	// value. Checks the resulting pair and stores it in one step, so concurrent setters cannot combine
+	// into an invalid pair such as SILK with 5 ms frames.
+	bool UpdateEncoderSetting(VoiceRecorder* recorder, int frameDuration, int mode)
+	{
+		uint64_t setting = recorder->targetEncoderSetting.load(std::memory_order_relaxed);
+		uint64_t newSetting;
+		do
 		{
-			return remainToEncodeBufferSize + remainToEncodeBufferEnd - remainToEncodeBufferStart;
+			int newFrameDuration = frameDuration >= 0 ? frameDuration : static_cast<int>(setting >> 32);
+			int newMode = mode >= 0 ? mode : static_cast<int>(static_cast<uint32_t>(setting));
+			if (!IsValidEncoderSetting(newFrameDuration, newMode)) return false;
+			newSetting = PackEncoderSetting(newFrameDuration, newMode);
+		} while (!recorder->targetEncoderSetting.compare_exchange_weak(setting, newSetting, std::memory_order_relaxed));
+		return true;
+	}
+
+	// The rates the Opus encoder accepts.
+	bool IsValidEncodeSampleRate(int rate)
+	{
+		return rate == 8000 || rate == 12000 || rate == 16000 || rate == 24000 || rate == 48000;
+	}
+
+	// Restarts the stream after a pause without allocating: the encoder is re-initialized on its work
+	// buffer and the next frame starts a talk spurt. Sequence numbers carry on and the timestamps skip
+	// the audio dropped while paused, so the receiver sees a pause rather than a loss.
+	void ResetEncoderState(VoiceRecorder* recorder)
+	{
+		if (recorder->isEncoderInitialized) recorder->encoder->Finalize();
+		recorder->isEncoderInitialized = recorder->encoder->Initialize(recorder->encodeSampleRate, 1, recorder->opusWorkBuffer, recorder->opusWorkBufferSize) == OpusResult_Success;
+		if (!recorder->isEncoderInitialized)
+		{
+			NN_LOG("Opus Encoder Reset Error\n");
 		}
+		recorder->encoder->SetBitRate(recorder->currentBitRate.load(std::memory_order_relaxed));
+		recorder->encoder->BindCodingMode(recorder->codingMode);
+
+		recorder->frameTimestamp += static_cast<uint32_t>(recorder->pausedSampleCount * VoiceFrameTimestampRate / recorder->encodeSampleRate);
+		recorder->pausedSampleCount = 0;
+		recorder->previousPacketSize = 0;
+		recorder->bundleCount = 0;
+		recorder->bundleSize = 0;
+		recorder->bundleSizeFieldSize = 0;
+		recorder->hangoverRemainingMicroSeconds = 0;
+		recorder->talkSpurtStart = true;
+		recorder->isSpeaking.store(!recorder->useVoiceActivityDetection, std::memory_order_relaxed);
+		// the block held from before the pause is not sent; the noise estimate and AGC gain are kept
+		recorder->preprocessor.Reset();
 	}
 
-	// Push elements to the remainToEncodeBuffer
-	void PushRemainToEncodeBuffer(int16_t value)
+	// Follows wntgd_PauseRecorder and wntgd_ResumeRecorder, on the encoding thread after capture.
+	// While paused the device keeps capturing, so it stays warm, and remainToEncodeRing is cut down to
+	// the newest preRollSampleCount samples, which are encoded first on resume. Returns false while paused.
+	// The resume waits for a bundle still pending from before the pause to be flushed, which in polling
+	// mode takes a call with room for a whole frame: resetting the encoder state would drop it.
+	bool ApplyPauseState(VoiceRecorder* recorder)
 	{
-		remainToEncodeBuffer[remainToEncodeBufferEnd] = value;
-		remainToEncodeBufferEnd = (remainToEncodeBufferEnd + 1) % remainToEncodeBufferSize;
-		if (remainToEncodeBufferStart == remainToEncodeBufferEnd)
+		bool pause = recorder->targetPaused.load(std::memory_order_acquire);
+		if (pause && !recorder->paused)
+		{
+			recorder->paused = true;
+			recorder->isSpeaking.store(false, std::memory_order_relaxed);
+		}
+		else if (!pause && recorder->paused && recorder->bundleCount == 0)
+		{
+			recorder->paused = false;
+			ResetEncoderState(recorder);
+		}
+		if (!recorder->paused) return true;
+
+		size_t size = recorder->remainToEncodeRing.Size();
+		if (size > recorder->preRollSampleCount)
+		{
+			recorder->remainToEncodeRing.Consume(size - recorder->preRollSampleCount);
+			recorder->pausedSampleCount += size - recorder->preRollSampleCount;
+		}
+		return false;
+	}
+
+	// Picks up bitrate, frame duration and coding mode changes. Called by the encoding thread
+	// between frames only, so the encoder is reconfigured without being re-initialized.
+	void ApplyEncoderSettings(VoiceRecorder* recorder)
+	{
+		int bitRate = recorder->targetBitRate.load(std::memory_order_relaxed);
+		if (bitRate != recorder->currentBitRate.load(std::memory_order_relaxed))
+		{
+			recorder->encoder->SetBitRate(bitRate);
+			recorder->currentBitRate.store(bitRate, std::memory_order_relaxed);
+		}
+
+		uint64_t setting = recorder->targetEncoderSetting.load(std::memory_order_relaxed);
+		OpusCodingMode mode = static_cast<OpusCodingMode>(static_cast<uint32_t>(setting));
+		if (mode != recorder->codingMode)
+		{
+			recorder->encoder->BindCodingMode(mode);
+			recorder->codingMode = mode;
+		}
+
+		int frameDuration = static_cast<int>(setting >> 32);
+		if (frameDuration != recorder->encodeFrameDuration)
 		{
-			remainToEncodeBufferStart = (remainToEncodeBufferStart + 1) % remainToEncodeBufferSize;
+			recorder->encodeFrameDuration = frameDuration;
+			recorder->encodeSampleCount = recorder->encoder->CalculateFrameSampleCount(frameDuration);
 		}
+
+		recorder->framesPerPacket = recorder->targetFramesPerPacket.load(std::memory_order_relaxed);
 	}
 
-	// Pop (adn discards) elements from the remainToEncodeBuffer
-	void PopRemainToEncodeBuffer(size_t quantity)
+	// Noise suppression and AGC on the frame in tempInputEncoderBuffer, in place and one 10 ms block
+	// late. Whenever the smoothed cost per block goes over the budget (a busy core, or a rate the
+	// device is too slow for), the suppression is bypassed for PREPROCESS_BYPASS_BLOCK_COUNT blocks:
+	// the audio is only delayed and the AGC keeps running, for a small part of the cost.
+	void PreprocessFrame(VoiceRecorder* recorder)
 	{
-		if (quantity > SizeRemainToEncodeBuffer()) quantity = SizeRemainToEncodeBuffer();
-		remainToEncodeBufferStart = (remainToEncodeBufferStart + quantity) % remainToEncodeBufferSize;
+		bool suppress = recorder->useNoiseSuppression.load(std::memory_order_relaxed);
+		bool useAgc = recorder->useAutomaticGainControl.load(std::memory_order_relaxed);
+		int blockSize = recorder->preprocessor.GetBlockSize();
+		if ((!suppress && !useAgc) || recorder->encodeSampleCount % blockSize != 0)
+		{
+			recorder->preprocessing = false;
+			return;
+		}
+		// the block held since the preprocessor last ran is stale
+		if (!recorder->preprocessing) recorder->preprocessor.Reset();
+		recorder->preprocessing = true;
+
+		int blockCount = recorder->encodeSampleCount / blockSize;
+		bool bypass = suppress && recorder->preprocessBypassRemaining > 0;
+		if (bypass)
+		{
+			recorder->preprocessBypassRemaining -= blockCount;
+			recorder->preprocessBypassedBlockCount.fetch_add(blockCount, std::memory_order_relaxed);
+		}
+		nn::os::Tick begin = nn::os::GetSystemTick();
+		recorder->preprocessor.Process(recorder->tempInputEncoderBuffer, blockCount, suppress && !bypass, useAgc);
+		int64_t blockMicroSeconds = nn::os::ConvertToTimeSpan(nn::os::GetSystemTick() - begin).GetMicroSeconds() / blockCount;
+		recorder->preprocessTimeHistogram.Record(blockMicroSeconds);
+		if (!suppress || bypass || recorder->preprocessBudgetMicroSeconds == 0) return;
+
+		float cost = recorder->preprocessCostMicroSeconds;
+		cost = cost == 0.0f ? static_cast<float>(blockMicroSeconds) : cost + (blockMicroSeconds - cost) * PREPROCESS_COST_SMOOTHING;
+		if (cost > recorder->preprocessBudgetMicroSeconds)
+		{
+			recorder->preprocessBypassRemaining = PREPROCESS_BYPASS_BLOCK_COUNT;
+			cost = 0.0f; // measured afresh after the bypass
+		}
+		recorder->preprocessCostMicroSeconds = cost;
 	}
 
-	// Copy remainToEncodeBuffer to dest buffer (only call this function if count <= SizeRemainToEncodeBuffer)
-	void CopyRemainToEncodeBuffer(int16_t* dest, size_t count)
+	// With useRedundancy, appends the previous frame's packet (or bundle) behind the payloadSize
+	// bytes at payload, keeps this frame's for the next one and returns the new payload size. The
+	// copy is only carried between frames of the same kind.
+	size_t AddRedundancy(VoiceRecorder* recorder, char* payload, size_t payloadSize, bool isBundle, uint8_t* flags)
 	{
-		if (remainToEncodeBufferStart <= remainToEncodeBufferEnd)
+		if (!recorder->useRedundancy) return payloadSize;
+		size_t totalSize = payloadSize;
+		if (recorder->previousPacketSize > 0 && recorder->previousPacketIsBundle == isBundle)
 		{
-			int16_t* source = &remainToEncodeBuffer[remainToEncodeBufferStart];
-			memcpy(dest, source, count);
+			std::memcpy(payload + payloadSize, recorder->previousPacket, recorder->previousPacketSize);
+			totalSize += recorder->previousPacketSize;
+			*flags |= VoiceFrameFlag_Redundant;
 		}
-		else
+		std::memcpy(recorder->previousPacket, payload, payloadSize);
+		recorder->previousPacketSize = payloadSize;
+		recorder->previousPacketIsBundle = isBundle;
+		return totalSize;
+	}
+
+	// Writes the bundle put together so far to out as one frame and starts a new one.
+	void FlushBundle(VoiceRecorder* recorder, char* out, size_t* encodedSize)
+	{
+		VoiceFrame frame;
+		frame.sequence = recorder->frameSequence++;
+		frame.timestamp = recorder->bundleTimestamp;
+		frame.durationHalfMilis = static_cast<uint8_t>(recorder->bundleDuration / 500);
+		frame.flags = recorder->bundleFlags | VoiceFrameFlag_Bundle;
+
+		char* payload = out + VoiceFrameHeaderSize;
+		size_t payloadSize = 0;
+		payload[payloadSize++] = static_cast<char>(recorder->bundleCount);
+		for (int i = 0; i < recorder->bundleCount; i++) payloadSize += WriteVoiceBundlePacketSize(payload + payloadSize, recorder->bundlePacketSizes[i]);
+		std::memcpy(payload + payloadSize, recorder->bundleBuffer, recorder->bundleSize);
+		payloadSize = AddRedundancy(recorder, payload, payloadSize + recorder->bundleSize, true, &frame.flags);
+
+		frame.payloadSize = static_cast<uint16_t>(payloadSize);
+		WriteVoiceFrameHeader(out, frame);
+		*encodedSize = VoiceFrameHeaderSize + payloadSize;
+		recorder->bundleCount = 0;
+		recorder->bundleSize = 0;
+		recorder->bundleSizeFieldSize = 0;
+	}
+
+	// Encodes one frame from remainToEncodeRing into out (at least MAX_FRAME_SIZE bytes), header included.
+	// The frame is consumed (and its sequence number used) even when encoding fails, so a bad frame
+	// cannot stall the stream and the receiver sees it as lost. With DTX, a silent frame is consumed
+	// without encoding: encodedSize is 0, the timestamp moves on and the sequence number does not, so
+	// the receiver sees a pause rather than a loss.
+	// With framesPerPacket above 1 the packet joins the bundle instead, and a frame is written whenever
+	// a bundle is complete or interrupted: by a full bundle, DTX, an encoding error, or a packet that
+	// no longer fits MAX_BUNDLE_SIZE. A packet too big for any bundle goes out on its own as a plain
+	// frame, after the bundle it interrupted: the only case with two frames written in one call.
+	bool EncodeFrame(VoiceRecorder* recorder, char* out, size_t outSize, size_t* encodedSize)
+	{
+		*encodedSize = 0;
+		// a bundle made complete by a settings change goes out before the next frame is taken
+		if (recorder->bundleCount > 0 && (recorder->bundleCount >= recorder->framesPerPacket
+			|| recorder->bundleDuration + recorder->encodeFrameDuration > MAX_BUNDLE_DURATION))
 		{
-			if (remainToEncodeBufferStart + count <= remainToEncodeBufferSize)
+			FlushBundle(recorder, out, encodedSize);
+			return true;
+		}
+
+		uint32_t frameTimestampIncrement = static_cast<uint32_t>(static_cast<int64_t>(recorder->encodeSampleCount) * VoiceFrameTimestampRate / recorder->encodeSampleRate);
+		// audio queued after this frame, i.e. how long ago its last sample was captured
+		int64_t queuedMicroSeconds = static_cast<int64_t>(recorder->remainToEncodeRing.Size() - recorder->encodeSampleCount) * 1000000 / recorder->encodeSampleRate;
+		recorder->remainToEncodeRing.Peek(recorder->tempInputEncoderBuffer, recorder->encodeSampleCount);
+		PreprocessFrame(recorder);
+
+		if (recorder->useVoiceActivityDetection)
+		{
+			bool speaking = DetectVoiceActivity(recorder, recorder->tempInputEncoderBuffer, recorder->encodeSampleCount);
+			recorder->isSpeaking.store(speaking, std::memory_order_relaxed);
+			if (recorder->useDtx && !speaking)
 			{
-				int16_t* source = &remainToEncodeBuffer[remainToEncodeBufferStart];
-				memcpy(dest, source, count);
+				if (recorder->bundleCount > 0) FlushBundle(recorder, out, encodedSize);
+				recorder->remainToEncodeRing.Consume(recorder->encodeSampleCount);
+				recorder->frameTimestamp += frameTimestampIncrement;
+				recorder->previousPacketSize = 0;
+				recorder->talkSpurtStart = true;
+				recorder->dtxSkippedFrameCount.fetch_add(1, std::memory_order_relaxed);
+				return true;
 			}
-			else
+		}
+
+		bool bundling = recorder->framesPerPacket > 1;
+		VoiceFrame frame;
+		frame.timestamp = recorder->frameTimestamp;
+		frame.durationHalfMilis = static_cast<uint8_t>(recorder->encodeFrameDuration / 500);
+		frame.flags = recorder->talkSpurtStart ? VoiceFrameFlag_TalkSpurtStart : 0;
+		if (!bundling) frame.sequence = recorder->frameSequence++;
+		recorder->frameTimestamp += frameTimestampIncrement;
+		recorder->talkSpurtStart = false;
+
+		size_t packetSize = 0;
+		// the rest of out is left for the redundant copy of the previous packet; a packet for the bundle
+		// is encoded behind it and only copied in once it is known to fit
+		char* packet = bundling ? recorder->bundleBuffer + MAX_BUNDLE_SIZE : out + VoiceFrameHeaderSize;
+		size_t packetCapacity = bundling ? MAX_OPUS_ENCODER_OUTPUT_SIZE : outSize - VoiceFrameHeaderSize - MAX_OPUS_ENCODER_OUTPUT_SIZE;
+		nn::os::Tick encodeBegin = nn::os::GetSystemTick();
+		OpusResult result = recorder->encoder->EncodeInterleaved(&packetSize, packet, packetCapacity,
+			recorder->tempInputEncoderBuffer, recorder->encodeSampleCount);
+		nn::os::Tick encodeEnd = nn::os::GetSystemTick();
+		recorder->remainToEncodeRing.Consume(recorder->encodeSampleCount);
+
+		if (result != OpusResult_Success)
+		{
+			NN_LOG("Opus Encoding Error: %d\n", result);
+			recorder->encodeErrorCount.fetch_add(1, std::memory_order_relaxed);
+			// a bundle covers consecutive audio, so the frames before the gap go out on their own
+			if (recorder->bundleCount > 0) FlushBundle(recorder, out, encodedSize);
+			recorder->previousPacketSize = 0;
+			return false;
+		}
+		recorder->encodedFrameCount.fetch_add(1, std::memory_order_relaxed);
+		recorder->encodeTimeHistogram.Record(nn::os::ConvertToTimeSpan(encodeEnd - encodeBegin).GetMicroSeconds());
+		recorder->captureToEncodeHistogram.Record(nn::os::ConvertToTimeSpan(encodeEnd - recorder->lastCaptureTick).GetMicroSeconds() + queuedMicroSeconds);
+
+		if (bundling)
+		{
+			// the header's size is dropped, the bundle header has it; its final range stays with the packet
+			const char* bundlePacket = packet + OpusPacketHeaderSize - VoiceBundlePacketRangeSize;
+			size_t bundlePacketSize = packetSize - (OpusPacketHeaderSize - VoiceBundlePacketRangeSize);
+			size_t sizeFieldSize = bundlePacketSize < 252 ? 1 : 2;
+			if (recorder->bundleCount > 0 && 1 + recorder->bundleSizeFieldSize + recorder->bundleSize + sizeFieldSize + bundlePacketSize > MAX_BUNDLE_SIZE)
 			{
-				int16_t* source = &remainToEncodeBuffer[remainToEncodeBufferStart];
-				size_t sourceCount = remainToEncodeBufferSize - remainToEncodeBufferStart;
-				memcpy(dest, source, sourceCount);
-				sourceCount = count - sourceCount;
-				memcpy(dest, remainToEncodeBuffer, sourceCount);
+				FlushBundle(recorder, out, encodedSize);
 			}
+			if (1 + sizeFieldSize + bundlePacketSize > MAX_BUNDLE_SIZE)
+			{
+				// after the bundle, which holds the frames before it; the redundant copy is only carried
+				// between frames of the same kind, so a plain frame behind a bundle has none
+				char* plainOut = out + *encodedSize;
+				frame.sequence = recorder->frameSequence++;
+				std::memcpy(plainOut + VoiceFrameHeaderSize, packet, packetSize);
+				size_t payloadSize = AddRedundancy(recorder, plainOut + VoiceFrameHeaderSize, packetSize, false, &frame.flags);
+				frame.payloadSize = static_cast<uint16_t>(payloadSize);
+				WriteVoiceFrameHeader(plainOut, frame);
+				*encodedSize += VoiceFrameHeaderSize + payloadSize;
+				return true;
+			}
+			if (recorder->bundleCount == 0)
+			{
+				recorder->bundleTimestamp = frame.timestamp;
+				recorder->bundleFlags = frame.flags;
+				recorder->bundleDuration = 0;
+			}
+			std::memcpy(recorder->bundleBuffer + recorder->bundleSize, bundlePacket, bundlePacketSize);
+			recorder->bundlePacketSizes[recorder->bundleCount++] = bundlePacketSize;
+			recorder->bundleSize += bundlePacketSize;
+			recorder->bundleSizeFieldSize += sizeFieldSize;
+			recorder->bundleDuration += recorder->encodeFrameDuration;
+
+			// a flush above leaves a single packet, which never completes a bundle
+			if (*encodedSize == 0 && (recorder->bundleCount >= recorder->framesPerPacket
+				|| recorder->bundleDuration + recorder->encodeFrameDuration > MAX_BUNDLE_DURATION))
+			{
+				FlushBundle(recorder, out, encodedSize);
+			}
+			return true;
 		}
+
+		size_t payloadSize = AddRedundancy(recorder, packet, packetSize, false, &frame.flags);
+		frame.payloadSize = static_cast<uint16_t>(payloadSize);
+		WriteVoiceFrameHeader(out, frame);
+		*encodedSize = VoiceFrameHeaderSize + payloadSize;
+		return true;
 	}
 
-	void GetMicrophoneInput()
+	// Encodes every complete frame of remainToEncodeRing straight into dest. Stops while a worst-case
+	// frame would no longer fit, leaving the remaining audio for the next call.
+	bool Encode(VoiceRecorder* recorder, char* dest, size_t capacity, size_t* written)
 	{
-		AudioInBuffer* releasedBuffer = GetReleasedAudioInBuffer(&audioIn);
-		if (releasedBuffer)
+		size_t partialEncodedOutSize = 0;
+		size_t totalEncodedOutSize = 0;
+		bool result = true;
+		ApplyEncoderSettings(recorder);
+
+		while (recorder->remainToEncodeRing.Size() >= static_cast<size_t>(recorder->encodeSampleCount) && capacity - totalEncodedOutSize >= MAX_FRAME_SIZE)
 		{
-			size_t releasedBufferSize = GetAudioInBufferDataSize(releasedBuffer) / 2;
-			int16_t* releasedBufferPointer = reinterpret_cast<int16_t*>(GetAudioInBufferDataPointer(releasedBuffer));
+			// a failed frame may still have written the bundle before it
+			bool frameResult = EncodeFrame(recorder, dest + totalEncodedOutSize, MAX_FRAME_SIZE, &partialEncodedOutSize);
+			totalEncodedOutSize += partialEncodedOutSize;
+			if (!frameResult)
+			{
+				result = false;
+				break;
+			}
+		}
+
+		*written = totalEncodedOutSize;
+		return result;
+	}
+
+	// Moves the whole frames queued by the worker thread that fit into dest.
+	void TakeEncodedPackets(VoiceRecorder* recorder, char* dest, size_t capacity, size_t* written)
+	{
+		size_t totalSize = 0;
+		while (recorder->encodedPacketQueue.Size() >= VoiceFrameHeaderSize)
+		{
+			char header[VoiceFrameHeaderSize];
+			recorder->encodedPacketQueue.Peek(header, VoiceFrameHeaderSize);
+			size_t frameSize = GetVoiceFrameSize(header);
+			if (totalSize + frameSize > capacity) break;
+
+			recorder->encodedPacketQueue.Pop(dest + totalSize, frameSize);
+			totalSize += frameSize;
+		}
+		*written = totalSize;
+	}
 
-			// only get one channel
-			size_t audioBufferMonoSize = releasedBufferSize / channelCount;
-			for (int i = 0; i < audioBufferMonoSize; i++)
+	// Hands the frame in workerPacketBuffer to frameCallback in immediate flush mode, or queues it
+	// in encodedPacketQueue.
+	// workerPacketBuffer holds encodedSize bytes of whole frames, usually one (see EncodeFrame).
+	void DeliverEncodedFrame(VoiceRecorder* recorder, size_t encodedSize)
+	{
+		for (size_t offset = 0; offset < encodedSize;)
+		{
+			const char* frame = recorder->workerPacketBuffer + offset;
+			size_t frameSize = GetVoiceFrameSize(frame);
+			offset += frameSize;
+			if (recorder->useImmediateFlush)
 			{
-				PushRemainToEncodeBuffer(releasedBufferPointer[i * channelCount]);
+				recorder->frameCallback(frame, static_cast<int>(frameSize), recorder->frameCallbackUserData);
+				recorder->sentByteCount.fetch_add(frameSize, std::memory_order_relaxed);
+				continue;
 			}
-			AppendAudioInBuffer(&audioIn, &audioInBuffer);
+
+			// A frame goes in with a single Push so the consumer never sees half of it.
+			// If the game is not collecting packets, drop whole frames rather than partial ones.
+			if (recorder->encodedPacketQueue.FreeSpace() >= frameSize) recorder->encodedPacketQueue.Push(frame, frameSize);
+			else recorder->droppedFrameCount.fetch_add(1, std::memory_order_relaxed);
 		}
 	}
 
-	bool Encode(intptr_t* handler, char** bufferOut, int* count)
+	// Captures what the driver released and encodes every complete frame.
+	void RunEncodeWorker(VoiceRecorder* recorder)
 	{
-		size_t partialEncodedOutSize = 0;
-		size_t totalEncodedOutSize = 0;
-		auto outVector = new std::vector<char>(0);
+		GetMicrophoneInput(recorder);
+		size_t encodedSize = 0;
+		if (!ApplyPauseState(recorder))
+		{
+			// the end of the last talk spurt, if it was waiting in a bundle
+			if (recorder->bundleCount > 0)
+			{
+				FlushBundle(recorder, recorder->workerPacketBuffer, &encodedSize);
+				DeliverEncodedFrame(recorder, encodedSize);
+			}
+			return;
+		}
+		ApplyEncoderSettings(recorder);
 
-		int iteration = 0;
-		size_t inSize = SizeRemainToEncodeBuffer();
+		while (recorder->remainToEncodeRing.Size() >= static_cast<size_t>(recorder->encodeSampleCount))
+		{
+			EncodeFrame(recorder, recorder->workerPacketBuffer, MAX_FRAME_SIZE, &encodedSize);
+			if (encodedSize > 0) DeliverEncodedFrame(recorder, encodedSize);
+		}
+	}
 
-		while (SizeRemainToEncodeBuffer() >= encodeSampleCountMaximum)
+	void EncodeWorkerThread(void* argument)
+	{
+		VoiceRecorder* recorder = reinterpret_cast<VoiceRecorder*>(argument);
+		while (recorder->workerRunning.load(std::memory_order_acquire))
 		{
-			CopyRemainToEncodeBuffer(tempInputEncoderBuffer, encodeSampleCountMaximum);
-			outVector->resize(totalEncodedOutSize + MAX_OPUS_ENCODER_OUTPUT_SIZE);
-			OpusResult result = encoder->EncodeInterleaved(
-				&partialEncodedOutSize, outVector->data() + totalEncodedOutSize, MAX_OPUS_ENCODER_OUTPUT_SIZE,
-				tempInputEncoderBuffer, encodeSampleCountMaximum);
+			// Timed so that StopEncodeWorker is noticed even if the device stops releasing buffers.
+			recorder->audioInEvent.TimedWait(nn::TimeSpan::FromMilliSeconds(WORKER_WAIT_TIMEOUT_MILIS));
+			RunEncodeWorker(recorder);
+		}
+	}
 
-			if (result != OpusResult_Success)
+	// There is no waiting on several events at once, so the shared worker polls them.
+	void SharedWorkerThread(void* argument)
+	{
+		(void)argument;
+		while (sharedWorkerRunning.load(std::memory_order_acquire))
+		{
+			sharedWorkerMutex.Lock();
+			for (int i = 0; i < sharedWorkerRecorderCount; i++)
 			{
-				NN_LOG("Opus Encoding Error: %s", result);
+				if (sharedWorkerRecorders[i]->audioInEvent.TryWait()) RunEncodeWorker(sharedWorkerRecorders[i]);
+			}
+			sharedWorkerMutex.Unlock();
+			nn::os::SleepThread(nn::TimeSpan::FromMilliSeconds(SHARED_WORKER_POLL_MILIS));
+		}
+	}
+
+	// The shared worker thread runs while it has recorders.
+	bool AddSharedWorkerRecorder(VoiceRecorder* recorder)
+	{
+		std::lock_guard<nn::os::Mutex> controlLock(sharedWorkerControlMutex);
+		if (sharedWorkerRecorderCount == 0)
+		{
+			sharedWorkerThreadStack = Allocate(MemoryCategory_Encoder, WORKER_THREAD_STACK_SIZE, nn::os::ThreadStackAlignment);
+			if (!sharedWorkerThreadStack) return false;
+			sharedWorkerRunning.store(true, std::memory_order_release);
+			if (nn::os::CreateThread(&sharedWorkerThread, SharedWorkerThread, nullptr, sharedWorkerThreadStack, WORKER_THREAD_STACK_SIZE, WORKER_THREAD_PRIORITY).IsFailure())
+			{
+				sharedWorkerRunning.store(false, std::memory_order_release);
+				Free(MemoryCategory_Encoder, sharedWorkerThreadStack);
 				return false;
 			}
+			nn::os::SetThreadName(&sharedWorkerThread, "VoiceChatSharedEncoder");
+			nn::os::StartThread(&sharedWorkerThread);
+		}
+		else if (sharedWorkerRecorderCount == MAX_SHARED_WORKER_RECORDER_COUNT)
+		{
+			return false;
+		}
 
-			totalEncodedOutSize += partialEncodedOutSize;
-			PopRemainToEncodeBuffer(encodeSampleCountMaximum);
-			iteration++;
+		std::lock_guard<nn::os::Mutex> lock(sharedWorkerMutex);
+		sharedWorkerRecorders[sharedWorkerRecorderCount++] = recorder;
+		return true;
+	}
+
+	// Once this returns, the shared worker no longer touches recorder.
+	void RemoveSharedWorkerRecorder(VoiceRecorder* recorder)
+	{
+		std::lock_guard<nn::os::Mutex> controlLock(sharedWorkerControlMutex);
+		sharedWorkerMutex.Lock();
+		for (int i = 0; i < sharedWorkerRecorderCount; i++)
+		{
+			if (sharedWorkerRecorders[i] == recorder)
+			{
+				sharedWorkerRecorders[i] = sharedWorkerRecorders[--sharedWorkerRecorderCount];
+				break;
+			}
 		}
+		sharedWorkerMutex.Unlock();
+		if (sharedWorkerRecorderCount > 0) return;
 
-		outVector->resize(totalEncodedOutSize);
+		sharedWorkerRunning.store(false, std::memory_order_release);
+		nn::os::WaitThread(&sharedWorkerThread);
+		nn::os::DestroyThread(&sharedWorkerThread);
+		Free(MemoryCategory_Encoder, sharedWorkerThreadStack);
+	}
 
-		*handler = reinterpret_cast<intptr_t>(outVector);
-		*bufferOut = outVector->data();
-		*count = outVector->size();
+	void FreeEncodeWorkerBuffers(VoiceRecorder* recorder)
+	{
+		Free(MemoryCategory_Encoder, recorder->workerThreadStack);
+		Free(MemoryCategory_Encoder, recorder->workerPacketBuffer);
+		Free(MemoryCategory_Encoder, recorder->encodedPacketQueueBuffer);
+		recorder->workerThreadStack = nullptr;
+	}
+
+	bool StartEncodeWorker(VoiceRecorder* recorder)
+	{
+		recorder->workerThreadStack = nullptr;
+		if (!recorder->useSharedWorker) recorder->workerThreadStack = Allocate(MemoryCategory_Encoder, WORKER_THREAD_STACK_SIZE, nn::os::ThreadStackAlignment);
+		recorder->workerPacketBuffer = reinterpret_cast<char*>(Allocate(MemoryCategory_Encoder, MAX_FRAME_SIZE));
+		recorder->encodedPacketQueueBuffer = reinterpret_cast<char*>(Allocate(MemoryCategory_Encoder, ENCODED_PACKET_QUEUE_SIZE));
+		if ((!recorder->useSharedWorker && !recorder->workerThreadStack) || !recorder->workerPacketBuffer || !recorder->encodedPacketQueueBuffer)
+		{
+			FreeEncodeWorkerBuffers(recorder);
+			return false;
+		}
+		recorder->encodedPacketQueue.Initialize(recorder->encodedPacketQueueBuffer, ENCODED_PACKET_QUEUE_SIZE);
+
+		if (recorder->useSharedWorker)
+		{
+			if (AddSharedWorkerRecorder(recorder)) return true;
+			recorder->encodedPacketQueue.Finalize();
+			FreeEncodeWorkerBuffers(recorder);
+			return false;
+		}
 
-		if (*count > 0)	return true;
-		else return false;
+		recorder->workerRunning.store(true, std::memory_order_release);
+		if (nn::os::CreateThread(&recorder->workerThread, EncodeWorkerThread, recorder, recorder->workerThreadStack, WORKER_THREAD_STACK_SIZE, WORKER_THREAD_PRIORITY).IsFailure())
+		{
+			recorder->workerRunning.store(false, std::memory_order_release);
+			recorder->encodedPacketQueue.Finalize();
+			FreeEncodeWorkerBuffers(recorder);
+			return false;
+		}
+		nn::os::SetThreadName(&recorder->workerThread, "VoiceChatEncoder");
+		nn::os::StartThread(&recorder->workerThread);
+		return true;
 	}
 
-	extern "C" void wntgd_StopRecordVoice()
+	void StopEncodeWorker(VoiceRecorder* recorder)
 	{
+		if (recorder->useSharedWorker)
+		{
+			RemoveSharedWorkerRecorder(recorder);
+		}
+		else
+		{
+			recorder->workerRunning.store(false, std::memory_order_release);
+			nn::os::WaitThread(&recorder->workerThread);
+			nn::os::DestroyThread(&recorder->workerThread);
+		}
+
+		recorder->encodedPacketQueue.Finalize();
+		FreeEncodeWorkerBuffers(recorder);
+	}
+
+	void StopRecorder(VoiceRecorder* recorder)
+	{
+		if (recorder->useWorkerThread)
+		{
+			StopEncodeWorker(recorder);
+			recorder->useWorkerThread = false;
+		}
+
 		// encoder cleanup
-		FinalizeEncoder();
-		delete remainToEncodeBuffer;
+		FinalizeEncoder(recorder);
+		FreePacketBuffers(recorder);
+		FreeCaptureResampler(recorder);
+		recorder->remainToEncodeRing.Finalize();
+		Free(MemoryCategory_Encoder, recorder->remainToEncodeBuffer);
 
 		// audioIn cleanup
-		StopAudioIn(&audioIn);
-		CloseAudioIn(&audioIn);
-		allocator.Free(audioBuffer);
-		allocator.Finalize();
-		delete totalBuffer;
+		StopAudioIn(&recorder->audioIn);
+		CloseAudioIn(&recorder->audioIn);
+		nn::os::DestroySystemEvent(recorder->audioInEvent.GetBase());
+		for (int i = 0; i < recorder->audioInBufferCount; i++) Free(MemoryCategory_Encoder, recorder->audioBuffers[i]);
+		ReleaseArena();
+	}
+
+	extern "C" void wntgd_StopRecordVoice()
+	{
+		StopRecorder(&defaultRecorder);
+	}
+
+	extern "C" void wntgd_InitializeVoiceRecordParameter(VoiceRecordParameter* parameter)
+	{
+		parameter->useWorkerThread = false;
+		parameter->audioInBufferCount = BUFFER_COUNT;
+		parameter->audioInBufferLengthMilis = BUFFER_LENGTH_MILIS;
+		parameter->useRedundancy = false;
+		parameter->useVoiceActivityDetection = false;
+		parameter->useDtx = false;
+		parameter->voiceActivityThresholdDb = VOICE_ACTIVITY_THRESHOLD_DB;
+		parameter->voiceActivityMinimumLevelDb = VOICE_ACTIVITY_MINIMUM_LEVEL_DB;
+		parameter->voiceActivityHangoverMilis = VOICE_ACTIVITY_HANGOVER_MILIS;
+		parameter->bitRate = ENCODER_BIT_RATE;
+		parameter->useAdaptiveBitRate = false;
+		parameter->minBitRate = MIN_ENCODER_BIT_RATE;
+		parameter->maxBitRate = MAX_ENCODER_BIT_RATE;
+		parameter->frameDurationMicroSeconds = ENCODER_FRAME_DURATION;
+		parameter->codingMode = OpusCodingMode_Auto;
+		parameter->encodeSampleRate = 0;
+		parameter->useImmediateFlush = false;
+		parameter->frameCallback = nullptr;
+		parameter->frameCallbackUserData = nullptr;
+		parameter->audioInName = nullptr;
+		parameter->useSharedWorker = false;
+		parameter->preRollMilis = 0;
+		parameter->startPaused = false;
+		parameter->framesPerPacket = 1;
+		parameter->useDownmix = false;
+		parameter->useDcRemoval = true;
+		parameter->inputGainDb = 0.0f;
+		parameter->useNoiseSuppression = false;
+		parameter->noiseSuppressionDb = NOISE_SUPPRESSION_DB;
+		parameter->useAutomaticGainControl = false;
+		parameter->automaticGainControlTargetDb = AGC_TARGET_LEVEL_DB;
+		parameter->preprocessBudgetMicroSeconds = PREPROCESS_BUDGET_MICROSECONDS;
 	}
 
 	extern "C" bool wntgd_StartRecordVoice()
 	{
+		VoiceRecordParameter parameter;
+		wntgd_InitializeVoiceRecordParameter(&parameter);
+		return wntgd_StartRecordVoiceWithParameter(&parameter);
+	}
+
+	bool StartRecorder(VoiceRecorder* recorder, const VoiceRecordParameter* parameter)
+	{
+		if (parameter->audioInBufferCount < 2 || parameter->audioInBufferCount > MAX_BUFFER_COUNT) return false;
+		if (parameter->audioInBufferLengthMilis <= 0 || 1000 % parameter->audioInBufferLengthMilis != 0) return false;
+		if (parameter->minBitRate < MIN_ENCODER_BIT_RATE || parameter->maxBitRate > MAX_ENCODER_BIT_RATE) return false;
+		if (parameter->minBitRate > parameter->maxBitRate) return false;
+		if (parameter->bitRate < parameter->minBitRate || parameter->bitRate > parameter->maxBitRate) return false;
+		if (!IsValidEncoderSetting(parameter->frameDurationMicroSeconds, parameter->codingMode)) return false;
+		if (parameter->encodeSampleRate != 0 && !IsValidEncodeSampleRate(parameter->encodeSampleRate)) return false;
+		if (parameter->useImmediateFlush && (!parameter->useWorkerThread || !parameter->frameCallback)) return false;
+		if (parameter->useSharedWorker && !parameter->useWorkerThread) return false;
+		if (parameter->preRollMilis < 0 || parameter->preRollMilis > MAX_PRE_ROLL_MILIS) return false;
+		if (parameter->framesPerPacket < 1 || parameter->framesPerPacket > MaxVoiceBundlePacketCount) return false;
+		if (!(std::fabs(parameter->inputGainDb) <= MAX_INPUT_GAIN_DB)) return false;
+		if (!(parameter->noiseSuppressionDb >= 0.0f && parameter->noiseSuppressionDb <= MAX_NOISE_SUPPRESSION_DB)) return false;
+		if (!(parameter->automaticGainControlTargetDb >= MIN_AGC_TARGET_LEVEL_DB && parameter->automaticGainControlTargetDb <= 0.0f)) return false;
+		if (parameter->preprocessBudgetMicroSeconds < 0) return false;
+		recorder->audioInBufferCount = parameter->audioInBufferCount;
+		recorder->audioInBufferLengthMilis = parameter->audioInBufferLengthMilis;
+		recorder->useRedundancy = parameter->useRedundancy;
+		recorder->useVoiceActivityDetection = parameter->useVoiceActivityDetection || parameter->useDtx;
+		recorder->useDtx = parameter->useDtx;
+		recorder->voiceActivityThresholdDb = parameter->voiceActivityThresholdDb;
+		recorder->voiceActivityMinimumLevelDb = parameter->voiceActivityMinimumLevelDb;
+		recorder->voiceActivityHangoverMilis = parameter->voiceActivityHangoverMilis;
+		recorder->initialBitRate = parameter->bitRate;
+		recorder->useAdaptiveBitRate = parameter->useAdaptiveBitRate;
+		recorder->bitRateController.Initialize(parameter->bitRate, parameter->minBitRate, parameter->maxBitRate);
+		recorder->initialFrameDuration = parameter->frameDurationMicroSeconds;
+		recorder->initialCodingMode = parameter->codingMode;
+		recorder->requestedEncodeSampleRate = parameter->encodeSampleRate;
+		recorder->useImmediateFlush = parameter->useImmediateFlush;
+		recorder->frameCallback = parameter->frameCallback;
+		recorder->frameCallbackUserData = parameter->frameCallbackUserData;
+		recorder->preRollMilis = parameter->preRollMilis;
+		recorder->targetFramesPerPacket.store(parameter->framesPerPacket, std::memory_order_relaxed);
+		recorder->targetPaused.store(parameter->startPaused, std::memory_order_relaxed);
+		recorder->paused = false;
+		recorder->pausedSampleCount = 0;
+		recorder->useDownmix = parameter->useDownmix;
+		recorder->useDcRemoval = parameter->useDcRemoval;
+		recorder->dcOffset = 0.0f;
+		recorder->inputGain.store(std::pow(10.0f, parameter->inputGainDb / 20.0f), std::memory_order_relaxed);
+		recorder->inputLevels.store(0, std::memory_order_relaxed);
+		recorder->inputPeak = 0.0f;
+		recorder->useNoiseSuppression.store(parameter->useNoiseSuppression, std::memory_order_relaxed);
+		recorder->useAutomaticGainControl.store(parameter->useAutomaticGainControl, std::memory_order_relaxed);
+		recorder->noiseSuppressionDb = parameter->noiseSuppressionDb;
+		recorder->automaticGainControlTargetDb = parameter->automaticGainControlTargetDb;
+		recorder->preprocessBudgetMicroSeconds = parameter->preprocessBudgetMicroSeconds;
+
 		AudioInParameter param;
 		InitializeAudioInParameter(&param);
 
-		if (!OpenDefaultAudioIn(&audioIn, param).IsSuccess()) return false;
+		nn::Result openResult = parameter->audioInName
+			? OpenAudioIn(&recorder->audioIn, &recorder->audioInEvent, parameter->audioInName, param)
+			: OpenDefaultAudioIn(&recorder->audioIn, &recorder->audioInEvent, param);
+		if (!openResult.IsSuccess()) return false;
+
+		if (!StartAudioIn(&recorder->audioIn).IsSuccess())
+		{
+			CloseAudioIn(&recorder->audioIn);
+			nn::os::DestroySystemEvent(recorder->audioInEvent.GetBase());
+			return false;
+		}
 
-		if (!StartAudioIn(&audioIn).IsSuccess())
+		if (!AcquireArena())
 		{
-			CloseAudioIn(&audioIn);
+			StopAudioIn(&recorder->audioIn);
+			CloseAudioIn(&recorder->audioIn);
+			nn::os::DestroySystemEvent(recorder->audioInEvent.GetBase());
 			return false;
 		}
 
-		if (!AllocateBuffers())
+		if (!AllocateBuffers(recorder))
 		{
-			StopAudioIn(&audioIn);
-			CloseAudioIn(&audioIn);
+			ReleaseArena();
+			StopAudioIn(&recorder->audioIn);
+			CloseAudioIn(&recorder->audioIn);
+			nn::os::DestroySystemEvent(recorder->audioInEvent.GetBase());
 			return false;
 		}
 
-		if (!InitializeEncoder())
+		if (!InitializeEncoder(recorder) || !AllocatePacketBuffers(recorder))
 		{
-			wntgd_StopRecordVoice();
+			StopRecorder(recorder);
 			return false;
 		}
 
-		AppendAudioInBuffer(&audioIn, &audioInBuffer);
+		recorder->audioInStarvedCount.store(0, std::memory_order_relaxed);
+		recorder->capturedSampleCount.store(0, std::memory_order_relaxed);
+		recorder->captureOverrunSampleCount.store(0, std::memory_order_relaxed);
+		recorder->encodedFrameCount.store(0, std::memory_order_relaxed);
+		recorder->encodeErrorCount.store(0, std::memory_order_relaxed);
+		recorder->droppedFrameCount.store(0, std::memory_order_relaxed);
+		recorder->sentByteCount.store(0, std::memory_order_relaxed);
+		recorder->captureToEncodeHistogram.Reset();
+		recorder->encodeTimeHistogram.Reset();
+		recorder->preprocessBypassedBlockCount.store(0, std::memory_order_relaxed);
+		recorder->preprocessTimeHistogram.Reset();
+		recorder->lastCaptureTick = nn::os::GetSystemTick();
+		for (int i = 0; i < recorder->audioInBufferCount; i++) AppendAudioInBuffer(&recorder->audioIn, &recorder->audioInBuffers[i]);
+
+		if (parameter->useWorkerThread)
+		{
+			recorder->useSharedWorker = parameter->useSharedWorker;
+			if (!StartEncodeWorker(recorder))
+			{
+				StopRecorder(recorder);
+				return false;
+			}
+			recorder->useWorkerThread = true;
+		}
+		return true;
+	}
+
+	extern "C" bool wntgd_StartRecordVoiceWithParameter(const VoiceRecordParameter* parameter)
+	{
+		return StartRecorder(&defaultRecorder, parameter);
+	}
+
+	extern "C" VoiceRecorder* wntgd_CreateVoiceRecorder(const VoiceRecordParameter* parameter)
+	{
+		// held until wntgd_DestroyVoiceRecorder, for the recorder itself
+		if (!AcquireArena()) return nullptr;
+		void* storage = Allocate(MemoryCategory_Encoder, sizeof(VoiceRecorder));
+		VoiceRecorder* recorder = storage ? new (storage) VoiceRecorder() : nullptr;
+		if (!recorder || !StartRecorder(recorder, parameter))
+		{
+			if (recorder) recorder->~VoiceRecorder();
+			Free(MemoryCategory_Encoder, storage);
+			ReleaseArena();
+			return nullptr;
+		}
+		return recorder;
+	}
+
+	extern "C" void wntgd_DestroyVoiceRecorder(VoiceRecorder* recorder)
+	{
+		if (!recorder) return;
+		StopRecorder(recorder);
+		recorder->~VoiceRecorder();
+		Free(MemoryCategory_Encoder, recorder);
+		ReleaseArena();
+	}
+
+	extern "C" uint64_t wntgd_GetVoiceRecorderMemorySize(const VoiceRecordParameter* parameter)
+	{
+		return GetEncoderMemorySize(parameter, DEFAULT_CAPTURE_SAMPLE_RATE, DEFAULT_CAPTURE_CHANNEL_COUNT) + GetAllocationSize(sizeof(VoiceRecorder));
+	}
+
+	extern "C" bool wntgd_GetAudioInName(int index, char* name, int capacity)
+	{
+		AudioInInfo audioInInfos[MAX_AUDIO_IN_COUNT];
+		int audioInCount = ListAudioIns(audioInInfos, MAX_AUDIO_IN_COUNT);
+		if (index < 0 || index >= audioInCount || capacity <= 0) return false;
+		std::strncpy(name, audioInInfos[index].name, capacity - 1);
+		name[capacity - 1] = '\0';
 		return true;
 	}
 
+	extern "C" bool wntgd_GetRecorderVoiceBufferInto(VoiceRecorder* recorder, char* dest, int capacity, int* written)
+	{
+		*written = 0;
+		// capacity is taken as a size_t below, a negative one would lift every limit
+		if (dest == nullptr || capacity < 0) return false;
+
+		size_t writtenSize = 0;
+		bool result = true;
+		if (recorder->useWorkerThread)
+		{
+			TakeEncodedPackets(recorder, dest, capacity, &writtenSize);
+		}
+		else
+		{
+			GetMicrophoneInput(recorder);
+			if (ApplyPauseState(recorder)) result = Encode(recorder, dest, capacity, &writtenSize);
+			else if (recorder->bundleCount > 0 && static_cast<size_t>(capacity) >= MAX_FRAME_SIZE) FlushBundle(recorder, dest, &writtenSize);
+		}
+
+		recorder->sentByteCount.fetch_add(writtenSize, std::memory_order_relaxed);
+		*written = static_cast<int>(writtenSize);
+		return result && writtenSize > 0;
+	}
+
+	extern "C" bool wntgd_GetVoiceBufferInto(char* dest, int capacity, int* written)
+	{
+		return wntgd_GetRecorderVoiceBufferInto(&defaultRecorder, dest, capacity, written);
+	}
+
+	extern "C" bool wntgd_GetRecorderVoiceBuffer(VoiceRecorder* recorder, intptr_t * handler, char** bufferOut, int* count)
+	{
+		*handler = 0;
+		*bufferOut = nullptr;
+		*count = 0;
+
+		// Every handle still held by the caller: leave the audio in the rings until one is released.
+		PacketBuffer* packetBuffer = AcquirePacketBuffer(recorder);
+		if (!packetBuffer) return false;
+
+		int written = 0;
+		bool result = wntgd_GetRecorderVoiceBufferInto(recorder, packetBuffer->data, PACKET_BUFFER_SIZE, &written);
+		if (written == 0)
+		{
+			ReleasePacketBuffer(packetBuffer);
+			return false;
+		}
+
+		*handler = reinterpret_cast<intptr_t>(packetBuffer);
+		*bufferOut = packetBuffer->data;
+		*count = written;
+		return result;
+	}
+
 	extern "C" bool wntgd_GetVoiceBuffer(intptr_t * handler, char** bufferOut, int* count)
 	{
-		GetMicrophoneInput();
-		return Encode(handler, bufferOut, count);
+		return wntgd_GetRecorderVoiceBuffer(&defaultRecorder, handler, bufferOut, count);
+	}
+
+	extern "C" void wntgd_GetRecorderCaptureStatus(VoiceRecorder* recorder, VoiceCaptureStatus* status)
+	{
+		status->audioInBufferCount = recorder->audioInBufferCount;
+		status->audioInBufferLengthMilis = recorder->audioInBufferLengthMilis;
+		status->captureLatencyMicroSeconds = recorder->audioInBufferLengthMilis * 1000;
+		status->starvedCount = recorder->audioInStarvedCount.load(std::memory_order_relaxed);
+		status->capturedSampleCount = recorder->capturedSampleCount.load(std::memory_order_relaxed);
+		status->sampleRate = recorder->sampleRate;
+		status->encodeSampleRate = recorder->encodeSampleRate;
+		status->isSpeaking = recorder->isSpeaking.load(std::memory_order_relaxed);
+		status->dtxSkippedFrameCount = recorder->dtxSkippedFrameCount.load(std::memory_order_relaxed);
+		status->bitRate = recorder->currentBitRate.load(std::memory_order_relaxed);
+	}
+
+	extern "C" void wntgd_GetVoiceCaptureStatus(VoiceCaptureStatus* status)
+	{
+		wntgd_GetRecorderCaptureStatus(&defaultRecorder, status);
+	}
+
+	extern "C" void wntgd_GetRecorderStats(VoiceRecorder* recorder, VoiceStats* stats)
+	{
+		stats->capturedSampleCount = recorder->capturedSampleCount.load(std::memory_order_relaxed);
+		stats->captureOverrunSampleCount = recorder->captureOverrunSampleCount.load(std::memory_order_relaxed);
+		stats->audioInStarvedCount = recorder->audioInStarvedCount.load(std::memory_order_relaxed);
+		stats->encodedFrameCount = recorder->encodedFrameCount.load(std::memory_order_relaxed);
+		stats->encodeErrorCount = recorder->encodeErrorCount.load(std::memory_order_relaxed);
+		stats->dtxSkippedFrameCount = recorder->dtxSkippedFrameCount.load(std::memory_order_relaxed);
+		stats->droppedFrameCount = recorder->droppedFrameCount.load(std::memory_order_relaxed);
+		stats->sentByteCount = recorder->sentByteCount.load(std::memory_order_relaxed);
+		recorder->captureToEncodeHistogram.Read(&stats->captureToEncodeLatency);
+		recorder->encodeTimeHistogram.Read(&stats->encodeTime);
+		stats->preprocessBypassedBlockCount = recorder->preprocessBypassedBlockCount.load(std::memory_order_relaxed);
+		recorder->preprocessTimeHistogram.Read(&stats->preprocessTime);
+	}
+
+	extern "C" void wntgd_GetVoiceStats(VoiceStats* stats)
+	{
+		wntgd_GetRecorderStats(&defaultRecorder, stats);
+	}
+
+	extern "C" bool wntgd_IsRecorderSpeaking(VoiceRecorder* recorder)
+	{
+		return recorder->isSpeaking.load(std::memory_order_relaxed);
+	}
+
+	extern "C" bool wntgd_IsSpeaking()
+	{
+		return wntgd_IsRecorderSpeaking(&defaultRecorder);
+	}
+
+	extern "C" void wntgd_PauseRecorder(VoiceRecorder* recorder)
+	{
+		recorder->targetPaused.store(true, std::memory_order_release);
+	}
+
+	extern "C" void wntgd_PauseRecordVoice()
+	{
+		wntgd_PauseRecorder(&defaultRecorder);
+	}
+
+	extern "C" void wntgd_ResumeRecorder(VoiceRecorder* recorder)
+	{
+		recorder->targetPaused.store(false, std::memory_order_release);
+		// wake the worker, so the pre-roll is encoded now rather than with the next AudioIn buffer
+		if (recorder->useWorkerThread) recorder->audioInEvent.Signal();
+	}
+
+	extern "C" void wntgd_ResumeRecordVoice()
+	{
+		wntgd_ResumeRecorder(&defaultRecorder);
+	}
+
+	extern "C" int wntgd_ReportRecorderNetworkFeedback(VoiceRecorder* recorder, float lossRate, int roundTripMilis, int jitterMilis)
+	{
+		if (!recorder->useAdaptiveBitRate) return recorder->targetBitRate.load(std::memory_order_relaxed);
+
+		int64_t time = nn::os::ConvertToTimeSpan(nn::os::GetSystemTick()).GetMicroSeconds();
+		recorder->bitRateControllerMutex.Lock();
+		int bitRate = recorder->bitRateController.Update(lossRate, roundTripMilis, jitterMilis, time);
+		recorder->bitRateControllerMutex.Unlock();
+
+		recorder->targetBitRate.store(bitRate, std::memory_order_relaxed);
+		return bitRate;
+	}
+
+	extern "C" int wntgd_ReportNetworkFeedback(float lossRate, int roundTripMilis, int jitterMilis)
+	{
+		return wntgd_ReportRecorderNetworkFeedback(&defaultRecorder, lossRate, roundTripMilis, jitterMilis);
+	}
+
+	extern "C" bool wntgd_SetRecorderFrameDuration(VoiceRecorder* recorder, int frameDurationMicroSeconds)
+	{
+		if (frameDurationMicroSeconds < 0) return false;
+		return UpdateEncoderSetting(recorder, frameDurationMicroSeconds, -1);
+	}
+
+	extern "C" bool wntgd_SetEncoderFrameDuration(int frameDurationMicroSeconds)
+	{
+		return wntgd_SetRecorderFrameDuration(&defaultRecorder, frameDurationMicroSeconds);
+	}
+
+	extern "C" bool wntgd_SetRecorderCodingMode(VoiceRecorder* recorder, OpusCodingMode mode)
+	{
+		if (static_cast<int>(mode) < 0) return false;
+		return UpdateEncoderSetting(recorder, -1, mode);
+	}
+
+	extern "C" bool wntgd_SetEncoderCodingMode(OpusCodingMode mode)
+	{
+		return wntgd_SetRecorderCodingMode(&defaultRecorder, mode);
+	}
+
+	extern "C" bool wntgd_SetRecorderFramesPerPacket(VoiceRecorder* recorder, int frameCount)
+	{
+		if (frameCount < 1 || frameCount > MaxVoiceBundlePacketCount) return false;
+		recorder->targetFramesPerPacket.store(frameCount, std::memory_order_relaxed);
+		return true;
+	}
+
+	extern "C" bool wntgd_SetEncoderFramesPerPacket(int frameCount)
+	{
+		return wntgd_SetRecorderFramesPerPacket(&defaultRecorder, frameCount);
+	}
+
+	extern "C" bool wntgd_SetRecorderInputGain(VoiceRecorder* recorder, float gainDb)
+	{
+		if (!(std::fabs(gainDb) <= MAX_INPUT_GAIN_DB)) return false;
+		recorder->inputGain.store(std::pow(10.0f, gainDb / 20.0f), std::memory_order_relaxed);
+		return true;
+	}
+
+	extern "C" bool wntgd_SetInputGain(float gainDb)
+	{
+		return wntgd_SetRecorderInputGain(&defaultRecorder, gainDb);
+	}
+
+	extern "C" void wntgd_GetRecorderInputLevels(VoiceRecorder* recorder, VoiceInputLevels* levels)
+	{
+		uint64_t packed = recorder->inputLevels.load(std::memory_order_relaxed);
+		std::memcpy(levels, &packed, sizeof(packed));
+	}
+
+	extern "C" void wntgd_GetInputLevels(VoiceInputLevels* levels)
+	{
+		wntgd_GetRecorderInputLevels(&defaultRecorder, levels);
+	}
+
+	extern "C" const VoiceInputLevels* wntgd_GetRecorderInputLevelsAddress(VoiceRecorder* recorder)
+	{
+		static_assert(sizeof(std::atomic<uint64_t>) == sizeof(VoiceInputLevels), "levels are read in place");
+		return reinterpret_cast<const VoiceInputLevels*>(&recorder->inputLevels);
+	}
+
+	extern "C" const VoiceInputLevels* wntgd_GetInputLevelsAddress()
+	{
+		return wntgd_GetRecorderInputLevelsAddress(&defaultRecorder);
+	}
+
+	extern "C" void wntgd_SetRecorderPreprocessing(VoiceRecorder* recorder, bool useNoiseSuppression, bool useAutomaticGainControl)
+	{
+		recorder->useNoiseSuppression.store(useNoiseSuppression, std::memory_order_relaxed);
+		recorder->useAutomaticGainControl.store(useAutomaticGainControl, std::memory_order_relaxed);
+	}
+
+	extern "C" void wntgd_SetPreprocessing(bool useNoiseSuppression, bool useAutomaticGainControl)
+	{
+		wntgd_SetRecorderPreprocessing(&defaultRecorder, useNoiseSuppression, useAutomaticGainControl);
 	}
 
 	extern "C" bool wntgd_ReleaseVoiceBuffer(intptr_t * handler)
 	{
-		auto outVector = reinterpret_cast<std::vector<char>*>(handler);
-		delete outVector;
+		if (!handler) return true;
+		ReleasePacketBuffer(reinterpret_cast<PacketBuffer*>(handler));
 		return true;
 	}
 }
@@ -2,27 +2,228 @@
 #include <stdint.h>
 #include <vector>
 #include <cstdlib>
+#include <cstring>
+#include <cmath>
 #include <nn/audio.h>
 #include <nn/codec.h>
 #include <nn/mem.h>
 #include <nn/os.h>
 #include <nn/nn_Log.h>
+#include "SwitchVoiceChatFraming.h"
+#include "SwitchVoiceChatMemory.h"
+#include "SwitchVoiceChatPreprocessor.h"
+#include "SwitchVoiceChatRateController.h"
+#include "SwitchVoiceChatResampler.h"
+#include "SwitchVoiceChatRingBuffer.h"
+#include "SwitchVoiceChatSimd.h"
+#include "SwitchVoiceChatStats.h"
 
 
 
 namespace SwitchVoiceChatNativeCode {
-	bool AllocateBuffers();
-	bool InitializeEncoder();
-	void FinalizeEncoder();
-	inline bool IsEmptyRemainToEncodeBuffer();
-	inline size_t SizeRemainToEncodeBuffer();
-	void PushRemainToEncodeBuffer(int16_t value);
-	void PopRemainToEncodeBuffer(size_t quantity);
-	void CopyRemainToEncodeBuffer(int16_t* dest, size_t count);
-	void GetMicrophoneInput();
-	bool Encode(intptr_t* handler, char** bufferOut, int* count);
+	// Receives one encoded frame (header included) in immediate flush mode, on the worker thread.
+	typedef void (*VoiceFrameCallback)(const char* frame, int size, void* userData);
+
+	struct VoiceRecordParameter
+	{
+		bool useWorkerThread; // capture and encode on a native thread woken by the AudioIn buffer event
+		int audioInBufferCount; // AudioInBuffers rotating through the driver (2 to 16)
+		int audioInBufferLengthMilis; // duration of each AudioInBuffer, e.g. 5, 10 or 20 (must divide 1000)
+		bool useRedundancy; // each frame also carries the previous frame's packet (VoiceFrameFlag_Redundant), doubling the bitrate
+		bool useVoiceActivityDetection; // classify each frame as speech or silence, see wntgd_IsSpeaking
+		bool useDtx; // silent frames are neither encoded nor sent (implies useVoiceActivityDetection)
+		float voiceActivityThresholdDb; // speech is at least this far above the tracked noise floor
+		float voiceActivityMinimumLevelDb; // frames quieter than this (dBFS) are always silence
+		int voiceActivityHangoverMilis; // speech is held this long after the last voiced frame
+		int bitRate; // initial encoder bitrate in bits per second, from minBitRate to maxBitRate
+		bool useAdaptiveBitRate; // wntgd_ReportNetworkFeedback moves the bitrate between minBitRate and maxBitRate
+		int minBitRate; // at least 6000 (default)
+		int maxBitRate; // at most 64000 (default)
+		int frameDurationMicroSeconds; // 5000, 10000 or 20000, see wntgd_SetEncoderFrameDuration
+		nn::codec::OpusCodingMode codingMode; // SILK cannot encode 5 ms frames
+		// Rate the encoder runs at: 8000, 12000, 16000, 24000 or 48000, or 0 (default) for the capture
+		// rate, or 48000 if the encoder does not accept it. Capture is resampled when the rates differ.
+		// 16000 or 24000 with SILK encodes wideband speech for much less CPU.
+		int encodeSampleRate;
+		bool useImmediateFlush; // the worker thread passes each frame to frameCallback as soon as it is encoded (needs useWorkerThread)
+		VoiceFrameCallback frameCallback;
+		void* frameCallbackUserData;
+		const char* audioInName; // AudioIn device to open, see wntgd_GetAudioInName; nullptr (default) for the default device
+		bool useSharedWorker; // one worker thread serves every recorder started with this, instead of a thread each (needs useWorkerThread)
+		int preRollMilis; // audio captured just before wntgd_ResumeRecordVoice that is sent first (0 to 500)
+		bool startPaused; // start like after wntgd_PauseRecordVoice, e.g. for push-to-talk
+		int framesPerPacket; // codec frames bundled into one frame (1 to 6), see wntgd_SetEncoderFramesPerPacket
+		bool useDownmix; // encode the mean of every capture channel instead of the first one
+		bool useDcRemoval; // subtract the capture's DC offset, tracked over about a second (default true)
+		float inputGainDb; // capture gain from -30 to 30 dB, saturating, see wntgd_SetInputGain
+		// Preprocessing before the encoder and the voice activity detection, see wntgd_SetPreprocessing.
+		bool useNoiseSuppression;
+		float noiseSuppressionDb; // most the background is attenuated, 0 to 40 (default 15)
+		bool useAutomaticGainControl;
+		float automaticGainControlTargetDb; // speech level (dBFS rms) the AGC aims for, -40 to 0 (default -20)
+		int preprocessBudgetMicroSeconds; // noise suppression CPU per 10 ms block before it is bypassed, 0 for no limit
+	};
+
+	// Input level meter, after DC removal and input gain, linear with 1 at full scale. Updated with
+	// every captured AudioIn buffer, paused or not. peak falls back at 20 dB per second; rms is over
+	// the last buffers captured.
+	struct VoiceInputLevels
+	{
+		float peak;
+		float rms;
+	};
+
+	struct VoiceCaptureStatus
+	{
+		int audioInBufferCount;
+		int audioInBufferLengthMilis;
+		int captureLatencyMicroSeconds; // a sample reaches the encoder at the earliest one buffer after it was recorded
+		uint32_t starvedCount; // times the driver was left with no buffer, i.e. possible capture gaps
+		uint64_t capturedSampleCount; // mono samples captured, at sampleRate
+		int sampleRate; // capture device rate
+		int encodeSampleRate;
+		bool isSpeaking;
+		uint32_t dtxSkippedFrameCount; // silent frames not encoded because of useDtx
+		int bitRate; // encoder bitrate currently in use
+	};
+
+	// Cumulative since wntgd_StartRecordVoice, see wntgd_GetVoiceStats.
+	struct VoiceStats
+	{
+		uint64_t capturedSampleCount; // mono samples captured, at the capture rate
+		uint64_t captureOverrunSampleCount; // samples dropped because the encoder fell behind and the capture ring was full
+		uint32_t audioInStarvedCount; // times the driver was left with no buffer
+		uint32_t encodedFrameCount;
+		uint32_t encodeErrorCount; // frames the encoder failed on (sent as lost)
+		uint32_t dtxSkippedFrameCount;
+		uint32_t droppedFrameCount; // encoded frames the worker dropped because the game did not collect them in time
+		uint64_t sentByteCount; // framed bytes handed to the game
+		SwitchVoiceChatStats::LatencyHistogramData captureToEncodeLatency; // driver handing over a sample to its frame being encoded
+		SwitchVoiceChatStats::LatencyHistogramData encodeTime; // encoder time per frame
+		uint32_t preprocessBypassedBlockCount; // 10 ms blocks sent without noise suppression to stay within the budget
+		SwitchVoiceChatStats::LatencyHistogramData preprocessTime; // preprocessing time per 10 ms block
+	};
+
+	struct VoiceRecorder;
+	int SelectEncodeSampleRate(int requestedRate, int captureRate);
+	size_t GetRemainToEncodeCapacity(size_t bufferSampleCount, int bufferCount, int rate, int preRollMilis);
+	size_t GetAudioInBufferSize(size_t dataSize);
+	// Memory the encoder takes from the arena (SwitchVoiceChatMemory.h), for the budget.
+	size_t GetEncoderMemorySize(const VoiceRecordParameter* parameter, int captureSampleRate, int captureChannelCount);
+	bool AllocateBuffers(VoiceRecorder* recorder);
+	void FreeCaptureResampler(VoiceRecorder* recorder);
+	bool AllocatePacketBuffers(VoiceRecorder* recorder);
+	void FreePacketBuffers(VoiceRecorder* recorder);
+	bool InitializeEncoder(VoiceRecorder* recorder);
+	void FinalizeEncoder(VoiceRecorder* recorder);
+	void UpdateInputLevels(VoiceRecorder* recorder, const SwitchVoiceChatSimd::CaptureLevels& levels, size_t sampleCount);
+	bool GetMicrophoneInput(VoiceRecorder* recorder);
+	bool DetectVoiceActivity(VoiceRecorder* recorder, const int16_t* samples, int sampleCount);
+	bool IsValidEncodeSampleRate(int rate);
+	bool IsValidEncoderSetting(int frameDuration, int mode);
+	uint64_t PackEncoderSetting(int frameDuration, int mode);
+	bool UpdateEncoderSetting(VoiceRecorder* recorder, int frameDuration, int mode);
+	void ResetEncoderState(VoiceRecorder* recorder);
+	bool ApplyPauseState(VoiceRecorder* recorder);
+	void ApplyEncoderSettings(VoiceRecorder* recorder);
+	void PreprocessFrame(VoiceRecorder* recorder);
+	size_t AddRedundancy(VoiceRecorder* recorder, char* payload, size_t payloadSize, bool isBundle, uint8_t* flags);
+	void FlushBundle(VoiceRecorder* recorder, char* out, size_t* encodedSize);
+	bool EncodeFrame(VoiceRecorder* recorder, char* out, size_t outSize, size_t* encodedSize);
+	bool Encode(VoiceRecorder* recorder, char* dest, size_t capacity, size_t* written);
+	void TakeEncodedPackets(VoiceRecorder* recorder, char* dest, size_t capacity, size_t* written);
+	void DeliverEncodedFrame(VoiceRecorder* recorder, size_t encodedSize);
+	void RunEncodeWorker(VoiceRecorder* recorder);
+	void EncodeWorkerThread(void* argument);
+	void SharedWorkerThread(void* argument);
+	bool AddSharedWorkerRecorder(VoiceRecorder* recorder);
+	void RemoveSharedWorkerRecorder(VoiceRecorder* recorder);
+	void FreeEncodeWorkerBuffers(VoiceRecorder* recorder);
+	bool StartEncodeWorker(VoiceRecorder* recorder);
+	void StopEncodeWorker(VoiceRecorder* recorder);
+	bool StartRecorder(VoiceRecorder* recorder, const VoiceRecordParameter* parameter);
+	void StopRecorder(VoiceRecorder* recorder);
 	extern "C" void wntgd_StopRecordVoice();
+	extern "C" void wntgd_InitializeVoiceRecordParameter(VoiceRecordParameter* parameter);
 	extern "C" bool wntgd_StartRecordVoice();
+	extern "C" bool wntgd_StartRecordVoiceWithParameter(const VoiceRecordParameter* parameter);
 	extern "C" bool wntgd_GetVoiceBuffer(intptr_t * handler, char** bufferOut, int* count);
+	// Same frames as wntgd_GetVoiceBuffer, written to a caller-owned buffer; nothing to release.
+	// capacity should hold at least one VoiceFrameHeaderSize + 2 * OpusPacketSizeMaximum frame.
+	// Returns false with nothing written for a null dest or a negative capacity.
+	extern "C" bool wntgd_GetVoiceBufferInto(char* dest, int capacity, int* written);
 	extern "C" bool wntgd_ReleaseVoiceBuffer(intptr_t * handler);
+	extern "C" void wntgd_GetVoiceCaptureStatus(VoiceCaptureStatus* status);
+	// Pipeline counters and latency histograms, cheap enough to poll for telemetry.
+	extern "C" void wntgd_GetVoiceStats(VoiceStats* stats);
+	// Whether the last captured frame was speech (always true without voice activity detection).
+	extern "C" bool wntgd_IsSpeaking();
+	// Receiver feedback for the adaptive bitrate: lossRate from 0 to 1, round-trip time and jitter in
+	// milliseconds, e.g. from the remote wntgd_GetSpeakerPlayoutStatus. Call it whenever a report arrives;
+	// the new bitrate (returned, in bits per second) takes effect at the next frame.
+	extern "C" int wntgd_ReportNetworkFeedback(float lossRate, int roundTripMilis, int jitterMilis);
+	// Switch the frame duration (5000, 10000 or 20000 us) or the coding mode while recording; the
+	// change applies from the next frame. E.g. 5 ms CELT for the lowest latency, 20 ms for fewer
+	// packets and less CPU (pair short frames with short audioInBufferLengthMilis, or capture still
+	// delivers them in bursts). Returns false for SILK with 5 ms frames.
+	extern "C" bool wntgd_SetEncoderFrameDuration(int frameDurationMicroSeconds);
+	extern "C" bool wntgd_SetEncoderCodingMode(nn::codec::OpusCodingMode mode);
+	// Bundles the packets of frameCount consecutive codec frames (1 to 6) into one frame
+	// (VoiceFrameFlag_Bundle), saving the frame headers of all but one, the size half of every codec
+	// packet header (the final range is kept for the decoder to check), and the per-packet network
+	// overhead when each frame is sent on its own. The cost is up to frameCount - 1 frames of added
+	// latency. Bundles stop short at 60 ms or 256 bytes, and at
+	// pauses (DTX, wntgd_PauseRecordVoice); a packet too big for any bundle is sent as a plain frame.
+	// Applies from the next frame; 1 (default) turns it off.
+	extern "C" bool wntgd_SetEncoderFramesPerPacket(int frameCount);
+	// Push-to-talk without stopping: while paused nothing is encoded or sent, but the AudioIn device,
+	// the buffers and the encoder stay allocated and capture keeps running into the ring, which holds
+	// the last preRollMilis. Resume only resets the encoder state and starts a new talk spurt with the
+	// pre-roll, so the first frame is ready within milliseconds. Without useWorkerThread, keep calling
+	// wntgd_GetVoiceBuffer while paused (it returns nothing) to keep the pre-roll fresh.
+	extern "C" void wntgd_PauseRecordVoice();
+	extern "C" void wntgd_ResumeRecordVoice();
+	// Input gain in dB (-30 to 30), applied from the next captured buffer.
+	extern "C" bool wntgd_SetInputGain(float gainDb);
+	// Lock-free mic meter: the levels are computed by the capture pass itself and published with one
+	// atomic store. For a meter polled every frame without a call, take the address once (valid as
+	// long as the recorder exists) and read the 8 bytes at once, e.g. Interlocked.Read on a long.
+	extern "C" void wntgd_GetInputLevels(VoiceInputLevels* levels);
+	extern "C" const VoiceInputLevels* wntgd_GetInputLevelsAddress();
+	// Noise suppression and automatic gain control between the capture ring and the encoder, on 10 ms
+	// blocks (SwitchVoiceChatPreprocessor.h). A steady background is attenuated, so the encoder spends
+	// fewer bits on it and the voice activity detection and DTX see the pauses in speech; the AGC
+	// brings quiet and loud talkers to the same level. Either stage adds 10 ms of latency. 5 ms frames
+	// are not preprocessed. The noise suppression is bypassed for half a second whenever its measured
+	// cost goes over VoiceRecordParameter::preprocessBudgetMicroSeconds per block, see VoiceStats.
+	// Applies from the next frame; switching from both stages off or to both off inserts or drops 10 ms.
+	extern "C" void wntgd_SetPreprocessing(bool useNoiseSuppression, bool useAutomaticGainControl);
+
+	// Recorders: independent capture and encode streams, e.g. one per local player with a headset in
+	// split-screen. The functions above drive a default recorder; these take the one returned by
+	// wntgd_CreateVoiceRecorder, which starts recording on parameter->audioInName right away.
+	// Recorders can be driven from different threads. Each takes wntgd_GetVoiceRecorderMemorySize from
+	// the arena, which the default budget does not include (see wntgd_SetMemoryBudget).
+	// Returns nullptr on failure.
+	extern "C" VoiceRecorder* wntgd_CreateVoiceRecorder(const VoiceRecordParameter* parameter);
+	// Release its wntgd_GetRecorderVoiceBuffer handles first.
+	extern "C" void wntgd_DestroyVoiceRecorder(VoiceRecorder* recorder);
+	extern "C" uint64_t wntgd_GetVoiceRecorderMemorySize(const VoiceRecordParameter* parameter);
+	// Name of the index-th AudioIn device for VoiceRecordParameter::audioInName; false past the last one.
+	extern "C" bool wntgd_GetAudioInName(int index, char* name, int capacity);
+	extern "C" bool wntgd_GetRecorderVoiceBuffer(VoiceRecorder* recorder, intptr_t * handler, char** bufferOut, int* count);
+	extern "C" bool wntgd_GetRecorderVoiceBufferInto(VoiceRecorder* recorder, char* dest, int capacity, int* written);
+	extern "C" void wntgd_GetRecorderCaptureStatus(VoiceRecorder* recorder, VoiceCaptureStatus* status);
+	extern "C" void wntgd_GetRecorderStats(VoiceRecorder* recorder, VoiceStats* stats);
+	extern "C" bool wntgd_IsRecorderSpeaking(VoiceRecorder* recorder);
+	extern "C" int wntgd_ReportRecorderNetworkFeedback(VoiceRecorder* recorder, float lossRate, int roundTripMilis, int jitterMilis);
+	extern "C" bool wntgd_SetRecorderFrameDuration(VoiceRecorder* recorder, int frameDurationMicroSeconds);
+	extern "C" bool wntgd_SetRecorderCodingMode(VoiceRecorder* recorder, nn::codec::OpusCodingMode mode);
+	extern "C" bool wntgd_SetRecorderFramesPerPacket(VoiceRecorder* recorder, int frameCount);
+	extern "C" void wntgd_PauseRecorder(VoiceRecorder* recorder);
+	extern "C" void wntgd_ResumeRecorder(VoiceRecorder* recorder);
+	extern "C" bool wntgd_SetRecorderInputGain(VoiceRecorder* recorder, float gainDb);
+	extern "C" void wntgd_GetRecorderInputLevels(VoiceRecorder* recorder, VoiceInputLevels* levels);
+	extern "C" const VoiceInputLevels* wntgd_GetRecorderInputLevelsAddress(VoiceRecorder* recorder);
+	extern "C" void wntgd_SetRecorderPreprocessing(VoiceRecorder* recorder, bool useNoiseSuppression, bool useAutomaticGainControl);
 }
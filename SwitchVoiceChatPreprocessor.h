@@ -0,0 +1,278 @@
+#pragma once
+#include <stdint.h>
+#include <cmath>
+#include <cstring>
+#include "SwitchVoiceChatSimd.h"
+
+namespace SwitchVoiceChatPreprocessor {
+	// Streaming noise suppressor and automatic gain control for mono int16 PCM at any encoder rate.
+	// The audio is cut into 10 ms blocks; each block is analysed together with the previous one through
+	// a square-root Hann window and an FFT, and every bin is attenuated by a Wiener gain from the
+	// decision-directed a priori SNR against a noise estimate. The noise estimate follows the smoothed
+	// spectrum down at once and up slowly, so it settles on the background during the pauses in speech.
+	// Overlap-add gives the audio back one block (10 ms) late, so the input comes in whole blocks.
+	// The work per block is fixed by the rate, whatever the input. The AGC then moves the gain
+	// towards a speech level, only during speech.
+	// Storage is provided by the caller.
+	class VoicePreprocessor
+	{
+	public:
+		static const int BlockMilis = 10;
+		static const int MaxFftSize = 1024; // 20 ms at 48 kHz, zero-padded
+
+		// Bytes of storage needed at sampleRate (8000 to 48000).
+		static size_t GetStorageSize(int sampleRate)
+		{
+			int blockSize = sampleRate * BlockMilis / 1000;
+			int fftSize = GetFftSize(blockSize);
+			if (fftSize == 0) return 0;
+			size_t floatCount = 4 * blockSize // window, analysis frame
+				+ 5 * fftSize // real, imaginary, twiddles, gains
+				+ blockSize // overlap-add tail
+				+ 4 * (fftSize / 2 + 1); // power, smoothed power, noise, speech power
+			return floatCount * sizeof(float) + fftSize * sizeof(uint16_t);
+		}
+
+		// suppressionDb is the most the noise is attenuated; targetLevelDb the speech level (dBFS rms)
+		// the AGC aims for. Either stage can be switched off per call with Process.
+		bool Initialize(void* storage, int sampleRate, float suppressionDb, float targetLevelDb)
+		{
+			m_BlockSize = sampleRate * BlockMilis / 1000;
+			m_FftSize = GetFftSize(m_BlockSize);
+			if (m_FftSize == 0) return false;
+			int binCount = m_FftSize / 2 + 1;
+			float* p = reinterpret_cast<float*>(storage);
+			m_pWindow = p; p += 2 * m_BlockSize;
+			m_pFrame = p; p += 2 * m_BlockSize;
+			m_pReal = p; p += m_FftSize;
+			m_pImag = p; p += m_FftSize;
+			m_pTwiddleReal = p; p += m_FftSize;
+			m_pTwiddleImag = p; p += m_FftSize;
+			m_pTail = p; p += m_BlockSize;
+			m_pPower = p; p += binCount;
+			m_pSmoothedPower = p; p += binCount;
+			m_pNoise = p; p += binCount;
+			m_pSpeechPower = p; p += binCount;
+			m_pGains = p; p += m_FftSize;
+			m_pBitReverse = reinterpret_cast<uint16_t*>(p);
+
+			const float pi = 3.14159265358979f;
+			// periodic Hann, squared window halves overlapping by one block sum to 1
+			for (int i = 0; i < 2 * m_BlockSize; i++) m_pWindow[i] = std::sqrt(0.5f - 0.5f * std::cos(pi * i / m_BlockSize));
+			// the twiddles of the stage with half size h are at index h to 2h - 1
+			for (int h = 1; h < m_FftSize; h *= 2)
+			{
+				for (int j = 0; j < h; j++)
+				{
+					m_pTwiddleReal[h + j] = std::cos(pi * j / h);
+					m_pTwiddleImag[h + j] = -std::sin(pi * j / h);
+				}
+			}
+			int bitCount = 0;
+			while ((1 << bitCount) < m_FftSize) bitCount++;
+			for (int i = 0; i < m_FftSize; i++)
+			{
+				int reversed = 0;
+				for (int b = 0; b < bitCount; b++) reversed |= ((i >> b) & 1) << (bitCount - 1 - b);
+				m_pBitReverse[i] = static_cast<uint16_t>(reversed);
+			}
+
+			m_GainFloor = std::pow(10.0f, -suppressionDb / 20.0f);
+			m_TargetLevelDb = targetLevelDb;
+			m_BlockCount = 0;
+			m_AgcGainDb = 0.0f;
+			m_AgcGain = 1.0f;
+			m_LevelFloorDb = SpeechMinimumLevelDb;
+			std::memset(m_pNoise, 0, binCount * sizeof(float));
+			std::memset(m_pSpeechPower, 0, binCount * sizeof(float));
+			Reset();
+			return true;
+		}
+
+		// Forgets the audio in flight, e.g. after a capture gap, but keeps the noise estimate and the
+		// AGC gain, which still match the room and the talker.
+		void Reset()
+		{
+			std::memset(m_pFrame, 0, m_BlockSize * sizeof(float));
+			std::memset(m_pTail, 0, m_BlockSize * sizeof(float));
+		}
+
+		// Processes blockCount whole blocks in place; each block is replaced by the one before it, so
+		// the audio comes out one block late. Blocks are suppressed with suppress, otherwise only
+		// delayed; the AGC runs with useAgc.
+		void Process(int16_t* samples, int blockCount, bool suppress, bool useAgc)
+		{
+			for (int i = 0; i < blockCount; i++)
+			{
+				int16_t* block = samples + static_cast<size_t>(i) * m_BlockSize;
+				SwitchVoiceChatSimd::ConvertInt16ToFloat(m_pFrame + m_BlockSize, block, m_BlockSize, 1.0f);
+				ProcessBlock(block, suppress, useAgc);
+			}
+		}
+
+		int GetBlockSize() const { return m_BlockSize; }
+		float GetAgcGainDb() const { return m_AgcGainDb; }
+
+	private:
+		static const int NoiseStartBlockCount = 5; // blocks taken as noise to seed the estimate
+		static constexpr float PowerSmoothing = 0.3f; // weight of the newest spectrum in the smoothed one
+		static constexpr float NoiseRise = 1.007f; // per block, about 3 dB per second
+		static constexpr float NoiseBias = 2.0f; // the minimum of the smoothed spectrum sits below the mean noise
+		static constexpr float PriorSmoothing = 0.98f; // decision-directed weight of the last block's speech estimate
+		static constexpr float SpeechMinimumLevelDb = -50.0f;
+		static constexpr float SpeechAboveFloorDb = 10.0f;
+		static constexpr float LevelFloorRiseDb = 0.05f; // per block
+		static constexpr float AgcMaxBoostDb = 24.0f;
+		static constexpr float AgcMaxCutDb = 12.0f;
+		static constexpr float AgcAttackDb = 0.5f; // per block, gain going down
+		static constexpr float AgcReleaseDb = 0.1f; // per block, gain going up
+
+		static int GetFftSize(int blockSize)
+		{
+			if (blockSize <= 0) return 0;
+			int fftSize = 1;
+			while (fftSize < 2 * blockSize) fftSize <<= 1;
+			return fftSize <= MaxFftSize ? fftSize : 0;
+		}
+
+		// In-place FFT of m_pReal / m_pImag.
+		void Transform()
+		{
+			for (int i = 0; i < m_FftSize; i++)
+			{
+				int j = m_pBitReverse[i];
+				if (j <= i) continue;
+				float r = m_pReal[i]; m_pReal[i] = m_pReal[j]; m_pReal[j] = r;
+				float m = m_pImag[i]; m_pImag[i] = m_pImag[j]; m_pImag[j] = m;
+			}
+			for (int h = 1; h < m_FftSize; h *= 2)
+			{
+				for (int g = 0; g < m_FftSize; g += 2 * h)
+				{
+					SwitchVoiceChatSimd::ComplexButterflies(m_pReal + g, m_pImag + g, m_pReal + g + h, m_pImag + g + h,
+						m_pTwiddleReal + h, m_pTwiddleImag + h, h);
+				}
+			}
+		}
+
+		// Sets m_pGains from the spectrum in m_pReal / m_pImag.
+		void UpdateGains()
+		{
+			int binCount = m_FftSize / 2 + 1;
+			SwitchVoiceChatSimd::PowerSpectrum(m_pPower, m_pReal, m_pImag, binCount);
+			bool seeding = m_BlockCount < NoiseStartBlockCount;
+			for (int k = 0; k < binCount; k++)
+			{
+				float power = m_pPower[k];
+				float smoothed = m_BlockCount == 0 ? power : m_pSmoothedPower[k] + (power - m_pSmoothedPower[k]) * PowerSmoothing;
+				m_pSmoothedPower[k] = smoothed;
+				float noise = m_pNoise[k] * NoiseRise;
+				if (seeding || smoothed < noise) noise = smoothed;
+				m_pNoise[k] = noise;
+
+				float inverseNoise = 1.0f / (noise * NoiseBias + 1e-3f);
+				float posterior = power * inverseNoise;
+				float prior = (m_BlockCount == 0 ? 0.0f : PriorSmoothing * m_pSpeechPower[k] * inverseNoise)
+					+ (1.0f - PriorSmoothing) * (posterior > 1.0f ? posterior - 1.0f : 0.0f);
+				float gain = prior / (1.0f + prior);
+				if (gain < m_GainFloor) gain = m_GainFloor;
+				m_pGains[k] = gain;
+				m_pSpeechPower[k] = gain * gain * power;
+			}
+			// mirror onto the negative frequencies, so the output stays real
+			for (int k = 1; k < m_FftSize / 2; k++) m_pGains[m_FftSize - k] = m_pGains[k];
+		}
+
+		// Turns the frame into the output for its first block, written to dest as int16.
+		void ProcessBlock(int16_t* dest, bool suppress, bool useAgc)
+		{
+			int frameSize = 2 * m_BlockSize;
+			float* output = m_pReal; // the first frameSize samples, whichever way they are made
+			if (suppress)
+			{
+				SwitchVoiceChatSimd::MultiplySamples(m_pReal, m_pFrame, m_pWindow, frameSize);
+				std::memset(m_pReal + frameSize, 0, (m_FftSize - frameSize) * sizeof(float));
+				std::memset(m_pImag, 0, m_FftSize * sizeof(float));
+				Transform();
+				UpdateGains();
+				SwitchVoiceChatSimd::MultiplySamples(m_pReal, m_pReal, m_pGains, m_FftSize);
+				SwitchVoiceChatSimd::MultiplySamples(m_pImag, m_pImag, m_pGains, m_FftSize);
+				// inverse transform: the forward one on the conjugate, whose real part is the (real) result
+				for (int i = 0; i < m_FftSize; i++) m_pImag[i] = -m_pImag[i];
+				Transform();
+				SwitchVoiceChatSimd::MultiplySamples(output, m_pReal, m_pWindow, frameSize);
+				float scale = 1.0f / m_FftSize;
+				for (int i = 0; i < frameSize; i++) output[i] *= scale;
+				m_BlockCount++;
+			}
+			else
+			{
+				// what suppression with unit gains would give, so switching either way is seamless
+				SwitchVoiceChatSimd::MultiplySamples(output, m_pFrame, m_pWindow, frameSize);
+				SwitchVoiceChatSimd::MultiplySamples(output, output, m_pWindow, frameSize);
+			}
+
+			for (int i = 0; i < m_BlockSize; i++) output[i] += m_pTail[i];
+			std::memcpy(m_pTail, output + m_BlockSize, m_BlockSize * sizeof(float));
+			std::memcpy(m_pFrame, m_pFrame + m_BlockSize, m_BlockSize * sizeof(float));
+
+			float gain = useAgc ? UpdateAgc(output) : 1.0f;
+			if (gain != m_AgcGain || gain != 1.0f)
+			{
+				// ramp from the last block's gain, so gain changes do not click
+				float step = (gain - m_AgcGain) / m_BlockSize;
+				for (int i = 0; i < m_BlockSize; i++) output[i] *= m_AgcGain + step * (i + 1);
+			}
+			m_AgcGain = gain;
+			SwitchVoiceChatSimd::ConvertFloatToInt16(dest, output, m_BlockSize, 1.0f);
+		}
+
+		// Moves the AGC gain for the block at output and returns it, linear. The level floor tracks the
+		// background the same way as the noise estimate; only blocks well above it count as speech.
+		float UpdateAgc(const float* output)
+		{
+			float meanSquare = SwitchVoiceChatSimd::DotProduct(output, output, m_BlockSize) / (m_BlockSize * 32768.0f * 32768.0f);
+			float levelDb = 10.0f * std::log10(meanSquare + 1e-10f);
+			if (levelDb < m_LevelFloorDb) m_LevelFloorDb = levelDb;
+			else m_LevelFloorDb += LevelFloorRiseDb;
+
+			if (levelDb > SpeechMinimumLevelDb && levelDb > m_LevelFloorDb + SpeechAboveFloorDb)
+			{
+				float desiredDb = m_TargetLevelDb - levelDb;
+				if (desiredDb > AgcMaxBoostDb) desiredDb = AgcMaxBoostDb;
+				else if (desiredDb < -AgcMaxCutDb) desiredDb = -AgcMaxCutDb;
+				if (desiredDb < m_AgcGainDb) m_AgcGainDb -= m_AgcGainDb - desiredDb < AgcAttackDb ? m_AgcGainDb - desiredDb : AgcAttackDb;
+				else m_AgcGainDb += desiredDb - m_AgcGainDb < AgcReleaseDb ? desiredDb - m_AgcGainDb : AgcReleaseDb;
+			}
+			float gain = std::pow(10.0f, m_AgcGainDb / 20.0f);
+
+			// never push the block into clipping
+			float peak = 0.0f;
+			for (int i = 0; i < m_BlockSize; i++) peak = std::fabs(output[i]) > peak ? std::fabs(output[i]) : peak;
+			if (peak * gain > 32767.0f) gain = 32767.0f / peak;
+			return gain;
+		}
+
+		int m_BlockSize; // samples per 10 ms
+		int m_FftSize;
+		float* m_pWindow; // square-root Hann over two blocks
+		float* m_pFrame; // the previous block followed by the current one
+		float* m_pReal;
+		float* m_pImag;
+		float* m_pTwiddleReal;
+		float* m_pTwiddleImag;
+		float* m_pTail; // second half of the last output frame, added to the next one
+		float* m_pPower;
+		float* m_pSmoothedPower;
+		float* m_pNoise;
+		float* m_pSpeechPower; // the last block's speech estimate per bin, for the a priori SNR
+		float* m_pGains; // per bin, both halves of the spectrum
+		uint16_t* m_pBitReverse;
+		int m_BlockCount; // suppressed blocks since Initialize
+		float m_GainFloor;
+		float m_TargetLevelDb;
+		float m_LevelFloorDb;
+		float m_AgcGainDb;
+		float m_AgcGain; // applied at the end of the last block
+	};
+}
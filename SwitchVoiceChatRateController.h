@@ -0,0 +1,103 @@
+#pragma once
+#include <stdint.h>
+
+namespace SwitchVoiceChatNativeCode {
+	// Picks the encoder bitrate from receiver feedback (loss rate, round-trip time, jitter).
+	// Reports are smoothed with an exponential moving average. A congested link cuts the bitrate by
+	// 15% at most every DecreaseHoldMicroSeconds; a clean link raises it by a tenth once it stayed
+	// clean for IncreaseHoldMicroSeconds. Between the two thresholds the bitrate is left alone, so
+	// a link near the limit does not make the bitrate oscillate.
+	class BitRateController
+	{
+	public:
+		static const int64_t DecreaseHoldMicroSeconds = 500 * 1000;
+		static const int64_t IncreaseHoldMicroSeconds = 3000 * 1000;
+
+		void Initialize(int bitRate, int minBitRate, int maxBitRate)
+		{
+			m_MinBitRate = minBitRate;
+			m_MaxBitRate = maxBitRate;
+			m_BitRate = Clamp(bitRate);
+			m_HasFeedback = false;
+			m_LossRate = 0.0f;
+			m_RoundTripMilis = 0.0f;
+			m_JitterMilis = 0.0f;
+			m_LastChangeTime = 0;
+			m_CleanSince = -1;
+		}
+
+		// lossRate is 0 to 1. time is in microseconds on any monotonic clock. Returns the new bitrate.
+		int Update(float lossRate, int roundTripMilis, int jitterMilis, int64_t time)
+		{
+			if (!m_HasFeedback)
+			{
+				m_LossRate = lossRate;
+				m_RoundTripMilis = static_cast<float>(roundTripMilis);
+				m_JitterMilis = static_cast<float>(jitterMilis);
+				m_LastChangeTime = time;
+				m_HasFeedback = true;
+			}
+			else
+			{
+				m_LossRate += (lossRate - m_LossRate) * Smoothing;
+				m_RoundTripMilis += (roundTripMilis - m_RoundTripMilis) * Smoothing;
+				m_JitterMilis += (jitterMilis - m_JitterMilis) * Smoothing;
+			}
+
+			bool congested = m_LossRate > CongestedLossRate || m_RoundTripMilis > CongestedRoundTripMilis || m_JitterMilis > CongestedJitterMilis;
+			bool clean = m_LossRate < CleanLossRate && m_RoundTripMilis < CleanRoundTripMilis && m_JitterMilis < CleanJitterMilis;
+
+			if (!clean) m_CleanSince = -1;
+			else if (m_CleanSince < 0) m_CleanSince = time;
+
+			if (congested && time - m_LastChangeTime >= DecreaseHoldMicroSeconds)
+			{
+				SetBitRate(m_BitRate * 85 / 100, time);
+			}
+			else if (clean && time - m_CleanSince >= IncreaseHoldMicroSeconds && time - m_LastChangeTime >= IncreaseHoldMicroSeconds)
+			{
+				SetBitRate(m_BitRate + (m_BitRate / 10 > BitRateStep ? m_BitRate / 10 : BitRateStep), time);
+			}
+			return m_BitRate;
+		}
+
+		int GetBitRate() const { return m_BitRate; }
+		float GetLossRate() const { return m_LossRate; }
+
+	private:
+		static constexpr float Smoothing = 0.25f;
+		static constexpr float CongestedLossRate = 0.08f;
+		static constexpr float CleanLossRate = 0.02f;
+		static constexpr float CongestedRoundTripMilis = 400.0f;
+		static constexpr float CleanRoundTripMilis = 250.0f;
+		static constexpr float CongestedJitterMilis = 60.0f;
+		static constexpr float CleanJitterMilis = 30.0f;
+		static const int BitRateStep = 1000; // bitrates are kept on whole kbps
+
+		int Clamp(int bitRate) const
+		{
+			bitRate = bitRate / BitRateStep * BitRateStep;
+			if (bitRate < m_MinBitRate) return m_MinBitRate;
+			if (bitRate > m_MaxBitRate) return m_MaxBitRate;
+			return bitRate;
+		}
+
+		void SetBitRate(int bitRate, int64_t time)
+		{
+			bitRate = Clamp(bitRate);
+			if (bitRate == m_BitRate) return;
+			m_BitRate = bitRate;
+			m_LastChangeTime = time;
+		}
+
+		int m_BitRate;
+		int m_MinBitRate;
+		int m_MaxBitRate;
+		bool m_HasFeedback;
+		float m_LossRate;
+		float m_RoundTripMilis;
+		float m_JitterMilis;
+		int64_t m_LastChangeTime;
+		int64_t m_CleanSince; // -1 while the link is not clean
+	};
+}
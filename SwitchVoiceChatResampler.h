@@ -0,0 +1,170 @@
+#pragma once
+#include <stdint.h>
+#include <cmath>
+#include <cstring>
+#include "SwitchVoiceChatSimd.h"
+
+namespace SwitchVoiceChatResampler {
+	// Streaming sample rate converter for mono int16 PCM, for any ratio of integer rates whose
+	// reduced form has at most MaxPhaseCount output phases (every pair of common audio rates).
+	// A windowed-sinc low-pass filter is split into one tapCount-tap filter per output phase, so each
+	// output sample is a single vectorized dot product over the input. The cutoff follows the lower of
+	// the two rates, so downsampling does not alias. The filter history is kept between calls, so the
+	// input can arrive in chunks of any size. Storage is provided by the caller.
+	class PolyphaseResampler
+	{
+	public:
+		// More taps give a steeper filter for more CPU; the delay is tapCount / 2 input samples.
+		static const int DefaultTapCount = 32;
+		static const int MinTapCount = 8;
+		static const int MaxTapCount = 64; // tapCount must also be a multiple of MinTapCount
+		static const int MaxPhaseCount = 640;
+		static const int BlockSize = 256; // input samples converted to float at a time
+
+		// Initialize can fail before it sets anything, so start from an empty state.
+		PolyphaseResampler() : m_TapCount(0), m_pCoefficients(nullptr), m_pInput(nullptr), m_InputCount(0),
+			m_Position(0), m_Phase(0), m_PhaseCount(0), m_Step(0) {}
+
+		// Floats of storage needed for the conversion from inputRate to outputRate, or 0 if the ratio
+		// or tapCount is not supported.
+		static size_t GetStorageSize(int inputRate, int outputRate, int tapCount = DefaultTapCount)
+		{
+			int phaseCount, step;
+			if (!Reduce(inputRate, outputRate, &phaseCount, &step) || !IsValidTapCount(tapCount)) return 0;
+			return static_cast<size_t>(phaseCount) * tapCount + tapCount - 1 + BlockSize;
+		}
+
+		bool Initialize(float* storage, int inputRate, int outputRate, int tapCount = DefaultTapCount)
+		{
+			if (!Reduce(inputRate, outputRate, &m_PhaseCount, &m_Step) || !IsValidTapCount(tapCount)) return false;
+			m_TapCount = tapCount;
+			m_pCoefficients = storage;
+			m_pInput = storage + static_cast<size_t>(m_PhaseCount) * tapCount;
+
+			// cutoff as a fraction of the input Nyquist frequency, a little below the lower rate's
+			float cutoff = (outputRate < inputRate ? static_cast<float>(outputRate) / inputRate : 1.0f) * 0.92f;
+			const float pi = 3.14159265358979f;
+			for (int phase = 0; phase < m_PhaseCount; phase++)
+			{
+				float* coefficients = m_pCoefficients + phase * tapCount;
+				float fraction = static_cast<float>(phase) / m_PhaseCount;
+				float sum = 0.0f;
+				for (int k = 0; k < tapCount; k++)
+				{
+					// distance from the output instant, in input samples
+					float t = k - (tapCount / 2 - 1) - fraction;
+					float sinc = t == 0.0f ? 1.0f : std::sin(pi * cutoff * t) / (pi * cutoff * t);
+					// Blackman window over the taps
+					float x = (t + tapCount / 2) / tapCount;
+					float window = 0.42f - 0.5f * std::cos(2.0f * pi * x) + 0.08f * std::cos(4.0f * pi * x);
+					coefficients[k] = sinc * (window > 0.0f ? window : 0.0f);
+					sum += coefficients[k];
+				}
+				// unity gain at DC for every phase
+				for (int k = 0; k < tapCount; k++) coefficients[k] /= sum;
+			}
+			Reset();
+			return true;
+		}
+
+		// Forgets the filter history, e.g. after a capture gap.
+		void Reset()
+		{
+			std::memset(m_pInput, 0, (m_TapCount - 1) * sizeof(float));
+			m_InputCount = m_TapCount - 1;
+			m_Position = 0;
+			m_Phase = 0;
+		}
+
+		// Upper bound of the samples Process writes for inputCount input samples.
+		size_t GetMaxOutputCount(size_t inputCount) const
+		{
+			return (inputCount + m_TapCount) * m_PhaseCount / m_Step + 1;
+		}
+
+		// The same bound before Initialize, e.g. to size the output buffer.
+		static size_t GetMaxOutputCount(int inputRate, int outputRate, size_t inputCount, int tapCount = DefaultTapCount)
+		{
+			int phaseCount, step;
+			if (!Reduce(inputRate, outputRate, &phaseCount, &step)) return 0;
+			return (inputCount + tapCount) * phaseCount / step + 1;
+		}
+
+		// Converts inputCount samples, read every stride samples from input (e.g. one channel of
+		// interleaved PCM), into output. Returns the number of samples written; output must hold
+		// GetMaxOutputCount(inputCount) samples.
+		size_t Process(const int16_t* input, size_t inputCount, size_t stride, int16_t* output)
+		{
+			size_t written = 0;
+			while (inputCount > 0)
+			{
+				size_t blockCount = inputCount < static_cast<size_t>(BlockSize) ? inputCount : BlockSize;
+				float* dest = m_pInput + m_InputCount;
+				if (stride == 1)
+				{
+					SwitchVoiceChatSimd::ConvertInt16ToFloat(dest, input, blockCount, 1.0f);
+				}
+				else
+				{
+					for (size_t i = 0; i < blockCount; i++) dest[i] = input[i * stride];
+				}
+				m_InputCount += static_cast<int>(blockCount);
+				input += blockCount * stride;
+				inputCount -= blockCount;
+
+				while (m_Position + m_TapCount <= m_InputCount)
+				{
+					float value = SwitchVoiceChatSimd::DotProduct(m_pInput + m_Position, m_pCoefficients + m_Phase * m_TapCount, m_TapCount);
+					value += value >= 0.0f ? 0.5f : -0.5f;
+					if (value > 32767.0f) value = 32767.0f;
+					else if (value < -32768.0f) value = -32768.0f;
+					output[written++] = static_cast<int16_t>(value);
+
+					m_Phase += m_Step;
+					m_Position += m_Phase / m_PhaseCount;
+					m_Phase %= m_PhaseCount;
+				}
+
+				// keep the samples the next outputs still need
+				int keep = m_InputCount - m_Position;
+				if (keep > 0) std::memmove(m_pInput, m_pInput + m_Position, keep * sizeof(float));
+				m_InputCount = keep > 0 ? keep : 0;
+				m_Position = keep >= 0 ? 0 : -keep;
+			}
+			return written;
+		}
+
+		int GetTapCount() const { return m_TapCount; }
+
+	private:
+		static bool IsValidTapCount(int tapCount)
+		{
+			return tapCount >= MinTapCount && tapCount <= MaxTapCount && tapCount % MinTapCount == 0;
+		}
+
+		// outputRate / inputRate = phaseCount / step, in lowest terms
+		static bool Reduce(int inputRate, int outputRate, int* phaseCount, int* step)
+		{
+			if (inputRate <= 0 || outputRate <= 0) return false;
+			int a = inputRate, b = outputRate;
+			while (b != 0)
+			{
+				int r = a % b;
+				a = b;
+				b = r;
+			}
+			*phaseCount = outputRate / a;
+			*step = inputRate / a;
+			return *phaseCount <= MaxPhaseCount;
+		}
+
+		int m_TapCount;
+		float* m_pCoefficients; // m_PhaseCount filters of m_TapCount taps
+		float* m_pInput; // history followed by the current block, as float
+		int m_InputCount;
+		int m_Position; // first input sample of the next output's window
+		int m_Phase; // fractional input position of the next output, in 1 / m_PhaseCount
+		int m_PhaseCount;
+		int m_Step;
+	};
+}
@@ -0,0 +1,152 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <cstring>
+
+namespace SwitchVoiceChatRingBuffer {
+	// Single-producer/single-consumer lock-free ring buffer.
+	// The producer only writes m_Tail and the consumer only writes m_Head, so capture and encode
+	// can run on different threads. Capacity is a power of two and indices are masked, never wrapped
+	// with a modulo. Storage is provided by the caller (usually carved from an nn::mem allocator).
+	// When the ring is full, Push drops the newest samples and reports how many were written.
+	template <typename T>
+	class SpscRingBuffer
+	{
+	public:
+		SpscRingBuffer() : m_pStorage(nullptr), m_Capacity(0), m_Mask(0), m_Head(0), m_Tail(0) {}
+
+		static size_t RoundUpCapacity(size_t count)
+		{
+			size_t capacity = 1;
+			while (capacity < count) capacity <<= 1;
+			return capacity;
+		}
+
+		// capacity must be a power of two (see RoundUpCapacity).
+		void Initialize(T* storage, size_t capacity)
+		{
+			m_pStorage = storage;
+			m_Capacity = capacity;
+			m_Mask = capacity - 1;
+			m_Head.store(0, std::memory_order_relaxed);
+			m_Tail.store(0, std::memory_order_relaxed);
+		}
+
+		void Finalize()
+		{
+			m_pStorage = nullptr;
+			m_Capacity = 0;
+			m_Mask = 0;
+		}
+
+		// Only safe while neither side is running.
+		void Clear()
+		{
+			m_Head.store(m_Tail.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		}
+
+		size_t Capacity() const { return m_Capacity; }
+
+		// Called by either side; exact for the caller's own end, a lower bound for the other.
+		size_t Size() const
+		{
+			return m_Tail.load(std::memory_order_acquire) - m_Head.load(std::memory_order_acquire);
+		}
+
+		bool IsEmpty() const { return Size() == 0; }
+
+		size_t FreeSpace() const { return m_Capacity - Size(); }
+
+		// Producer: appends up to count elements, returns how many were written.
+		size_t Push(const T* source, size_t count)
+		{
+			size_t tail = m_Tail.load(std::memory_order_relaxed);
+			size_t head = m_Head.load(std::memory_order_acquire);
+			size_t space = m_Capacity - (tail - head);
+			if (count > space) count = space;
+
+			size_t start = tail & m_Mask;
+			size_t firstCount = m_Capacity - start;
+			if (firstCount > count) firstCount = count;
+			std::memcpy(m_pStorage + start, source, firstCount * sizeof(T));
+			std::memcpy(m_pStorage, source + firstCount, (count - firstCount) * sizeof(T));
+
+			m_Tail.store(tail + count, std::memory_order_release);
+			return count;
+		}
+
+		// Producer: exposes up to count writable elements as at most two contiguous regions.
+		// Fill them, then call Commit with the number of elements written.
+		size_t Reserve(T** first, size_t* firstCount, T** second, size_t* secondCount, size_t count)
+		{
+			size_t tail = m_Tail.load(std::memory_order_relaxed);
+			size_t head = m_Head.load(std::memory_order_acquire);
+			size_t space = m_Capacity - (tail - head);
+			if (count > space) count = space;
+
+			size_t start = tail & m_Mask;
+			*first = m_pStorage + start;
+			*firstCount = m_Capacity - start < count ? m_Capacity - start : count;
+			*second = m_pStorage;
+			*secondCount = count - *firstCount;
+			return count;
+		}
+
+		void Commit(size_t count)
+		{
+			m_Tail.store(m_Tail.load(std::memory_order_relaxed) + count, std::memory_order_release);
+		}
+
+		// Consumer: exposes up to count readable elements as at most two contiguous regions, without copying.
+		size_t Peek(const T** first, size_t* firstCount, const T** second, size_t* secondCount, size_t count) const
+		{
+			size_t head = m_Head.load(std::memory_order_relaxed);
+			size_t tail = m_Tail.load(std::memory_order_acquire);
+			if (count > tail - head) count = tail - head;
+
+			size_t start = head & m_Mask;
+			*first = m_pStorage + start;
+			*firstCount = m_Capacity - start < count ? m_Capacity - start : count;
+			*second = m_pStorage;
+			*secondCount = count - *firstCount;
+			return count;
+		}
+
+		// Consumer: copies up to count elements to dest without consuming them.
+		size_t Peek(T* dest, size_t count) const
+		{
+			const T* first;
+			const T* second;
+			size_t firstCount, secondCount;
+			count = Peek(&first, &firstCount, &second, &secondCount, count);
+			std::memcpy(dest, first, firstCount * sizeof(T));
+			std::memcpy(dest + firstCount, second, secondCount * sizeof(T));
+			return count;
+		}
+
+		// Consumer: discards up to count elements.
+		size_t Consume(size_t count)
+		{
+			size_t head = m_Head.load(std::memory_order_relaxed);
+			size_t tail = m_Tail.load(std::memory_order_acquire);
+			if (count > tail - head) count = tail - head;
+			m_Head.store(head + count, std::memory_order_release);
+			return count;
+		}
+
+		// Consumer: copies and consumes up to count elements.
+		size_t Pop(T* dest, size_t count)
+		{
+			return Consume(Peek(dest, count));
+		}
+
+	private:
+		T* m_pStorage;
+		size_t m_Capacity;
+		size_t m_Mask;
+		// Free-running indices; the element index is (index & m_Mask).
+		// Kept on separate cache lines so the two threads do not false-share.
+		alignas(64) std::atomic<size_t> m_Head;
+		alignas(64) std::atomic<size_t> m_Tail;
+	};
+}
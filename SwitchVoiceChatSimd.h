@@ -0,0 +1,464 @@
+#pragma once
+#include <stdint.h>
+#include <cstddef>
+
+// Vectorized PCM and spectral kernels shared by the capture and decode paths.
+// NEON on device, AVX2/SSE2 on the host backend, scalar everywhere else.
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SWITCH_VOICE_CHAT_NEON
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define SWITCH_VOICE_CHAT_AVX2
+#define SWITCH_VOICE_CHAT_SSE2
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SWITCH_VOICE_CHAT_SSE2
+#endif
+
+namespace SwitchVoiceChatSimd {
+	// dest[i] = source[i] * scale
+	inline void ConvertInt16ToFloat(float* dest, const int16_t* source, size_t count, float scale)
+	{
+		size_t i = 0;
+#if defined(SWITCH_VOICE_CHAT_NEON)
+		for (; i + 8 <= count; i += 8)
+		{
+			int16x8_t s = vld1q_s16(source + i);
+			float32x4_t low = vcvtq_f32_s32(vmovl_s16(vget_low_s16(s)));
+			float32x4_t high = vcvtq_f32_s32(vmovl_s16(vget_high_s16(s)));
+			vst1q_f32(dest + i, vmulq_n_f32(low, scale));
+			vst1q_f32(dest + i + 4, vmulq_n_f32(high, scale));
+		}
+#elif defined(SWITCH_VOICE_CHAT_AVX2)
+		const __m256 scaleVector = _mm256_set1_ps(scale);
+		for (; i + 16 <= count; i += 16)
+		{
+			__m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i));
+			__m256 low = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_castsi256_si128(s)));
+			__m256 high = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_extracti128_si256(s, 1)));
+			_mm256_storeu_ps(dest + i, _mm256_mul_ps(low, scaleVector));
+			_mm256_storeu_ps(dest + i + 8, _mm256_mul_ps(high, scaleVector));
+		}
+#elif defined(SWITCH_VOICE_CHAT_SSE2)
+		const __m128 scaleVector = _mm_set1_ps(scale);
+		for (; i + 8 <= count; i += 8)
+		{
+			__m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+			// sign-extend by placing each sample in the upper half of a 32-bit lane and shifting back
+			__m128 low = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16));
+			__m128 high = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16));
+			_mm_storeu_ps(dest + i, _mm_mul_ps(low, scaleVector));
+			_mm_storeu_ps(dest + i + 4, _mm_mul_ps(high, scaleVector));
+		}
+#endif
+		for (; i < count; i++) dest[i] = static_cast<float>(source[i]) * scale;
+	}
+
+	// Sum of source[i]^2, e.g. for the frame energy.
+	inline uint64_t SumOfSquares(const int16_t* source, size_t count)
+	{
+		size_t i = 0;
+		uint64_t sum = 0;
+#if defined(SWITCH_VOICE_CHAT_NEON)
+		uint64x2_t accumulator = vdupq_n_u64(0);
+		for (; i + 8 <= count; i += 8)
+		{
+			int16x8_t s = vld1q_s16(source + i);
+			// each square fits in 31 bits, so the products can be widened as unsigned
+			uint32x4_t low = vreinterpretq_u32_s32(vmull_s16(vget_low_s16(s), vget_low_s16(s)));
+			uint32x4_t high = vreinterpretq_u32_s32(vmull_s16(vget_high_s16(s), vget_high_s16(s)));
+			accumulator = vpadalq_u32(accumulator, low);
+			accumulator = vpadalq_u32(accumulator, high);
+		}
+		sum = vgetq_lane_u64(accumulator, 0) + vgetq_lane_u64(accumulator, 1);
+#elif defined(SWITCH_VOICE_CHAT_SSE2)
+		const __m128i zero = _mm_setzero_si128();
+		__m128i accumulator = _mm_setzero_si128();
+		for (; i + 8 <= count; i += 8)
+		{
+			__m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+			// pairs of squares, at most 2 * 32768^2 which still fits in an unsigned 32-bit lane
+			__m128i pairs = _mm_madd_epi16(s, s);
+			accumulator = _mm_add_epi64(accumulator, _mm_unpacklo_epi32(pairs, zero));
+			accumulator = _mm_add_epi64(accumulator, _mm_unpackhi_epi32(pairs, zero));
+		}
+		uint64_t lanes[2];
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), accumulator);
+		sum = lanes[0] + lanes[1];
+#endif
+		for (; i < count; i++) sum += static_cast<uint64_t>(static_cast<int32_t>(source[i]) * source[i]);
+		return sum;
+	}
+
+	// stereo[2i] += mono[i] * leftGain, stereo[2i + 1] += mono[i] * rightGain
+	inline void MixMonoToStereo(float* stereo, const float* mono, size_t count, float leftGain, float rightGain)
+	{
+		size_t i = 0;
+#if defined(SWITCH_VOICE_CHAT_NEON)
+		for (; i + 4 <= count; i += 4)
+		{
+			float32x4_t m = vld1q_f32(mono + i);
+			float32x4x2_t s = vld2q_f32(stereo + 2 * i);
+			s.val[0] = vmlaq_n_f32(s.val[0], m, leftGain);
+			s.val[1] = vmlaq_n_f32(s.val[1], m, rightGain);
+			vst2q_f32(stereo + 2 * i, s);
+		}
+#elif defined(SWITCH_VOICE_CHAT_AVX2)
+		const __m256 gains = _mm256_setr_ps(leftGain, rightGain, leftGain, rightGain, leftGain, rightGain, leftGain, rightGain);
+		for (; i + 8 <= count; i += 8)
+		{
+			__m256 m = _mm256_loadu_ps(mono + i);
+			// unpack works within 128-bit lanes: low = m0 m0 m1 m1 | m4 m4 m5 m5, high = m2 m2 m3 m3 | m6 m6 m7 m7
+			__m256 low = _mm256_unpacklo_ps(m, m);
+			__m256 high = _mm256_unpackhi_ps(m, m);
+			__m256 first = _mm256_permute2f128_ps(low, high, 0x20);
+			__m256 second = _mm256_permute2f128_ps(low, high, 0x31);
+			float* s = stereo + 2 * i;
+			_mm256_storeu_ps(s, _mm256_add_ps(_mm256_loadu_ps(s), _mm256_mul_ps(first, gains)));
+			_mm256_storeu_ps(s + 8, _mm256_add_ps(_mm256_loadu_ps(s + 8), _mm256_mul_ps(second, gains)));
+		}
+#elif defined(SWITCH_VOICE_CHAT_SSE2)
+		const __m128 gains = _mm_setr_ps(leftGain, rightGain, leftGain, rightGain);
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128 m = _mm_loadu_ps(mono + i);
+			float* s = stereo + 2 * i;
+			_mm_storeu_ps(s, _mm_add_ps(_mm_loadu_ps(s), _mm_mul_ps(_mm_unpacklo_ps(m, m), gains)));
+			_mm_storeu_ps(s + 4, _mm_add_ps(_mm_loadu_ps(s + 4), _mm_mul_ps(_mm_unpackhi_ps(m, m), gains)));
+		}
+#endif
+		for (; i < count; i++)
+		{
+			stereo[2 * i] += mono[i] * leftGain;
+			stereo[2 * i + 1] += mono[i] * rightGain;
+		}
+	}
+
+	// Sum of a[i] * b[i], e.g. one output sample of a FIR filter.
+	inline float DotProduct(const float* a, const float* b, size_t count)
+	{
+		size_t i = 0;
+		float sum = 0.0f;
+#if defined(SWITCH_VOICE_CHAT_NEON)
+		float32x4_t accumulator = vdupq_n_f32(0.0f);
+		for (; i + 4 <= count; i += 4) accumulator = vmlaq_f32(accumulator, vld1q_f32(a + i), vld1q_f32(b + i));
+		float32x2_t pair = vadd_f32(vget_low_f32(accumulator), vget_high_f32(accumulator));
+		sum = vget_lane_f32(vpadd_f32(pair, pair), 0);
+#elif defined(SWITCH_VOICE_CHAT_AVX2)
+		__m256 accumulator = _mm256_setzero_ps();
+		for (; i + 8 <= count; i += 8) accumulator = _mm256_add_ps(accumulator, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+		__m128 quad = _mm_add_ps(_mm256_castps256_ps128(accumulator), _mm256_extractf128_ps(accumulator, 1));
+		quad = _mm_add_ps(quad, _mm_movehl_ps(quad, quad));
+		sum = _mm_cvtss_f32(_mm_add_ss(quad, _mm_shuffle_ps(quad, quad, 1)));
+#elif defined(SWITCH_VOICE_CHAT_SSE2)
+		__m128 accumulator = _mm_setzero_ps();
+		for (; i + 4 <= count; i += 4) accumulator = _mm_add_ps(accumulator, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+		accumulator = _mm_add_ps(accumulator, _mm_movehl_ps(accumulator, accumulator));
+		sum = _mm_cvtss_f32(_mm_add_ss(accumulator, _mm_shuffle_ps(accumulator, accumulator, 1)));
+#endif
+		for (; i < count; i++) sum += a[i] * b[i];
+		return sum;
+	}
+
+	// Saturates samples to [-limit, limit].
+	inline void ClampSamples(float* samples, size_t count, float limit)
+	{
+		size_t i = 0;
+#if defined(SWITCH_VOICE_CHAT_NEON)
+		const float32x4_t high = vdupq_n_f32(limit);
+		const float32x4_t low = vdupq_n_f32(-limit);
+		for (; i + 4 <= count; i += 4) vst1q_f32(samples + i, vmaxq_f32(vminq_f32(vld1q_f32(samples + i), high), low));
+#elif defined(SWITCH_VOICE_CHAT_AVX2)
+		const __m256 high = _mm256_set1_ps(limit);
+		const __m256 low = _mm256_set1_ps(-limit);
+		for (; i + 8 <= count; i += 8) _mm256_storeu_ps(samples + i, _mm256_max_ps(_mm256_min_ps(_mm256_loadu_ps(samples + i), high), low));
+#elif defined(SWITCH_VOICE_CHAT_SSE2)
+		const __m128 high = _mm_set1_ps(limit);
+		const __m128 low = _mm_set1_ps(-limit);
+		for (; i + 4 <= count; i += 4) _mm_storeu_ps(samples + i, _mm_max_ps(_mm_min_ps(_mm_loadu_ps(samples + i), high), low));
+#endif
+		for (; i < count; i++)
+		{
+			if (samples[i] > limit) samples[i] = limit;
+			else if (samples[i] < -limit) samples[i] = -limit;
+		}
+	}
+
+	// Running results of ProcessCapture, zeroed by the caller before the first call.
+	struct CaptureLevels
+	{
+		float inputSum; // mono input before DC removal and gain, for the DC estimate
+		float peak; // largest |dest[i]|
+		float sumOfSquares; // of dest
+	};
+
+	// Capture front-end in one pass over interleaved PCM of channelCount channels: mono[i] is channel 0
+	// of frame i, or the mean of every channel with downmix, and dest[i] = saturate((mono[i] - dcOffset)
+	// * gain), rounded. The levels of dest are added to levels. dest may be source, for in-place use.
+	inline void ProcessCapture(int16_t* dest, const int16_t* source, size_t count, int channelCount, bool downmix, float dcOffset, float gain, CaptureLevels* levels)
+	{
+		size_t i = 0;
+		float inputSum = 0.0f;
+		float peak = 0.0f;
+		float sumOfSquares = 0.0f;
+#if defined(SWITCH_VOICE_CHAT_NEON)
+		if (channelCount <= 2)
+		{
+			const float32x4_t offset = vdupq_n_f32(dcOffset);
+			const float32x4_t high = vdupq_n_f32(32767.0f);
+			const float32x4_t low = vdupq_n_f32(-32768.0f);
+			const uint32x4_t signMask = vdupq_n_u32(0x80000000u);
+			const uint32x4_t half = vreinterpretq_u32_f32(vdupq_n_f32(0.5f));
+			float32x4_t inputAccumulator = vdupq_n_f32(0.0f);
+			float32x4_t peakAccumulator = vdupq_n_f32(0.0f);
+			float32x4_t squareAccumulator = vdupq_n_f32(0.0f);
+			for (; i + 8 <= count; i += 8)
+			{
+				float32x4_t x[2];
+				if (channelCount == 1)
+				{
+					int16x8_t s = vld1q_s16(source + i);
+					x[0] = vcvtq_f32_s32(vmovl_s16(vget_low_s16(s)));
+					x[1] = vcvtq_f32_s32(vmovl_s16(vget_high_s16(s)));
+				}
+				else
+				{
+					int16x8x2_t s = vld2q_s16(source + 2 * i);
+					if (downmix)
+					{
+						x[0] = vmulq_n_f32(vcvtq_f32_s32(vaddl_s16(vget_low_s16(s.val[0]), vget_low_s16(s.val[1]))), 0.5f);
+						x[1] = vmulq_n_f32(vcvtq_f32_s32(vaddl_s16(vget_high_s16(s.val[0]), vget_high_s16(s.val[1]))), 0.5f);
+					}
+					else
+					{
+						x[0] = vcvtq_f32_s32(vmovl_s16(vget_low_s16(s.val[0])));
+						x[1] = vcvtq_f32_s32(vmovl_s16(vget_high_s16(s.val[0])));
+					}
+				}
+				int16x4_t y[2];
+				for (int k = 0; k < 2; k++)
+				{
+					inputAccumulator = vaddq_f32(inputAccumulator, x[k]);
+					float32x4_t v = vmaxq_f32(vminq_f32(vmulq_n_f32(vsubq_f32(x[k], offset), gain), high), low);
+					peakAccumulator = vmaxq_f32(peakAccumulator, vabsq_f32(v));
+					squareAccumulator = vmlaq_f32(squareAccumulator, v, v);
+					// round half away from zero: add 0.5 with the sign of v, then truncate
+					float32x4_t rounding = vreinterpretq_f32_u32(vorrq_u32(vandq_u32(vreinterpretq_u32_f32(v), signMask), half));
+					y[k] = vqmovn_s32(vcvtq_s32_f32(vaddq_f32(v, rounding)));
+				}
+				vst1q_s16(dest + i, vcombine_s16(y[0], y[1]));
+			}
+			float32x2_t pair = vadd_f32(vget_low_f32(inputAccumulator), vget_high_f32(inputAccumulator));
+			inputSum = vget_lane_f32(vpadd_f32(pair, pair), 0);
+			pair = vpmax_f32(vget_low_f32(peakAccumulator), vget_high_f32(peakAccumulator));
+			peak = vget_lane_f32(vpmax_f32(pair, pair), 0);
+			pair = vadd_f32(vget_low_f32(squareAccumulator), vget_high_f32(squareAccumulator));
+			sumOfSquares = vget_lane_f32(vpadd_f32(pair, pair), 0);
+		}
+#elif defined(SWITCH_VOICE_CHAT_SSE2)
+		if (channelCount <= 2)
+		{
+			const __m128 offset = _mm_set1_ps(dcOffset);
+			const __m128 scale = _mm_set1_ps(gain);
+			const __m128 high = _mm_set1_ps(32767.0f);
+			const __m128 low = _mm_set1_ps(-32768.0f);
+			const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+			const __m128 signMask = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+			const __m128 half = _mm_set1_ps(0.5f);
+			__m128 inputAccumulator = _mm_setzero_ps();
+			__m128 peakAccumulator = _mm_setzero_ps();
+			__m128 squareAccumulator = _mm_setzero_ps();
+			for (; i + 8 <= count; i += 8)
+			{
+				__m128 x[2];
+				if (channelCount == 1)
+				{
+					__m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+					x[0] = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16));
+					x[1] = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16));
+				}
+				else
+				{
+					for (int k = 0; k < 2; k++)
+					{
+						// four stereo frames: channel 0 in the low half of each 32-bit lane, channel 1 in the high half
+						__m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + 2 * i + 8 * k));
+						__m128i left = _mm_srai_epi32(_mm_slli_epi32(s, 16), 16);
+						x[k] = downmix ? _mm_mul_ps(_mm_cvtepi32_ps(_mm_add_epi32(left, _mm_srai_epi32(s, 16))), _mm_set1_ps(0.5f)) : _mm_cvtepi32_ps(left);
+					}
+				}
+				__m128i y[2];
+				for (int k = 0; k < 2; k++)
+				{
+					inputAccumulator = _mm_add_ps(inputAccumulator, x[k]);
+					__m128 v = _mm_max_ps(_mm_min_ps(_mm_mul_ps(_mm_sub_ps(x[k], offset), scale), high), low);
+					peakAccumulator = _mm_max_ps(peakAccumulator, _mm_and_ps(v, absMask));
+					squareAccumulator = _mm_add_ps(squareAccumulator, _mm_mul_ps(v, v));
+					// round half away from zero like the other paths: add 0.5 with the sign of v, then truncate
+					y[k] = _mm_cvttps_epi32(_mm_add_ps(v, _mm_or_ps(_mm_and_ps(v, signMask), half)));
+				}
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i), _mm_packs_epi32(y[0], y[1]));
+			}
+			inputAccumulator = _mm_add_ps(inputAccumulator, _mm_movehl_ps(inputAccumulator, inputAccumulator));
+			inputSum = _mm_cvtss_f32(_mm_add_ss(inputAccumulator, _mm_shuffle_ps(inputAccumulator, inputAccumulator, 1)));
+			peakAccumulator = _mm_max_ps(peakAccumulator, _mm_movehl_ps(peakAccumulator, peakAccumulator));
+			peak = _mm_cvtss_f32(_mm_max_ss(peakAccumulator, _mm_shuffle_ps(peakAccumulator, peakAccumulator, 1)));
+			squareAccumulator = _mm_add_ps(squareAccumulator, _mm_movehl_ps(squareAccumulator, squareAccumulator));
+			sumOfSquares = _mm_cvtss_f32(_mm_add_ss(squareAccumulator, _mm_shuffle_ps(squareAccumulator, squareAccumulator, 1)));
+		}
+#endif
+		for (; i < count; i++)
+		{
+			const int16_t* frame = source + i * channelCount;
+			float x = frame[0];
+			if (downmix)
+			{
+				for (int c = 1; c < channelCount; c++) x += frame[c];
+				x /= channelCount;
+			}
+			inputSum += x;
+			float v = (x - dcOffset) * gain;
+			if (v > 32767.0f) v = 32767.0f;
+			else if (v < -32768.0f) v = -32768.0f;
+			float magnitude = v >= 0.0f ? v : -v;
+			if (magnitude > peak) peak = magnitude;
+			sumOfSquares += v * v;
+			dest[i] = static_cast<int16_t>(v + (v >= 0.0f ? 0.5f : -0.5f));
+		}
+		levels->inputSum += inputSum;
+		if (peak > levels->peak) levels->peak = peak;
+		levels->sumOfSquares += sumOfSquares;
+	}
+
+	// dest[i] = round(source[i] * scale), saturated to int16.
+	inline void ConvertFloatToInt16(int16_t* dest, const float* source, size_t count, float scale)
+	{
+		size_t i = 0;
+#if defined(SWITCH_VOICE_CHAT_NEON)
+		const float32x4_t high = vdupq_n_f32(32767.0f);
+		const float32x4_t low = vdupq_n_f32(-32768.0f);
+		const uint32x4_t signMask = vdupq_n_u32(0x80000000u);
+		const uint32x4_t half = vreinterpretq_u32_f32(vdupq_n_f32(0.5f));
+		for (; i + 8 <= count; i += 8)
+		{
+			int16x4_t y[2];
+			for (int k = 0; k < 2; k++)
+			{
+				float32x4_t v = vmaxq_f32(vminq_f32(vmulq_n_f32(vld1q_f32(source + i + 4 * k), scale), high), low);
+				float32x4_t rounding = vreinterpretq_f32_u32(vorrq_u32(vandq_u32(vreinterpretq_u32_f32(v), signMask), half));
+				y[k] = vqmovn_s32(vcvtq_s32_f32(vaddq_f32(v, rounding)));
+			}
+			vst1q_s16(dest + i, vcombine_s16(y[0], y[1]));
+		}
+#elif defined(SWITCH_VOICE_CHAT_SSE2)
+		const __m128 scaleVector = _mm_set1_ps(scale);
+		const __m128 high = _mm_set1_ps(32767.0f);
+		const __m128 low = _mm_set1_ps(-32768.0f);
+		const __m128 signMask = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+		const __m128 half = _mm_set1_ps(0.5f);
+		for (; i + 8 <= count; i += 8)
+		{
+			__m128i y[2];
+			for (int k = 0; k < 2; k++)
+			{
+				__m128 v = _mm_max_ps(_mm_min_ps(_mm_mul_ps(_mm_loadu_ps(source + i + 4 * k), scaleVector), high), low);
+				// round half away from zero, as above
+				y[k] = _mm_cvttps_epi32(_mm_add_ps(v, _mm_or_ps(_mm_and_ps(v, signMask), half)));
+			}
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i), _mm_packs_epi32(y[0], y[1]));
+		}
+#endif
+		for (; i < count; i++)
+		{
+			float v = source[i] * scale;
+			if (v > 32767.0f) v = 32767.0f;
+			else if (v < -32768.0f) v = -32768.0f;
+			dest[i] = static_cast<int16_t>(v + (v >= 0.0f ? 0.5f : -0.5f));
+		}
+	}
+
+	// dest[i] = a[i] * b[i], e.g. a window or per-bin gains. dest may be a or b.
+	inline void MultiplySamples(float* dest, const float* a, const float* b, size_t count)
+	{
+		size_t i = 0;
+#if defined(SWITCH_VOICE_CHAT_NEON)
+		for (; i + 4 <= count; i += 4) vst1q_f32(dest + i, vmulq_f32(vld1q_f32(a + i), vld1q_f32(b + i)));
+#elif defined(SWITCH_VOICE_CHAT_AVX2)
+		for (; i + 8 <= count; i += 8) _mm256_storeu_ps(dest + i, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+#elif defined(SWITCH_VOICE_CHAT_SSE2)
+		for (; i + 4 <= count; i += 4) _mm_storeu_ps(dest + i, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+#endif
+		for (; i < count; i++) dest[i] = a[i] * b[i];
+	}
+
+	// power[i] = real[i]^2 + imag[i]^2
+	inline void PowerSpectrum(float* power, const float* real, const float* imag, size_t count)
+	{
+		size_t i = 0;
+#if defined(SWITCH_VOICE_CHAT_NEON)
+		for (; i + 4 <= count; i += 4)
+		{
+			float32x4_t r = vld1q_f32(real + i);
+			float32x4_t m = vld1q_f32(imag + i);
+			vst1q_f32(power + i, vmlaq_f32(vmulq_f32(r, r), m, m));
+		}
+#elif defined(SWITCH_VOICE_CHAT_SSE2)
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128 r = _mm_loadu_ps(real + i);
+			__m128 m = _mm_loadu_ps(imag + i);
+			_mm_storeu_ps(power + i, _mm_add_ps(_mm_mul_ps(r, r), _mm_mul_ps(m, m)));
+		}
+#endif
+		for (; i < count; i++) power[i] = real[i] * real[i] + imag[i] * imag[i];
+	}
+
+	// count radix-2 FFT butterflies on split complex data: t = x1 * twiddle, x1 = x0 - t, x0 = x0 + t.
+	inline void ComplexButterflies(float* real0, float* imag0, float* real1, float* imag1, const float* twiddleReal, const float* twiddleImag, size_t count)
+	{
+		size_t i = 0;
+#if defined(SWITCH_VOICE_CHAT_NEON)
+		for (; i + 4 <= count; i += 4)
+		{
+			float32x4_t r1 = vld1q_f32(real1 + i);
+			float32x4_t m1 = vld1q_f32(imag1 + i);
+			float32x4_t wr = vld1q_f32(twiddleReal + i);
+			float32x4_t wi = vld1q_f32(twiddleImag + i);
+			float32x4_t tr = vmlsq_f32(vmulq_f32(r1, wr), m1, wi);
+			float32x4_t ti = vmlaq_f32(vmulq_f32(r1, wi), m1, wr);
+			float32x4_t r0 = vld1q_f32(real0 + i);
+			float32x4_t m0 = vld1q_f32(imag0 + i);
+			vst1q_f32(real1 + i, vsubq_f32(r0, tr));
+			vst1q_f32(imag1 + i, vsubq_f32(m0, ti));
+			vst1q_f32(real0 + i, vaddq_f32(r0, tr));
+			vst1q_f32(imag0 + i, vaddq_f32(m0, ti));
+		}
+#elif defined(SWITCH_VOICE_CHAT_SSE2)
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128 r1 = _mm_loadu_ps(real1 + i);
+			__m128 m1 = _mm_loadu_ps(imag1 + i);
+			__m128 wr = _mm_loadu_ps(twiddleReal + i);
+			__m128 wi = _mm_loadu_ps(twiddleImag + i);
+			__m128 tr = _mm_sub_ps(_mm_mul_ps(r1, wr), _mm_mul_ps(m1, wi));
+			__m128 ti = _mm_add_ps(_mm_mul_ps(r1, wi), _mm_mul_ps(m1, wr));
+			__m128 r0 = _mm_loadu_ps(real0 + i);
+			__m128 m0 = _mm_loadu_ps(imag0 + i);
+			_mm_storeu_ps(real1 + i, _mm_sub_ps(r0, tr));
+			_mm_storeu_ps(imag1 + i, _mm_sub_ps(m0, ti));
+			_mm_storeu_ps(real0 + i, _mm_add_ps(r0, tr));
+			_mm_storeu_ps(imag0 + i, _mm_add_ps(m0, ti));
+		}
+#endif
+		for (; i < count; i++)
+		{
+			float tr = real1[i] * twiddleReal[i] - imag1[i] * twiddleImag[i];
+			float ti = real1[i] * twiddleImag[i] + imag1[i] * twiddleReal[i];
+			real1[i] = real0[i] - tr;
+			imag1[i] = imag0[i] - ti;
+			real0[i] += tr;
+			imag0[i] += ti;
+		}
+	}
+}
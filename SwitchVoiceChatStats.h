@@ -0,0 +1,64 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+
+// Counters and latency histograms for production telemetry. Recording is a few relaxed atomic
+// increments, so it stays on in release builds; readers get a snapshot that may mix values from
+// two frames, which is fine for monitoring.
+namespace SwitchVoiceChatStats {
+	// Bucket 0 counts values below 16 us, bucket i counts [8 << i, 16 << i) us, and the last bucket
+	// everything from 8 << (LatencyBucketCount - 1) us (about 262 ms) up.
+	const int LatencyBucketCount = 16;
+
+	struct LatencyHistogramData
+	{
+		uint32_t bucketCounts[LatencyBucketCount];
+		uint32_t count;
+		uint32_t maxMicroSeconds;
+		uint64_t totalMicroSeconds; // divide by count for the mean
+	};
+
+	// Lower bound of a bucket in microseconds.
+	inline uint32_t GetLatencyBucketMicroSeconds(int bucket)
+	{
+		return bucket == 0 ? 0 : 8u << bucket;
+	}
+
+	class LatencyHistogram
+	{
+	public:
+		void Reset()
+		{
+			for (int i = 0; i < LatencyBucketCount; i++) m_BucketCounts[i].store(0, std::memory_order_relaxed);
+			m_Count.store(0, std::memory_order_relaxed);
+			m_MaxMicroSeconds.store(0, std::memory_order_relaxed);
+			m_TotalMicroSeconds.store(0, std::memory_order_relaxed);
+		}
+
+		void Record(int64_t microSeconds)
+		{
+			uint32_t value = microSeconds < 0 ? 0 : (microSeconds > UINT32_MAX ? UINT32_MAX : static_cast<uint32_t>(microSeconds));
+			int bucket = 0;
+			for (uint32_t v = value >> 3; v > 1 && bucket < LatencyBucketCount - 1; v >>= 1) bucket++;
+			m_BucketCounts[bucket].fetch_add(1, std::memory_order_relaxed);
+			m_Count.fetch_add(1, std::memory_order_relaxed);
+			m_TotalMicroSeconds.fetch_add(value, std::memory_order_relaxed);
+			// no compare-exchange loop: two threads recording at once may keep the smaller maximum
+			if (value > m_MaxMicroSeconds.load(std::memory_order_relaxed)) m_MaxMicroSeconds.store(value, std::memory_order_relaxed);
+		}
+
+		void Read(LatencyHistogramData* data) const
+		{
+			for (int i = 0; i < LatencyBucketCount; i++) data->bucketCounts[i] = m_BucketCounts[i].load(std::memory_order_relaxed);
+			data->count = m_Count.load(std::memory_order_relaxed);
+			data->maxMicroSeconds = m_MaxMicroSeconds.load(std::memory_order_relaxed);
+			data->totalMicroSeconds = m_TotalMicroSeconds.load(std::memory_order_relaxed);
+		}
+
+	private:
+		std::atomic<uint32_t> m_BucketCounts[LatencyBucketCount];
+		std::atomic<uint32_t> m_Count;
+		std::atomic<uint32_t> m_MaxMicroSeconds;
+		std::atomic<uint64_t> m_TotalMicroSeconds;
+	};
+}